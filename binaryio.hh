@@ -0,0 +1,242 @@
+// Binaryio.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Helpers shared by the snapshot and journal files: little-endian encoding of integers and length-prefixed
+// strings into a byte buffer and back, the FNV-1a checksum and a read-only view of a whole file, which is
+// memory mapped where the platform supports it.
+
+#ifndef BINARYIO_HH
+#define BINARYIO_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BINARYIO_USE_MMAP 1
+#endif
+
+inline std::uint64_t fnv1a(unsigned char const* data, std::size_t size)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Appends little-endian values to a byte buffer
+class ByteWriter
+{
+public:
+    template <typename T>
+    void put(T value)
+    {
+        static_assert(std::is_integral_v<T>, "Only integers are written directly");
+        auto bits = static_cast<std::make_unsigned_t<T>>(value);
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            bytes.push_back(static_cast<unsigned char>(bits >> (8 * i)));
+        }
+    }
+
+    void put_string(std::string const& text)
+    {
+        put<std::uint32_t>(text.size());
+        bytes.insert(bytes.end(), text.begin(), text.end());
+    }
+
+    template <typename Range>
+    void put_array(Range const& values)
+    {
+        put<std::uint32_t>(std::distance(values.begin(), values.end()));
+        for (auto value : values) {
+            put(value);
+        }
+    }
+
+    std::vector<unsigned char> bytes;
+};
+
+// Reads little-endian values from a byte range. Reading past the end yields zeros and sets failed, so the
+// loader only has to check the flag once per record.
+class ByteReader
+{
+public:
+    ByteReader(unsigned char const* data, std::size_t size) : pos(data), end(data + size) {}
+
+    template <typename T>
+    T get()
+    {
+        if (static_cast<std::size_t>(end - pos) < sizeof(T)) {
+            failed = true;
+            pos = end;
+            return T{};
+        }
+        std::make_unsigned_t<T> bits = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            bits |= static_cast<std::make_unsigned_t<T>>(pos[i]) << (8 * i);
+        }
+        pos += sizeof(T);
+        return static_cast<T>(bits);
+    }
+
+    std::string get_string()
+    {
+        std::uint32_t size = get<std::uint32_t>();
+        if (static_cast<std::size_t>(end - pos) < size) {
+            failed = true;
+            pos = end;
+            return {};
+        }
+        std::string text(reinterpret_cast<char const*>(pos), size);
+        pos += size;
+        return text;
+    }
+
+    // Reads a u32 element count, rejecting counts that could not fit in the remaining bytes
+    std::uint32_t get_count(std::size_t element_size)
+    {
+        std::uint32_t count = get<std::uint32_t>();
+        if (count > static_cast<std::size_t>(end - pos) / element_size) {
+            failed = true;
+            pos = end;
+            return 0;
+        }
+        return count;
+    }
+
+    bool at_end() const { return pos == end; }
+
+    bool failed = false;
+
+private:
+    unsigned char const* pos;
+    unsigned char const* end;
+};
+
+// Read-only view of a whole file, memory mapped where the platform supports it
+class MappedFile
+{
+public:
+    explicit MappedFile(std::string const& filename)
+    {
+#ifdef BINARYIO_USE_MMAP
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat status;
+        if (::fstat(fd, &status) == 0 && status.st_size > 0) {
+            void* mapping = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                ::madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<unsigned char const*>(mapping);
+                size_ = status.st_size;
+                mapped_ = true;
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream input(filename, std::ios::binary);
+        if (input) {
+            buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+            data_ = reinterpret_cast<unsigned char const*>(buffer_.data());
+            size_ = buffer_.size();
+        }
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef BINARYIO_USE_MMAP
+        if (mapped_) {
+            ::munmap(const_cast<unsigned char*>(data_), size_);
+        }
+#endif
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    unsigned char const* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    unsigned char const* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> buffer_;
+};
+
+// Replaces a file with the concatenation of the given buffers so that a crash leaves either the old or the new
+// contents: they are written to a temporary file next to it, which is synced and renamed over the file, and the
+// directory is synced so that the rename itself survives. Returns false if any step fails, in which case the
+// file may still hold the old contents, or the new ones without them being known to be durable.
+inline bool replace_file(std::string const& filename, std::initializer_list<std::vector<unsigned char> const*> parts)
+{
+    std::string temporary = filename + ".tmp";
+#ifdef BINARYIO_USE_MMAP
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = true;
+    for (auto const* part : parts) {
+        for (std::size_t done = 0; written && done < part->size(); ) {
+            ssize_t count = ::write(fd, part->data() + done, part->size() - done);
+            if (count < 0 && errno != EINTR) {
+                written = false;
+            } else if (count > 0) {
+                done += count;
+            }
+        }
+    }
+    written = ::fsync(fd) == 0 && written;
+    written = ::close(fd) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+    int directory_fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (directory_fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(directory_fd) == 0;
+    ::close(directory_fd);
+    return synced;
+#else
+    // Without POSIX there is no portable way to sync, but the rename still keeps a torn file from replacing the old one
+    {
+        std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+        for (auto const* part : parts) {
+            output.write(reinterpret_cast<char const*>(part->data()), part->size());
+        }
+        output.close();
+        if (!output) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, filename, error);
+    return !error;
+#endif
+}
+
+#endif // BINARYIO_HH
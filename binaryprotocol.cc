@@ -0,0 +1,290 @@
+// Binaryprotocol.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "binaryprotocol.hh"
+
+#include <algorithm>
+
+namespace
+{
+
+// Utility function: whether the arguments were read without running out of bytes and nothing is left over
+bool complete(ByteReader const& reader)
+{
+    return !reader.failed && reader.at_end();
+}
+
+void put_bool(ByteWriter& writer, bool value)
+{
+    writer.put<std::uint8_t>(value ? 1 : 0);
+}
+
+}
+
+void BinaryProtocol::execute(SharedDatastructures& ds, unsigned char const* request, std::size_t size, ByteWriter& response)
+{
+    ByteReader reader(request, size);
+    std::uint32_t request_id = reader.get<std::uint32_t>();
+    auto opcode = static_cast<Opcode>(reader.get<std::uint8_t>());
+
+    response.put(request_id);
+    std::size_t status_at = response.bytes.size();
+    response.put(static_cast<std::uint8_t>(Status::OK));
+
+    // The arguments are decoded and checked before the operation runs, so a malformed request changes nothing
+    Status status = Status::OK;
+    try {
+        switch (opcode) {
+        case Opcode::AFFILIATION_COUNT:
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put<std::uint32_t>(ds.get_affiliation_count());
+            break;
+        case Opcode::ALL_AFFILIATIONS:
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_all_affiliations());
+            break;
+        case Opcode::AFFILIATION_RECORDS: {
+            auto ids = get_strings(reader);
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put<std::uint32_t>(ids.size());
+            for (auto const& id : ids) {
+                response.put_string(id);
+                response.put_string(ds.get_affiliation_name(id));
+                put_coord(response, ds.get_affiliation_coord(id));
+            }
+            break;
+        }
+        case Opcode::AFFILIATIONS_ALPHABETICALLY:
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_affiliations_alphabetically());
+            break;
+        case Opcode::AFFILIATIONS_DISTANCE_INCREASING:
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_affiliations_distance_increasing());
+            break;
+        case Opcode::FIND_AFFILIATION_WITH_COORD: {
+            Coord xy = get_coord(reader);
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put_string(ds.find_affiliation_with_coord(xy));
+            break;
+        }
+        case Opcode::AFFILIATIONS_CLOSEST_TO: {
+            Coord xy = get_coord(reader);
+            auto k = reader.get<std::uint32_t>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_affiliations_closest_to(xy, k));
+            break;
+        }
+        case Opcode::AFFILIATIONS_WITHIN: {
+            Coord xy = get_coord(reader);
+            auto radius = reader.get<Distance>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_affiliations_within(xy, radius));
+            break;
+        }
+        case Opcode::AFFILIATIONS_IN_RECT: {
+            Coord min = get_coord(reader);
+            Coord max = get_coord(reader);
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_affiliations_in_rect(min, max));
+            break;
+        }
+        case Opcode::ADD_AFFILIATION: {
+            auto id = reader.get_string();
+            auto name = reader.get_string();
+            Coord xy = get_coord(reader);
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.add_affiliation(id, name, xy));
+            break;
+        }
+        case Opcode::CHANGE_AFFILIATION_COORD: {
+            auto id = reader.get_string();
+            Coord xy = get_coord(reader);
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.change_affiliation_coord(id, xy));
+            break;
+        }
+        case Opcode::REMOVE_AFFILIATION: {
+            auto id = reader.get_string();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.remove_affiliation(id));
+            break;
+        }
+        case Opcode::ALL_PUBLICATIONS:
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put_array(ds.all_publications());
+            break;
+        case Opcode::PUBLICATION_RECORDS: {
+            std::uint32_t count = reader.get_count(sizeof(PublicationID));
+            std::vector<PublicationID> ids(count);
+            for (auto& id : ids) {
+                id = reader.get<PublicationID>();
+            }
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put<std::uint32_t>(count);
+            for (auto id : ids) {
+                response.put(id);
+                response.put_string(ds.get_publication_name(id));
+                response.put(ds.get_publication_year(id));
+                response.put(ds.get_parent(id));
+            }
+            break;
+        }
+        case Opcode::PUBLICATION_AFFILIATIONS: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_strings(response, ds.get_affiliations(id));
+            break;
+        }
+        case Opcode::PUBLICATIONS: {
+            auto id = reader.get_string();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put_array(ds.get_publications(id));
+            break;
+        }
+        case Opcode::PUBLICATIONS_AFTER: {
+            auto id = reader.get_string();
+            auto year = reader.get<Year>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            auto publications = ds.get_publications_after(id, year);
+            response.put<std::uint32_t>(publications.size());
+            for (auto const& [publication_year, publication] : publications) {
+                response.put(publication_year);
+                response.put(publication);
+            }
+            break;
+        }
+        case Opcode::PARENT: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put(ds.get_parent(id));
+            break;
+        }
+        case Opcode::DIRECT_REFERENCES: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put_array(ds.get_direct_references(id));
+            break;
+        }
+        case Opcode::ALL_REFERENCES: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put_array(ds.get_all_references(id));
+            break;
+        }
+        case Opcode::REFERENCED_BY_CHAIN: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put_array(ds.get_referenced_by_chain(id));
+            break;
+        }
+        case Opcode::COUNT_ALL_REFERENCES: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put<std::int32_t>(ds.count_all_references(id));
+            break;
+        }
+        case Opcode::CLOSEST_COMMON_PARENT: {
+            auto id1 = reader.get<PublicationID>();
+            auto id2 = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            response.put(ds.get_closest_common_parent(id1, id2));
+            break;
+        }
+        case Opcode::ADD_PUBLICATION: {
+            auto id = reader.get<PublicationID>();
+            auto name = reader.get_string();
+            auto year = reader.get<Year>();
+            auto affiliations = get_strings(reader);
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.add_publication(id, name, year, affiliations));
+            break;
+        }
+        case Opcode::ADD_AFFILIATION_TO_PUBLICATION: {
+            auto affiliation = reader.get_string();
+            auto publication = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.add_affiliation_to_publication(affiliation, publication));
+            break;
+        }
+        case Opcode::ADD_REFERENCE: {
+            auto id = reader.get<PublicationID>();
+            auto parent = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.add_reference(id, parent));
+            break;
+        }
+        case Opcode::REMOVE_PUBLICATION: {
+            auto id = reader.get<PublicationID>();
+            if (!complete(reader)) { status = Status::MALFORMED_REQUEST; break; }
+            put_bool(response, ds.remove_publication(id));
+            break;
+        }
+        default:
+            status = reader.failed ? Status::MALFORMED_REQUEST : Status::UNKNOWN_OPCODE;
+            break;
+        }
+    } catch (NotImplemented const&) {
+        status = Status::NOT_IMPLEMENTED;
+    }
+
+    // A failed request has no result, whatever was written of it is dropped
+    if (status != Status::OK) {
+        response.bytes.resize(status_at);
+        response.put(static_cast<std::uint8_t>(status));
+    }
+}
+
+std::size_t BinaryProtocol::start_frame(ByteWriter& writer)
+{
+    std::size_t start = writer.bytes.size();
+    writer.put<std::uint32_t>(0);
+    return start;
+}
+
+void BinaryProtocol::end_frame(ByteWriter& writer, std::size_t start)
+{
+    auto size = static_cast<std::uint32_t>(writer.bytes.size() - start - FRAME_HEADER_SIZE);
+    for (std::size_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+        writer.bytes[start + i] = static_cast<unsigned char>(size >> (8 * i));
+    }
+}
+
+std::uint32_t BinaryProtocol::payload_size(unsigned char const* data, std::size_t size)
+{
+    ByteReader reader(data, std::min(size, FRAME_HEADER_SIZE));
+    return reader.get<std::uint32_t>();
+}
+
+void BinaryProtocol::put_coord(ByteWriter& writer, Coord xy)
+{
+    writer.put<std::int32_t>(xy.x);
+    writer.put<std::int32_t>(xy.y);
+}
+
+Coord BinaryProtocol::get_coord(ByteReader& reader)
+{
+    Coord xy;
+    xy.x = reader.get<std::int32_t>();
+    xy.y = reader.get<std::int32_t>();
+    return xy;
+}
+
+void BinaryProtocol::put_strings(ByteWriter& writer, std::vector<std::string> const& strings)
+{
+    writer.put<std::uint32_t>(strings.size());
+    for (auto const& text : strings) {
+        writer.put_string(text);
+    }
+}
+
+std::vector<std::string> BinaryProtocol::get_strings(ByteReader& reader)
+{
+    // Every string takes at least its length field
+    std::vector<std::string> strings(reader.get_count(sizeof(std::uint32_t)));
+    for (auto& text : strings) {
+        text = reader.get_string();
+    }
+    return strings;
+}
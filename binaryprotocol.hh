@@ -0,0 +1,108 @@
+// Binaryprotocol.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Compact binary protocol of the query server, for clients that don't need the text output. A connection speaks
+// it if it starts with the four HELLO bytes, which can't start a text command (they begin with a NUL byte).
+// After that both directions are a stream of frames: a u32 payload size followed by the payload.
+//
+//   request payload:   u32 request id | u8 opcode | arguments
+//   response payload:  u32 request id | u8 status | result (only when the status is OK)
+//
+// All integers are little-endian, as in the snapshot files (binaryio.hh). Strings (affiliation IDs, names) are a
+// u32 length and the bytes, publication IDs u64, years u16, distances i32, coordinates two i32 (x, y), and
+// arrays a u32 count and the elements. Results that don't exist are the same NO_... values the Datastructures
+// functions return, e.g. NO_PUBLICATION as a u64.
+//
+// A client may send any number of requests without waiting for the responses (pipelining). The responses come
+// in the order of the requests and carry the request id of their request.
+
+#ifndef BINARYPROTOCOL_HH
+#define BINARYPROTOCOL_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "binaryio.hh"
+#include "datastructures.hh"
+#include "shareddatastructures.hh"
+
+class BinaryProtocol
+{
+public:
+    static constexpr char HELLO[] = {'\0', 'P', 'B', '1'};
+    static constexpr std::size_t HELLO_SIZE = sizeof(HELLO);
+    // Larger request frames are a protocol error, and the server closes the connection
+    static constexpr std::uint32_t MAX_FRAME_SIZE = 1 << 24;
+    static constexpr std::size_t FRAME_HEADER_SIZE = sizeof(std::uint32_t);
+
+    // Arguments and results of the requests, in order
+    enum class Opcode : std::uint8_t
+    {
+        AFFILIATION_COUNT = 1,          // -> u32
+        ALL_AFFILIATIONS,               // -> [affiliation id]
+        AFFILIATION_RECORDS,            // [affiliation id] -> [affiliation id, name, coord]
+        AFFILIATIONS_ALPHABETICALLY,    // -> [affiliation id]
+        AFFILIATIONS_DISTANCE_INCREASING, // -> [affiliation id]
+        FIND_AFFILIATION_WITH_COORD,    // coord -> affiliation id
+        AFFILIATIONS_CLOSEST_TO,        // coord, u32 k -> [affiliation id]
+        AFFILIATIONS_WITHIN,            // coord, distance -> [affiliation id]
+        AFFILIATIONS_IN_RECT,           // coord, coord -> [affiliation id]
+        ADD_AFFILIATION,                // affiliation id, name, coord -> u8 success
+        CHANGE_AFFILIATION_COORD,       // affiliation id, coord -> u8 success
+        REMOVE_AFFILIATION,             // affiliation id -> u8 success
+        ALL_PUBLICATIONS,               // -> [publication id]
+        PUBLICATION_RECORDS,            // [publication id] -> [publication id, name, year, parent]
+        PUBLICATION_AFFILIATIONS,       // publication id -> [affiliation id]
+        PUBLICATIONS,                   // affiliation id -> [publication id]
+        PUBLICATIONS_AFTER,             // affiliation id, year -> [year, publication id]
+        PARENT,                         // publication id -> publication id
+        DIRECT_REFERENCES,              // publication id -> [publication id]
+        ALL_REFERENCES,                 // publication id -> [publication id]
+        REFERENCED_BY_CHAIN,            // publication id -> [publication id]
+        COUNT_ALL_REFERENCES,           // publication id -> i32
+        CLOSEST_COMMON_PARENT,          // publication id, publication id -> publication id
+        ADD_PUBLICATION,                // publication id, name, year, [affiliation id] -> u8 success
+        ADD_AFFILIATION_TO_PUBLICATION, // affiliation id, publication id -> u8 success
+        ADD_REFERENCE,                  // publication id, parent id -> u8 success
+        REMOVE_PUBLICATION              // publication id -> u8 success
+    };
+
+    enum class Status : std::uint8_t
+    {
+        OK = 0,
+        UNKNOWN_OPCODE,
+        MALFORMED_REQUEST, // Arguments missing, extra bytes or counts that don't fit the frame
+        NOT_IMPLEMENTED
+    };
+
+    // Estimate of performance: that of the operation, plus O(r) to decode the arguments and encode the result
+    // of size r
+    // Short rationale for estimate: The opcode picks the Datastructures function, and the arguments and result
+    // are copied to and from the frame once.
+    // Appends the response payload of one request payload to the writer. The requests go through the shared
+    // front-end, so many threads may execute them at once: the queries run in parallel and the mutations one
+    // at a time.
+    static void execute(SharedDatastructures& ds, unsigned char const* request, std::size_t size, ByteWriter& response);
+
+    // Framing for both ends: start_frame reserves the size field of a frame, end_frame fills it in once the
+    // payload has been written after it
+    static std::size_t start_frame(ByteWriter& writer);
+    static void end_frame(ByteWriter& writer, std::size_t start);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Decodes the size field at the start of the data.
+    // Returns the payload size of the frame at the start of the data, whether or not all of it has arrived yet,
+    // or 0 if even the size field hasn't arrived (a valid frame is never empty).
+    static std::uint32_t payload_size(unsigned char const* data, std::size_t size);
+
+    // Encoding of the value types shared by the requests and responses
+    static void put_coord(ByteWriter& writer, Coord xy);
+    static Coord get_coord(ByteReader& reader);
+    static void put_strings(ByteWriter& writer, std::vector<std::string> const& strings);
+    static std::vector<std::string> get_strings(ByteReader& reader);
+};
+
+#endif // BINARYPROTOCOL_HH
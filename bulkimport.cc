@@ -0,0 +1,185 @@
+// Bulkimport.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "bulkimport.hh"
+#include "binaryio.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <iterator>
+#include <thread>
+
+namespace
+{
+
+// Removes surrounding spaces and the carriage return of CRLF line ends
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\r')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+void split_fields(std::string_view line, char separator, std::vector<std::string_view>& fields)
+{
+    fields.clear();
+    std::size_t begin = 0;
+    while (true) {
+        std::size_t end = line.find(separator, begin);
+        if (end == std::string_view::npos) {
+            fields.push_back(trim(line.substr(begin)));
+            return;
+        }
+        fields.push_back(trim(line.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+}
+
+// Parses the whole field as a number, returns false on anything else
+template <typename Number>
+bool parse_number(std::string_view field, Number& value)
+{
+    auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+    return error == std::errc() && end == field.data() + field.size();
+}
+
+bool is_record_line(std::string_view line)
+{
+    line = trim(line);
+    return !line.empty() && line.front() != '#';
+}
+
+// The separator is a tab if the first record line has one and a comma otherwise
+char detect_separator(std::string_view text)
+{
+    std::size_t begin = 0;
+    while (begin < text.size()) {
+        std::size_t end = std::min(text.find('\n', begin), text.size());
+        std::string_view line = text.substr(begin, end - begin);
+        if (is_record_line(line)) {
+            return line.find('\t') != std::string_view::npos ? '\t' : ',';
+        }
+        begin = end + 1;
+    }
+    return ',';
+}
+
+} // namespace
+
+template <typename Record, typename ParseLine>
+BulkImport::Result BulkImport::parse_parallel(std::string const& filename, std::vector<Record>& records, ParseLine parse_line)
+{
+    Result result;
+    MappedFile file(filename);
+    if (file.data() == nullptr) {
+        return result;
+    }
+    result.opened = true;
+    std::string_view text(reinterpret_cast<char const*>(file.data()), file.size());
+    char separator = detect_separator(text);
+
+    // Cut the file into chunks that end at line boundaries
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::max<std::size_t>(1, std::min(threads, text.size() / MIN_CHUNK_SIZE));
+    std::vector<std::size_t> bounds{0};
+    for (std::size_t i = 1; i < threads; ++i) {
+        std::size_t cut = std::max(bounds.back(), text.size() * i / threads);
+        cut = text.find('\n', cut);
+        if (cut == std::string_view::npos) {
+            break;
+        }
+        bounds.push_back(cut + 1);
+    }
+    bounds.push_back(text.size());
+
+    struct Chunk
+    {
+        std::vector<Record> records;
+        std::size_t invalid_lines = 0;
+    };
+    std::vector<Chunk> chunks(bounds.size() - 1);
+    auto parse_chunk = [&](std::size_t index) {
+        Chunk& chunk = chunks[index];
+        std::vector<std::string_view> fields;
+        std::size_t begin = bounds[index];
+        while (begin < bounds[index + 1]) {
+            std::size_t end = std::min(text.find('\n', begin), bounds[index + 1]);
+            std::string_view line = text.substr(begin, end - begin);
+            begin = end + 1;
+            if (!is_record_line(line)) {
+                continue;
+            }
+            split_fields(line, separator, fields);
+            Record record{};
+            if (parse_line(fields, record)) {
+                chunk.records.push_back(std::move(record));
+            } else {
+                ++chunk.invalid_lines;
+            }
+        }
+    };
+
+    // The calling thread parses the first chunk itself
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < chunks.size(); ++i) {
+        workers.emplace_back(parse_chunk, i);
+    }
+    parse_chunk(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::size_t total = records.size();
+    for (auto const& chunk : chunks) {
+        total += chunk.records.size();
+    }
+    records.reserve(total);
+    for (auto& chunk : chunks) {
+        std::move(chunk.records.begin(), chunk.records.end(), std::back_inserter(records));
+        result.records += chunk.records.size();
+        result.invalid_lines += chunk.invalid_lines;
+    }
+    return result;
+}
+
+BulkImport::Result BulkImport::parse_affiliations(std::string const& filename, std::vector<AffiliationRecord>& records)
+{
+    return parse_parallel(filename, records, [](std::vector<std::string_view> const& fields, AffiliationRecord& record) {
+        if (fields.size() != 4 || fields[0].empty()) {
+            return false;
+        }
+        record.id.assign(fields[0]);
+        record.name.assign(fields[1]);
+        return parse_number(fields[2], record.xy.x) && parse_number(fields[3], record.xy.y);
+    });
+}
+
+BulkImport::Result BulkImport::parse_publications(std::string const& filename, std::vector<PublicationRecord>& records)
+{
+    return parse_parallel(filename, records, [](std::vector<std::string_view> const& fields, PublicationRecord& record) {
+        if (fields.size() < 3 || !parse_number(fields[0], record.id) || !parse_number(fields[2], record.year)) {
+            return false;
+        }
+        record.name.assign(fields[1]);
+        record.affiliations.reserve(fields.size() - 3);
+        for (std::size_t i = 3; i < fields.size(); ++i) {
+            if (!fields[i].empty()) {
+                record.affiliations.emplace_back(fields[i]);
+            }
+        }
+        return true;
+    });
+}
+
+BulkImport::Result BulkImport::parse_references(std::string const& filename,
+                                                std::vector<std::pair<PublicationID, PublicationID>>& records)
+{
+    return parse_parallel(filename, records, [](std::vector<std::string_view> const& fields, std::pair<PublicationID, PublicationID>& record) {
+        return fields.size() == 2 && parse_number(fields[0], record.first) && parse_number(fields[1], record.second);
+    });
+}
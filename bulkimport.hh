@@ -0,0 +1,55 @@
+// Bulkimport.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Parallel parser for bulk import files. A file holds one record per line, with the fields separated by tabs
+// (TSV) or commas (CSV), whichever the first record line uses. Empty lines and lines starting with '#' are
+// skipped, and names can't contain the separator. The record formats are
+//
+//   affiliations:  id | name | x | y
+//   publications:  id | name | year | affiliation id | affiliation id | ...
+//   references:    child id | parent id
+//
+// The memory-mapped file is cut at line boundaries into one chunk per hardware thread. The chunks are parsed
+// in parallel by a hand-written field splitter and std::from_chars, and the records are returned in file order,
+// so that importing a file gives the same result as adding its records one by one.
+
+#ifndef BULKIMPORT_HH
+#define BULKIMPORT_HH
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "datastructures.hh"
+
+class BulkImport
+{
+public:
+    struct Result
+    {
+        bool opened = false;
+        std::size_t records = 0;
+        std::size_t invalid_lines = 0;
+    };
+
+    // Estimate of performance: O(b / t), where b is the size of the file and t the number of threads
+    // Short rationale for estimate: Every byte is scanned once, the chunks in parallel, and the per-chunk record
+    // vectors are moved into the result in order.
+    static Result parse_affiliations(std::string const& filename, std::vector<AffiliationRecord>& records);
+    static Result parse_publications(std::string const& filename, std::vector<PublicationRecord>& records);
+    static Result parse_references(std::string const& filename, std::vector<std::pair<PublicationID, PublicationID>>& records);
+
+private:
+    // Utility function: splits the file into chunks, calls parse_line(fields, record) for each record line in
+    // parallel and concatenates the records of the lines it accepted
+    template <typename Record, typename ParseLine>
+    static Result parse_parallel(std::string const& filename, std::vector<Record>& records, ParseLine parse_line);
+
+    // Chunks smaller than this aren't worth a thread of their own
+    static std::size_t const MIN_CHUNK_SIZE = 1 << 20;
+};
+
+#endif // BULKIMPORT_HH
@@ -0,0 +1,308 @@
+// Chunkedvector.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Containers whose copies share their storage until it is written (copy-on-write). The storage is split into
+// chunks held by reference-counted pointers, so copying a container only copies one pointer per chunk, and a write
+// through a copy first clones the chunk it goes to if another copy still shares that chunk. Two copies therefore
+// differ only by the chunks written since one was made from the other. The versioned front-end relies on this to
+// publish copies of its working data often.
+//
+// ChunkedVector is a vector stored in fixed-size chunks of about CHUNK_BYTES bytes, or MIN_CHUNK_SIZE elements
+// if they are larger. Small chunks keep the clones that a write costs small, large ones the number of pointers a
+// copy has to copy. The elements never move when it
+// grows, but any non-const access to an element may replace its chunk with a clone, so a pointer taken through
+// the const interface may be left pointing into the shared chunk. Reading through the const interface never clones.
+//
+// ChunkedSlices stores many short arrays (slices) back to back in blocks, so that every slice is contiguous and
+// can be walked through a plain pointer range. A slice never crosses a block boundary, and one longer than a block
+// gets a block of its own. A slice is addressed by its position, block index * BLOCK_SIZE + offset in the block.
+//
+// The reference counts are only changed by copying and destroying the containers. As long as a single thread does
+// all of that and all the writing, other threads may read the copies it isn't writing at the same time.
+
+#ifndef CHUNKEDVECTOR_HH
+#define CHUNKEDVECTOR_HH
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Number of elements of the given size that fit in CHUNK_BYTES, a power of two and at least MIN_CHUNK_SIZE
+constexpr std::size_t CHUNK_BYTES = 1024;
+constexpr std::size_t MIN_CHUNK_SIZE = 8;
+constexpr std::size_t chunk_size_for(std::size_t element_size)
+{
+    std::size_t size = MIN_CHUNK_SIZE;
+    while (2 * size * element_size <= CHUNK_BYTES) {
+        size *= 2;
+    }
+    return size;
+}
+
+template <typename T>
+class ChunkedVector
+{
+public:
+    using value_type = T;
+    static constexpr std::size_t CHUNK_SIZE = chunk_size_for(sizeof(T));
+
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using Vector = std::conditional_t<Const, ChunkedVector const, ChunkedVector>;
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, T const*, T*>;
+        using reference = std::conditional_t<Const, T const&, T&>;
+
+        Iterator() = default;
+        Iterator(Vector* vector, std::size_t index) : vector_(vector), index_(index) {}
+        // Iterators convert to const_iterators
+        operator Iterator<true>() const { return Iterator<true>(vector_, index_); }
+
+        reference operator*() const { return (*vector_)[index_]; }
+        pointer operator->() const { return &(*vector_)[index_]; }
+        reference operator[](difference_type n) const { return (*vector_)[index_ + n]; }
+
+        Iterator& operator++() { ++index_; return *this; }
+        Iterator operator++(int) { Iterator old = *this; ++index_; return old; }
+        Iterator& operator--() { --index_; return *this; }
+        Iterator operator--(int) { Iterator old = *this; --index_; return old; }
+        Iterator& operator+=(difference_type n) { index_ += n; return *this; }
+        Iterator& operator-=(difference_type n) { index_ -= n; return *this; }
+        friend Iterator operator+(Iterator it, difference_type n) { return it += n; }
+        friend Iterator operator+(difference_type n, Iterator it) { return it += n; }
+        friend Iterator operator-(Iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(Iterator const& a, Iterator const& b)
+        {
+            return static_cast<difference_type>(a.index_) - static_cast<difference_type>(b.index_);
+        }
+
+        bool operator==(Iterator const& other) const { return index_ == other.index_; }
+        bool operator!=(Iterator const& other) const { return index_ != other.index_; }
+        bool operator<(Iterator const& other) const { return index_ < other.index_; }
+        bool operator>(Iterator const& other) const { return index_ > other.index_; }
+        bool operator<=(Iterator const& other) const { return index_ <= other.index_; }
+        bool operator>=(Iterator const& other) const { return index_ >= other.index_; }
+
+    private:
+        Vector* vector_ = nullptr;
+        std::size_t index_ = 0;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, size_); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T const& operator[](std::size_t index) const { return chunks_[index / CHUNK_SIZE]->items[index % CHUNK_SIZE]; }
+    T& operator[](std::size_t index) { return writable_chunk(index / CHUNK_SIZE).items[index % CHUNK_SIZE]; }
+    T const& back() const { return (*this)[size_ - 1]; }
+    T& back() { return (*this)[size_ - 1]; }
+
+    void clear()
+    {
+        chunks_.clear();
+        size_ = 0;
+    }
+
+    // Makes room for the chunk pointers of n elements, the chunks themselves are allocated as the vector grows
+    void reserve(std::size_t n) { chunks_.reserve((n + CHUNK_SIZE - 1) / CHUNK_SIZE); }
+
+    void push_back(T const& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        if (size_ == chunks_.size() * CHUNK_SIZE) {
+            chunks_.push_back(std::make_shared<Chunk>());
+        }
+        T& slot = (*this)[size_];
+        slot = T(std::forward<Args>(args)...);
+        ++size_;
+        return slot;
+    }
+
+    // The slot is reset, so that the element frees what it owns right away
+    void pop_back()
+    {
+        --size_;
+        if (size_ % CHUNK_SIZE == 0) {
+            chunks_.pop_back();
+        } else {
+            (*this)[size_] = T();
+        }
+    }
+
+    void resize(std::size_t n, T const& value = T())
+    {
+        while (size_ > n) {
+            pop_back();
+        }
+        // Fill the rest of the last chunk, then whole new chunks
+        while (size_ < n && size_ % CHUNK_SIZE != 0) {
+            emplace_back(value);
+        }
+        while (size_ < n) {
+            auto chunk = std::make_shared<Chunk>();
+            chunk->items.fill(value);
+            chunks_.push_back(std::move(chunk));
+            size_ = std::min(n, size_ + CHUNK_SIZE);
+        }
+    }
+
+    void assign(std::size_t n, T const& value)
+    {
+        clear();
+        resize(n, value);
+    }
+
+    template <typename InputIterator, typename = typename std::iterator_traits<InputIterator>::iterator_category>
+    void assign(InputIterator first, InputIterator last)
+    {
+        clear();
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+    }
+
+    // Shifts the elements after the position down by one, so only the chunks from the position on are cloned
+    void erase(const_iterator position)
+    {
+        for (std::size_t index = position - cbegin(); index + 1 < size_; ++index) {
+            (*this)[index] = std::move((*this)[index + 1]);
+        }
+        pop_back();
+    }
+
+    void swap(ChunkedVector& other) noexcept
+    {
+        chunks_.swap(other.chunks_);
+        std::swap(size_, other.size_);
+    }
+
+private:
+    // The slots after the last element of the last chunk are unused
+    struct Chunk
+    {
+        std::array<T, CHUNK_SIZE> items{};
+    };
+
+    Chunk& writable_chunk(std::size_t chunk)
+    {
+        std::shared_ptr<Chunk>& pointer = chunks_[chunk];
+        if (pointer.use_count() > 1) {
+            pointer = std::make_shared<Chunk>(*pointer);
+        }
+        return *pointer;
+    }
+
+    std::vector<std::shared_ptr<Chunk>> chunks_;
+    std::size_t size_ = 0;
+};
+
+template <typename T>
+class ChunkedSlices
+{
+public:
+    static constexpr std::size_t BLOCK_SIZE = chunk_size_for(sizeof(T));
+
+    ChunkedSlices() { clear(); }
+
+    // Total length of the slices appended, the elements erased from them since included
+    std::size_t size() const { return size_; }
+
+    void clear()
+    {
+        blocks_.clear();
+        blocks_.push_back(new_block(BLOCK_SIZE));
+        size_ = 0;
+    }
+
+    // Appends a slice of count elements, initially default values, and returns its position. An empty slice
+    // gets some valid position, so that data() works for every position returned.
+    std::size_t append(std::size_t count)
+    {
+        if (count == 0) {
+            return (blocks_.size() - 1) * BLOCK_SIZE;
+        }
+        if (blocks_.back()->size() + count > BLOCK_SIZE) {
+            blocks_.push_back(new_block(std::max(count, BLOCK_SIZE)));
+        }
+        std::vector<T>& block = writable_block(blocks_.size() - 1);
+        std::size_t offset = block.size();
+        block.resize(offset + count);
+        size_ += count;
+        return (blocks_.size() - 1) * BLOCK_SIZE + offset;
+    }
+
+    T const* data(std::size_t position) const { return blocks_[position / BLOCK_SIZE]->data() + position % BLOCK_SIZE; }
+    T* writable(std::size_t position) { return writable_block(position / BLOCK_SIZE).data() + position % BLOCK_SIZE; }
+
+    // Tells whether a slice of count elements at the position lies within one block
+    bool contains(std::size_t position, std::size_t count) const
+    {
+        std::size_t block = position / BLOCK_SIZE;
+        return block < blocks_.size() && position % BLOCK_SIZE + count <= blocks_[block]->size();
+    }
+
+    // The blocks as they are, for snapshots: saving them and loading them back keeps every position valid
+    std::size_t block_count() const { return blocks_.size(); }
+    std::vector<T> const& block(std::size_t block) const { return *blocks_[block]; }
+    // Replaces the contents with the given blocks, each at most BLOCK_SIZE elements unless it holds one slice
+    void assign_blocks(std::vector<std::vector<T>> blocks)
+    {
+        blocks_.clear();
+        size_ = 0;
+        for (auto& elements : blocks) {
+            size_ += elements.size();
+            auto block = new_block(std::max(elements.size(), BLOCK_SIZE));
+            block->assign(elements.begin(), elements.end());
+            blocks_.push_back(std::move(block));
+        }
+        if (blocks_.empty()) {
+            clear();
+        }
+    }
+
+private:
+    // Blocks keep their capacity reserved, so that appending to one never moves the slices already in it
+    static std::shared_ptr<std::vector<T>> new_block(std::size_t capacity)
+    {
+        auto block = std::make_shared<std::vector<T>>();
+        block->reserve(capacity);
+        return block;
+    }
+
+    std::vector<T>& writable_block(std::size_t block)
+    {
+        std::shared_ptr<std::vector<T>>& pointer = blocks_[block];
+        if (pointer.use_count() > 1) {
+            auto clone = new_block(std::max(pointer->size(), BLOCK_SIZE));
+            clone->assign(pointer->begin(), pointer->end());
+            pointer = std::move(clone);
+        }
+        return *pointer;
+    }
+
+    std::vector<std::shared_ptr<std::vector<T>>> blocks_;
+    std::size_t size_ = 0;
+};
+
+#endif // CHUNKEDVECTOR_HH
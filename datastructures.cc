@@ -3,10 +3,14 @@
 // Student name: Taisto Tammilehto
 
 #include "datastructures.hh"
+#include "journal.hh"
 #include <random>
 #include <unordered_set>
 #include <cmath>
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
 
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
@@ -34,64 +38,230 @@ Datastructures::~Datastructures()
 {
 }
 
+// Copied member by member. The chunked containers and the affiliation indexes are shared with the other structure
+// until either of them writes to them, the rest is copied outright.
+Datastructures::Datastructures(Datastructures const& other)
+    : publications(other.publications),
+      reverse_references(other.reverse_references),
+      affiliation_indexes(other.affiliation_indexes),
+      affiliation_ids(other.affiliation_ids),
+      affiliation_names(other.affiliation_names),
+      affiliation_xs(other.affiliation_xs),
+      affiliation_ys(other.affiliation_ys),
+      affiliation_publications(other.affiliation_publications),
+      affiliation_years(other.affiliation_years),
+      unsorted_year_indexes(other.unsorted_year_indexes),
+      free_affiliation_handles(other.free_affiliation_handles),
+      sorted_affiliations_by_name(other.sorted_affiliations_by_name),
+      sorted_affiliations_by_distance(other.sorted_affiliations_by_distance),
+      unmerged_affiliations_by_name(other.unmerged_affiliations_by_name),
+      unmerged_affiliations_by_distance(other.unmerged_affiliations_by_distance),
+      affiliations_sorted_by_name(other.affiliations_sorted_by_name),
+      affiliations_sorted_by_distance(other.affiliations_sorted_by_distance),
+      ancestor_index_valid(other.ancestor_index_valid),
+      csr_references(other.csr_references),
+      csr_referrers(other.csr_referrers),
+      csr_slices(other.csr_slices),
+      csr_compacted(other.csr_compacted),
+      csr_delta_edges(other.csr_delta_edges),
+      traversal_epoch(other.traversal_epoch),
+      subtree_order(other.subtree_order),
+      subtree_ranges(other.subtree_ranges),
+      subtree_layout_valid(other.subtree_layout_valid),
+      subtree_layout_stale(other.subtree_layout_stale),
+      subtree_fallback_work(other.subtree_fallback_work.load()),
+      grid_cell_size(other.grid_cell_size),
+      grid_sized_for(other.grid_sized_for),
+      grid_min_cell(other.grid_min_cell),
+      grid_max_cell(other.grid_max_cell)
+{
+}
+
 // Returns the number of affiliations currently stored
-unsigned int Datastructures::get_affiliation_count() {
-    return affiliations.size();
+unsigned int Datastructures::get_affiliation_count() const {
+    return affiliation_indexes->handles.size();
 }
 
 // Clears all stored data, resetting the data structure to its initial state
 void Datastructures::clear_all() {
-    affiliations.clear();
+    if (journal) {
+        journal->record_clear_all();
+    }
     publications.clear();
-    affiliations_publications.clear();
-    coord_to_affiliation.clear();
-
-    // Clear the sorted sets
+    reverse_references.clear();
+    csr_references.clear();
+    csr_referrers.clear();
+    csr_slices.clear();
+    csr_compacted = false;
+    csr_delta_edges = 0;
+
+    // Release every affiliation handle
+    affiliation_ids.clear();
+    affiliation_names.clear();
+    affiliation_xs.clear();
+    affiliation_ys.clear();
+    affiliation_publications.clear();
+    free_affiliation_handles.clear();
     sorted_affiliations_by_name.clear();
     sorted_affiliations_by_distance.clear();
+    unmerged_affiliations_by_name.clear();
+    unmerged_affiliations_by_distance.clear();
+    unsorted_year_indexes.clear();
+
+    affiliation_years.clear();
+
+    // Indexes that a copy still shares are left to it
+    if (affiliation_indexes.use_count() == 1) {
+        AffiliationIndexes& indexes = writable_affiliation_indexes();
+        indexes.handles.clear();
+        indexes.grid.clear();
+    } else {
+        affiliation_indexes = std::make_shared<AffiliationIndexes>();
+    }
+
+    // Reset the spatial grid
+    grid_cell_size = INITIAL_GRID_CELL_SIZE;
+    grid_sized_for = 0;
+    grid_min_cell = NO_COORD;
+    grid_max_cell = NO_COORD;
 
     // Reset the flags
     affiliations_sorted_by_name = true;
     affiliations_sorted_by_distance = true;
+    ancestor_index_valid = true;
+    subtree_order.clear();
+    subtree_ranges.clear();
+    subtree_layout_valid = false;
+    subtree_layout_stale = false;
+    subtree_fallback_work = 0;
 }
 
 // Retrieves a list of all affiliations in no particular order
-std::vector<AffiliationID> Datastructures::get_all_affiliations() {
+std::vector<AffiliationID> Datastructures::get_all_affiliations() const {
     std::vector<AffiliationID> all_affiliations;
-    for (const auto& entry : affiliations) {
-        all_affiliations.push_back(entry.first);
+    all_affiliations.reserve(affiliation_indexes->handles.size());
+    for (const auto& id : affiliation_ids) {
+        if (id != NO_AFFILIATION) {
+            all_affiliations.push_back(id);
+        }
     }
     return all_affiliations;
 }
 
 // Adds a new affiliation, returns true if successful or false if the affiliation already exists
 bool Datastructures::add_affiliation(AffiliationID id, Name const& name, Coord xy) {
-    if (affiliations.find(id) == affiliations.end()) {
-        affiliations[id] = std::make_tuple(name, xy);
+    AffiliationHandle handle = append_affiliation(id, name, xy);
+    if (handle == NO_HANDLE) {
+        return false;
+    }
 
-        // Update the sorted sets
-        sorted_affiliations_by_name.insert({name, id});
-        sorted_affiliations_by_distance.insert({calculate_distance_from_origin(xy), id});
+    // The sorted orders take the new affiliation in on their next read
+    unmerged_affiliations_by_name.push_back(handle);
+    unmerged_affiliations_by_distance.push_back(handle);
+    affiliations_sorted_by_name = false;
+    affiliations_sorted_by_distance = false;
 
-        return true;
+    // Update the spatial grid, re-choosing the cell size whenever the number of affiliations or the area they
+    // cover has grown enough
+    grid_insert(handle, xy);
+    rebuild_affiliation_grid_if_due();
+
+    if (journal) {
+        journal->record_add_affiliation(id, name, xy);
     }
-    return false;
+    return true;
+}
+
+// Adds every affiliation whose ID isn't taken yet, returns the number added. The storage is reserved up front, and
+// the sorted orders are merged lazily and the spatial grid rebuilt once at the end instead of updating them per
+// affiliation.
+unsigned int Datastructures::add_affiliations(std::vector<AffiliationRecord> const& records) {
+    // Batches that are small compared to the existing affiliations are cheaper to insert one by one
+    if (records.size() * BULK_REBUILD_FRACTION < affiliation_indexes->handles.size()) {
+        unsigned int added = 0;
+        for (auto const& record : records) {
+            if (add_affiliation(record.id, record.name, record.xy)) {
+                ++added;
+            }
+        }
+        return added;
+    }
+
+    std::size_t capacity = affiliation_ids.size() + records.size();
+    AffiliationIndexes& indexes = writable_affiliation_indexes();
+    indexes.handles.reserve(indexes.handles.size() + records.size());
+    affiliation_ids.reserve(capacity);
+    affiliation_names.reserve(capacity);
+    affiliation_xs.reserve(capacity);
+    affiliation_ys.reserve(capacity);
+    affiliation_publications.reserve(capacity);
+    affiliation_years.reserve(capacity);
+
+    unsigned int added = 0;
+    for (auto const& record : records) {
+        AffiliationHandle handle = append_affiliation(record.id, record.name, record.xy);
+        if (handle == NO_HANDLE) {
+            continue;
+        }
+        unmerged_affiliations_by_name.push_back(handle);
+        unmerged_affiliations_by_distance.push_back(handle);
+        ++added;
+        if (journal) {
+            journal->record_add_affiliation(record.id, record.name, record.xy);
+        }
+    }
+
+    if (added > 0) {
+        affiliations_sorted_by_name = false;
+        affiliations_sorted_by_distance = false;
+        rebuild_affiliation_grid();
+    }
+    return added;
+}
+
+// Stores a new affiliation in the handle-indexed arrays, returns its handle or NO_HANDLE if the ID is taken.
+// The sorted orders and the spatial grid are left for the caller to update.
+AffiliationHandle Datastructures::append_affiliation(AffiliationID const& id, Name const& name, Coord xy) {
+    if (handle_of(id) != NO_HANDLE) {
+        return NO_HANDLE;
+    }
+
+    // Reuse the slot of a removed affiliation if there is one
+    AffiliationHandle handle;
+    if (!free_affiliation_handles.empty()) {
+        handle = free_affiliation_handles.back();
+        free_affiliation_handles.pop_back();
+        affiliation_ids[handle] = id;
+        affiliation_names[handle] = name;
+        affiliation_xs[handle] = xy.x;
+        affiliation_ys[handle] = xy.y;
+    } else {
+        handle = affiliation_ids.size();
+        affiliation_ids.push_back(id);
+        affiliation_names.push_back(name);
+        affiliation_xs.push_back(xy.x);
+        affiliation_ys.push_back(xy.y);
+        affiliation_publications.emplace_back();
+        affiliation_years.emplace_back();
+    }
+    writable_affiliation_indexes().handles.emplace(id, handle);
+    return handle;
 }
 
 // Retrieves the name of a specified affiliation
-Name Datastructures::get_affiliation_name(AffiliationID id) {
-    auto it = affiliations.find(id);
-    if (it != affiliations.end()) {
-        return std::get<0>(it->second);
+Name Datastructures::get_affiliation_name(AffiliationID id) const {
+    AffiliationHandle handle = handle_of(id);
+    if (handle != NO_HANDLE) {
+        return affiliation_names[handle];
     }
     return NO_NAME;
 }
 
 // Retrieves the coordinates of a specified affiliation
-Coord Datastructures::get_affiliation_coord(AffiliationID id) {
-    auto it = affiliations.find(id);
-    if (it != affiliations.end()) {
-        return std::get<1>(it->second);
+Coord Datastructures::get_affiliation_coord(AffiliationID id) const {
+    AffiliationHandle handle = handle_of(id);
+    if (handle != NO_HANDLE) {
+        return affiliation_coord(handle);
     }
     return NO_COORD;
 }
@@ -99,80 +269,221 @@ Coord Datastructures::get_affiliation_coord(AffiliationID id) {
 // Returns a list of affiliations sorted alphabetically by their names
 std::vector<AffiliationID> Datastructures::get_affiliations_alphabetically() {
     update_sorted_affiliations_by_name();
-    std::vector<AffiliationID> result;
-    for (const auto& [name, id] : sorted_affiliations_by_name) {
-        result.push_back(id);
-    }
-    return result;
+    return std::as_const(*this).get_affiliations_alphabetically();
+}
+
+std::vector<AffiliationID> Datastructures::get_affiliations_alphabetically() const {
+    return ids_in_order(sorted_affiliations_by_name, unmerged_affiliations_by_name, AffiliationsByName{this});
 }
 
 // Returns a list of affiliations sorted by increasing distance from the origin
 std::vector<AffiliationID> Datastructures::get_affiliations_distance_increasing() {
+    update_sorted_affiliations_by_distance();
+    return std::as_const(*this).get_affiliations_distance_increasing();
+}
+
+std::vector<AffiliationID> Datastructures::get_affiliations_distance_increasing() const {
+    return ids_in_order(sorted_affiliations_by_distance, unmerged_affiliations_by_distance, AffiliationsByDistance{this});
+}
+
+// Lists the IDs of a sorted order. Buffered additions are sorted in a copy and merged into the listing on the fly,
+// so that the order itself is left untouched.
+template <typename Compare>
+std::vector<AffiliationID> Datastructures::ids_in_order(ChunkedVector<AffiliationHandle> const& sorted,
+                                                        std::vector<AffiliationHandle> const& unmerged, Compare compare) const {
     std::vector<AffiliationID> result;
-    for (const auto& [distance, id] : sorted_affiliations_by_distance) {
-        result.push_back(id);
+    result.reserve(sorted.size() + unmerged.size());
+    if (unmerged.empty()) {
+        for (AffiliationHandle handle : sorted) {
+            result.push_back(affiliation_ids[handle]);
+        }
+        return result;
+    }
+
+    std::vector<AffiliationHandle> pending(unmerged);
+    std::sort(pending.begin(), pending.end(), compare);
+    std::vector<AffiliationHandle> merged(sorted.size() + pending.size());
+    std::merge(sorted.begin(), sorted.end(), pending.begin(), pending.end(), merged.begin(), compare);
+    for (AffiliationHandle handle : merged) {
+        result.push_back(affiliation_ids[handle]);
     }
     return result;
 }
 
 void Datastructures::update_sorted_affiliations_by_name() {
     if (!affiliations_sorted_by_name) {
-        sorted_affiliations_by_name.clear();
-        for (const auto& [id, data] : affiliations) {
-            sorted_affiliations_by_name.emplace(std::get<0>(data), id);
-        }
+        merge_unmerged_affiliations(sorted_affiliations_by_name, unmerged_affiliations_by_name, AffiliationsByName{this});
         affiliations_sorted_by_name = true;
     }
 }
 
 void Datastructures::update_sorted_affiliations_by_distance() {
     if (!affiliations_sorted_by_distance) {
-        sorted_affiliations_by_distance.clear();
-        for (const auto& [id, data] : affiliations) {
-            sorted_affiliations_by_distance.emplace(calculate_distance_from_origin(std::get<1>(data)), id);
-        }
+        merge_unmerged_affiliations(sorted_affiliations_by_distance, unmerged_affiliations_by_distance, AffiliationsByDistance{this});
         affiliations_sorted_by_distance = true;
     }
 }
 
+// Sorts the buffered handles and merges them into the sorted order in one linear pass
+template <typename Compare>
+void Datastructures::merge_unmerged_affiliations(ChunkedVector<AffiliationHandle>& sorted, std::vector<AffiliationHandle>& unmerged,
+                                                 Compare compare) {
+    std::sort(unmerged.begin(), unmerged.end(), compare);
+    std::vector<AffiliationHandle> merged(sorted.size() + unmerged.size());
+    std::merge(sorted.cbegin(), sorted.cend(), unmerged.begin(), unmerged.end(), merged.begin(), compare);
+    sorted.assign(merged.begin(), merged.end());
+    unmerged.clear();
+}
+
+// Removes a handle from a sorted order, while the keys it was sorted by are still unchanged
+template <typename Compare>
+void Datastructures::erase_from_sorted_affiliations(ChunkedVector<AffiliationHandle>& sorted, std::vector<AffiliationHandle>& unmerged,
+                                                    AffiliationHandle handle, Compare compare) {
+    auto unmerged_it = std::find(unmerged.begin(), unmerged.end(), handle);
+    if (unmerged_it != unmerged.end()) {
+        *unmerged_it = unmerged.back();
+        unmerged.pop_back();
+        return;
+    }
+    auto it = std::lower_bound(sorted.cbegin(), sorted.cend(), handle, compare);
+    if (it != sorted.cend() && *it == handle) {
+        sorted.erase(it);
+    }
+}
+
+bool Datastructures::AffiliationsByName::operator()(AffiliationHandle a, AffiliationHandle b) const {
+    auto const& name_a = ds->affiliation_names[a];
+    auto const& name_b = ds->affiliation_names[b];
+    int order = name_a.compare(name_b);
+    return order < 0 || (order == 0 && ds->affiliation_ids[a] < ds->affiliation_ids[b]);
+}
+
+bool Datastructures::AffiliationsByDistance::operator()(AffiliationHandle a, AffiliationHandle b) const {
+    Distance distance_a = calculate_distance_from_origin(ds->affiliation_coord(a));
+    Distance distance_b = calculate_distance_from_origin(ds->affiliation_coord(b));
+    return distance_a < distance_b || (distance_a == distance_b && ds->affiliation_ids[a] < ds->affiliation_ids[b]);
+}
+
+// Returns the handle of an affiliation, or NO_HANDLE if there is no such affiliation
+AffiliationHandle Datastructures::handle_of(AffiliationID const& id) const {
+    auto const& handles = affiliation_indexes->handles;
+    auto it = handles.find(id);
+    return it != handles.end() ? it->second : NO_HANDLE;
+}
+
+Coord Datastructures::affiliation_coord(AffiliationHandle affiliation) const {
+    return {affiliation_xs[affiliation], affiliation_ys[affiliation]};
+}
+
+// Clones the affiliation indexes first if a copy of the structure still shares them
+Datastructures::AffiliationIndexes& Datastructures::writable_affiliation_indexes() {
+    if (affiliation_indexes.use_count() > 1) {
+        affiliation_indexes = std::make_shared<AffiliationIndexes>(*affiliation_indexes);
+    }
+    // Only the shared bundle is kept const, this structure owns the one it has now
+    return const_cast<AffiliationIndexes&>(*affiliation_indexes);
+}
+
+// Translates affiliation handles back to the IDs used by the public interface
+std::vector<AffiliationID> Datastructures::ids_of(AffiliationList const& handles) const {
+    std::vector<AffiliationID> ids;
+    ids.reserve(handles.size());
+    for (AffiliationHandle handle : handles) {
+        ids.push_back(affiliation_ids[handle]);
+    }
+    return ids;
+}
+
+// Appends a publication to an affiliation's year index. An entry that breaks the order starts the unsorted tail.
+void Datastructures::year_index_insert(AffiliationHandle affiliation, Year year, PublicationID publicationid) {
+    auto& index = affiliation_years[affiliation];
+    std::pair<Year, PublicationID> entry{year, publicationid};
+    if (index.sorted()) {
+        if (index.entries.empty() || !(entry < index.entries.back())) {
+            index.entries.push_back(entry);
+            ++index.sorted_size;
+            return;
+        }
+        unsorted_year_indexes.push_back(affiliation);
+    }
+    index.entries.push_back(entry);
+}
+
+// Removes one occurrence of a publication from an affiliation's year index: binary search in the sorted prefix,
+// linear search in the unsorted tail
+void Datastructures::year_index_erase(AffiliationHandle affiliation, Year year, PublicationID publicationid) {
+    auto& index = affiliation_years[affiliation];
+    auto entry = std::make_pair(year, publicationid);
+    auto sorted_end = index.entries.begin() + index.sorted_size;
+    auto pos = std::lower_bound(index.entries.begin(), sorted_end, entry);
+    if (pos != sorted_end && *pos == entry) {
+        index.entries.erase(pos);
+        --index.sorted_size;
+        return;
+    }
+    pos = std::find(sorted_end, index.entries.end(), entry);
+    if (pos != index.entries.end()) {
+        index.entries.erase(pos);
+    }
+}
+
+// Sorts the unsorted tail of a year index and merges it into the sorted prefix in one linear pass
+void Datastructures::sort_year_index(YearIndex& index) {
+    if (!index.sorted()) {
+        auto middle = index.entries.begin() + index.sorted_size;
+        std::sort(middle, index.entries.end());
+        std::inplace_merge(index.entries.begin(), middle, index.entries.end());
+        index.sorted_size = index.entries.size();
+    }
+}
+
 Distance Datastructures::calculate_distance_from_origin(Coord coord) {
     return coord.x * coord.x + coord.y * coord.y;
 }
 
 // Changes the coordinates of a specified affiliation
 bool Datastructures::change_affiliation_coord(AffiliationID id, Coord newcoord) {
-    auto it = affiliations.find(id);
-    if (it != affiliations.end()) {
-        // Update the coordinates in the affiliations map
-        Coord old_coord = std::get<1>(it->second);
-        std::get<1>(it->second) = newcoord;
-
-        // Update the sorted_affiliations_by_distance set
-        Distance old_distance = calculate_distance_from_origin(old_coord);
-        Distance new_distance = calculate_distance_from_origin(newcoord);
-        sorted_affiliations_by_distance.erase({old_distance, id});
-        sorted_affiliations_by_distance.insert({new_distance, id});
-
-        // Update coord_to_affiliation map
-        auto& old_vec = coord_to_affiliation[old_coord];
-        auto find_iter = std::find(old_vec.begin(), old_vec.end(), id);
-        if (find_iter != old_vec.end()) {
-            old_vec.erase(find_iter);
-        }
-        coord_to_affiliation[newcoord].push_back(id);
+    AffiliationHandle handle = handle_of(id);
+    if (handle == NO_HANDLE) {
+        return false;
+    }
 
-        return true;
+    // The distance order depends on the coordinates, so the handle is taken out of it while they change
+    Coord old_coord = affiliation_coord(handle);
+    erase_from_sorted_affiliations(sorted_affiliations_by_distance, unmerged_affiliations_by_distance, handle, AffiliationsByDistance{this});
+    affiliation_xs[handle] = newcoord.x;
+    affiliation_ys[handle] = newcoord.y;
+    unmerged_affiliations_by_distance.push_back(handle);
+    affiliations_sorted_by_distance = false;
+
+    // Move the affiliation to its new grid cell
+    grid_erase(handle, old_coord);
+    grid_insert(handle, newcoord);
+    rebuild_affiliation_grid_if_due();
+
+    if (journal) {
+        journal->record_change_affiliation_coord(id, newcoord);
     }
-    return false;
+    return true;
 }
 
-// Finds and returns the ID of an affiliation at a specific coordinate
-AffiliationID Datastructures::find_affiliation_with_coord(Coord xy) {
-    auto it = coord_to_affiliation.find(xy);
-    if (it != coord_to_affiliation.end() && !it->second.empty()) {
-        return it->second.front();
+// Finds and returns the ID of an affiliation at a specific coordinate (the smallest ID if there are several)
+AffiliationID Datastructures::find_affiliation_with_coord(Coord xy) const {
+    AffiliationID found = NO_AFFILIATION;
+    auto const& grid = affiliation_indexes->grid;
+    if (grid.empty()) {
+        return found;
     }
-    return NO_AFFILIATION;
+
+    auto it = grid.find(grid_cell_of(xy));
+    if (it != grid.end()) {
+        for (const auto& [coord, handle] : it->second) {
+            if (coord == xy && (found == NO_AFFILIATION || affiliation_ids[handle] < found)) {
+                found = affiliation_ids[handle];
+            }
+        }
+    }
+    return found;
 }
 
 // Adds a new publication, returns true if successful or false if the publication already exists
@@ -181,20 +492,83 @@ bool Datastructures::add_publication(PublicationID id, const Name& name, Year ye
         return false;
     }
 
-    std::vector<AffiliationID> valid_affiliations;
+    AffiliationList valid_affiliations;
+    valid_affiliations.reserve(affs.size());
     for (const auto& aff_id : affs) {
-        if (affiliations.find(aff_id) != affiliations.end()) {
-            valid_affiliations.push_back(aff_id);
-            affiliations_publications[aff_id].push_back(id);
+        AffiliationHandle handle = handle_of(aff_id);
+        if (handle != NO_HANDLE) {
+            valid_affiliations.push_back(handle);
+            affiliation_publications[handle].push_back(id);
+            year_index_insert(handle, year, id);
         }
     }
 
-    publications[id] = {name, year, valid_affiliations, {}};
+    PublicationInfo& info = publications[id];
+    info.name = name;
+    info.year = year;
+    info.affiliations = std::move(valid_affiliations);
+    if (journal) {
+        journal->record_add_publication(id, name, year, affs);
+    }
     return true;
 }
 
+// Adds every publication whose ID isn't taken yet, returns the number added. The publications are stored first,
+// then the per-affiliation lists are grown once to their final size and filled in the same order as add_publication
+// would. The year indexes are sorted once by the next query that reads them.
+unsigned int Datastructures::add_publications(std::vector<PublicationRecord> const& records) {
+    if (records.empty()) {
+        return 0;
+    }
+    PublicationID max_id = 0;
+    for (auto const& record : records) {
+        max_id = std::max(max_id, record.id);
+    }
+    publications.reserve(records.size(), max_id);
+
+    std::vector<PublicationID> added;
+    added.reserve(records.size());
+    std::vector<unsigned int> new_publications(affiliation_ids.size(), 0);
+    for (auto const& record : records) {
+        if (publications.find(record.id) != publications.end()) {
+            continue;
+        }
+        PublicationInfo& info = publications[record.id];
+        info.name = record.name;
+        info.year = record.year;
+        info.affiliations.reserve(record.affiliations.size());
+        for (auto const& aff_id : record.affiliations) {
+            AffiliationHandle handle = handle_of(aff_id);
+            if (handle != NO_HANDLE) {
+                info.affiliations.push_back(handle);
+                ++new_publications[handle];
+            }
+        }
+        added.push_back(record.id);
+        if (journal) {
+            journal->record_add_publication(record.id, record.name, record.year, record.affiliations);
+        }
+    }
+
+    for (AffiliationHandle handle = 0; handle < new_publications.size(); ++handle) {
+        if (new_publications[handle] > 0) {
+            affiliation_publications[handle].reserve(affiliation_publications[handle].size() + new_publications[handle]);
+            auto& entries = affiliation_years[handle].entries;
+            entries.reserve(entries.size() + new_publications[handle]);
+        }
+    }
+    for (PublicationID id : added) {
+        PublicationInfo const& info = publications.find(id)->second;
+        for (AffiliationHandle handle : info.affiliations) {
+            affiliation_publications[handle].push_back(id);
+            year_index_insert(handle, info.year, id);
+        }
+    }
+    return added.size();
+}
+
 // Returns a list of all publications
-std::vector<PublicationID> Datastructures::all_publications() {
+std::vector<PublicationID> Datastructures::all_publications() const {
     std::vector<PublicationID> result;
     for (const auto& entry : publications) {
         result.push_back(entry.first);
@@ -202,31 +576,39 @@ std::vector<PublicationID> Datastructures::all_publications() {
     return result;
 }
 
+// Returns the number of publications currently stored
+unsigned int Datastructures::get_publication_count() const {
+    return publications.size();
+}
+
 // Retrieves the name of a specified publication
-Name Datastructures::get_publication_name(PublicationID id)
+Name Datastructures::get_publication_name(PublicationID id) const
 {
-    if (publications.find(id) != publications.end()) {
-        return publications[id].name;
+    auto it = publications.find(id);
+    if (it != publications.end()) {
+        return it->second.name;
     }
 
     return NO_NAME;
 }
 
 // Retrieves the publication year of a specified publication
-Year Datastructures::get_publication_year(PublicationID id)
+Year Datastructures::get_publication_year(PublicationID id) const
 {
-    if (publications.find(id) != publications.end()) {
-        return publications[id].year;
+    auto it = publications.find(id);
+    if (it != publications.end()) {
+        return it->second.year;
     }
 
     return NO_YEAR;
 }
 
 // Retrieves a list of affiliations associated with a specified publication
-std::vector<AffiliationID> Datastructures::get_affiliations(PublicationID id)
+std::vector<AffiliationID> Datastructures::get_affiliations(PublicationID id) const
 {
-    if (publications.find(id) != publications.end()) {
-        return publications[id].affiliations;
+    auto it = publications.find(id);
+    if (it != publications.end()) {
+        return ids_of(it->second.affiliations);
     }
 
     return {};
@@ -243,17 +625,82 @@ bool Datastructures::add_reference(PublicationID child, PublicationID parent) {
         parent_it->second.references.push_back(child);
         // Update reverse_references
         reverse_references[child].push_back(parent);
+        ++csr_delta_edges;
+
+        invalidate_subtree_ranges_from(parent);
+
+        // Only the jump tables of the attached subtree change, unless the reference closes a cycle or attaches the
+        // subtree below one. A parent at depth 0 that has a parent of its own is in or below a cycle, where
+        // rebuild_ancestor_index leaves every publication a root of its own, so the subtree would have to become
+        // roots too; the rebuild does that.
+        if (ancestor_index_valid) {
+            auto& parent_info = parent_it->second;
+            auto& child_info = child_it->second;
+            bool cycle = child == parent ||
+                         (parent_info.depth > child_info.depth && lift(parent, parent_info.depth - child_info.depth) == child);
+            bool below_cycle = parent_info.depth == 0 && publications.find(parent_info.parent) != publications.end();
+            if (cycle || below_cycle) {
+                ancestor_index_valid = false;
+            } else {
+                refresh_ancestor_subtree(child);
+            }
+        }
+        if (journal) {
+            journal->record_add_reference(child, parent);
+        }
         return true;
     }
     return false;
 }
 
+// Adds every (child, parent) reference between existing publications, returns the number added. The ancestor
+// index is rebuilt once by the next query that needs it instead of being refreshed for each reference.
+unsigned int Datastructures::add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references) {
+    // Rebuilding the ancestor index doesn't pay off for a batch that is small compared to the publications
+    if (references.size() * BULK_REBUILD_FRACTION < publications.size()) {
+        unsigned int added = 0;
+        for (auto [child, parent] : references) {
+            if (add_reference(child, parent)) {
+                ++added;
+            }
+        }
+        return added;
+    }
+
+    unsigned int added = 0;
+    for (auto [child, parent] : references) {
+        auto child_it = publications.find(child);
+        auto parent_it = publications.find(parent);
+        if (child_it == publications.end() || parent_it == publications.end()) {
+            continue;
+        }
+        child_it->second.parent = parent;
+        parent_it->second.references.push_back(child);
+        reverse_references[child].push_back(parent);
+        ++added;
+        if (journal) {
+            journal->record_add_reference(child, parent);
+        }
+    }
+
+    if (added > 0) {
+        csr_delta_edges += added;
+        invalidate_subtree_layout();
+        ancestor_index_valid = false;
+    }
+    return added;
+}
+
 // Retrieves a list of publications that a specified publication directly references
-std::vector<PublicationID> Datastructures::get_direct_references(PublicationID id)
+std::vector<PublicationID> Datastructures::get_direct_references(PublicationID id) const
 {
     auto it = publications.find(id);
     if (it != publications.end()) {
-        return it->second.references;
+        std::vector<PublicationID> result;
+        for (auto [first, last] : references_of(id, it->second)) {
+            result.insert(result.end(), first, last);
+        }
+        return result;
     }
     return {}; // Return an empty vector if the publication does not exist
 }
@@ -261,18 +708,15 @@ std::vector<PublicationID> Datastructures::get_direct_references(PublicationID i
 // Associates an affiliation with a specified publication
 bool Datastructures::add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid)
 {
-    if (publications.find(publicationid) != publications.end() && affiliations.find(affiliationid) != affiliations.end()) {
-        publications[publicationid].affiliations.push_back(affiliationid);
-
-        // Check if the affiliation already has publications
-        if (affiliations_publications.find(affiliationid) == affiliations_publications.end()) {
-            // Initialize with the first publication
-            affiliations_publications[affiliationid] = {publicationid};
-        } else {
-            // Add to existing publications
-            affiliations_publications[affiliationid].push_back(publicationid);
+    auto pub_it = publications.find(publicationid);
+    AffiliationHandle handle = handle_of(affiliationid);
+    if (pub_it != publications.end() && handle != NO_HANDLE) {
+        pub_it->second.affiliations.push_back(handle);
+        year_index_insert(handle, pub_it->second.year, publicationid);
+        affiliation_publications[handle].push_back(publicationid);
+        if (journal) {
+            journal->record_add_affiliation_to_publication(affiliationid, publicationid);
         }
-
         return true;
     }
 
@@ -280,27 +724,21 @@ bool Datastructures::add_affiliation_to_publication(AffiliationID affiliationid,
 }
 
 // Retrieves a list of publications associated with a specified affiliation
-std::vector<PublicationID> Datastructures::get_publications(AffiliationID id)
+std::vector<PublicationID> Datastructures::get_publications(AffiliationID id) const
 {
     // Check if the affiliation exists
-    if (affiliations.find(id) == affiliations.end()) {
+    AffiliationHandle handle = handle_of(id);
+    if (handle == NO_HANDLE) {
         // The affiliation does not exist
         return {NO_PUBLICATION};
     }
 
-    // The affiliation exists, check if it has any publications
-    auto it = affiliations_publications.find(id);
-    if (it == affiliations_publications.end()) {
-        // The affiliation exists but has no publications
-        return {};
-    }
-
     // Return the list of publications for the affiliation
-    return it->second;
+    return affiliation_publications[handle].to_vector();
 }
 
 // Retrieves the parent publication of a specified publication
-PublicationID Datastructures::get_parent(PublicationID id) {
+PublicationID Datastructures::get_parent(PublicationID id) const {
     auto it = publications.find(id);
     if (it != publications.end()) {
         return it->second.parent;
@@ -311,135 +749,1099 @@ PublicationID Datastructures::get_parent(PublicationID id) {
 // Retrieves a list of publications after a specified year associated with a specific affiliation
 std::vector<std::pair<Year, PublicationID>> Datastructures::get_publications_after(AffiliationID affiliationid, Year year)
 {
-    std::vector<std::pair<Year, PublicationID>> result;
+    AffiliationHandle handle = handle_of(affiliationid);
+    if (handle == NO_HANDLE) {
+        return {};
+    }
 
-    auto it = affiliations_publications.find(affiliationid);
-    if (it != affiliations_publications.end()) {
-        for (PublicationID id : it->second) {
-            if (publications[id].year >= year) { // Changed from > to >=
-                result.emplace_back(publications[id].year, id);
-            }
+    // Sorted through a non-const reference only when needed, which would clone a chunk shared with a copy
+    if (!std::as_const(affiliation_years)[handle].sorted()) {
+        sort_year_index(affiliation_years[handle]);
+    }
+    return std::as_const(*this).get_publications_after(affiliationid, year);
+}
+
+std::vector<std::pair<Year, PublicationID>> Datastructures::get_publications_after(AffiliationID affiliationid, Year year) const
+{
+    AffiliationHandle handle = handle_of(affiliationid);
+    if (handle == NO_HANDLE) {
+        return {};
+    }
+
+    // The index is ordered by year and then by ID, so the result is the tail of its sorted prefix starting from
+    // the given year
+    auto const& index = affiliation_years[handle];
+    auto sorted_end = index.entries.begin() + index.sorted_size;
+    auto first = std::lower_bound(index.entries.begin(), sorted_end, std::make_pair(year, PublicationID{0}));
+    if (index.sorted()) {
+        return std::vector<std::pair<Year, PublicationID>>(first, sorted_end);
+    }
+
+    // The matching entries of the unsorted tail are sorted in a copy and merged in
+    std::vector<std::pair<Year, PublicationID>> appended;
+    std::copy_if(sorted_end, index.entries.end(), std::back_inserter(appended),
+                 [year](auto const& entry) { return entry.first >= year; });
+    std::sort(appended.begin(), appended.end());
+    std::vector<std::pair<Year, PublicationID>> result(static_cast<std::size_t>(sorted_end - first) + appended.size());
+    std::merge(first, sorted_end, appended.begin(), appended.end(), result.begin());
+    return result;
+}
+
+// The references of a publication: its slice of the compacted edge array followed by the ones added since
+Datastructures::Adjacency Datastructures::references_of(PublicationID id, PublicationInfo const& info) const {
+    Adjacency result{{{nullptr, nullptr}, {info.references.begin(), info.references.end()}}};
+    if (csr_compacted) {
+        auto slices_it = csr_slices.find(id);
+        if (slices_it != csr_slices.end()) {
+            PublicationID const* slice = csr_references.data(slices_it->second.references_begin);
+            result[0] = {slice, slice + slices_it->second.references_count};
         }
     }
+    return result;
+}
 
-    // Sort by year and then by ID
-    std::sort(result.begin(), result.end());
+// The publications referencing a publication, in the same layout as references_of
+Datastructures::Adjacency Datastructures::referrers_of(PublicationID id) const {
+    Adjacency result{};
+    if (csr_compacted) {
+        auto slices_it = csr_slices.find(id);
+        if (slices_it != csr_slices.end()) {
+            PublicationID const* slice = csr_referrers.data(slices_it->second.referrers_begin);
+            result[0] = {slice, slice + slices_it->second.referrers_count};
+        }
+    }
+    if (reverse_references.empty()) {
+        return result; // Right after a compaction there's no delta to look up
+    }
+    auto delta_it = reverse_references.find(id);
+    if (delta_it != reverse_references.end()) {
+        result[1] = {delta_it->second.begin(), delta_it->second.end()};
+    }
     return result;
 }
 
-// Retrieves a chain of publications that reference a specific publication
-std::vector<PublicationID> Datastructures::get_referenced_by_chain(PublicationID id) {
-    if (publications.find(id) == publications.end()) {
-        return {NO_PUBLICATION}; // Publication does not exist
+// Removes every occurrence of target from a slice of a compacted edge array. The freed tail of the slice is
+// left unused until the next compaction.
+void Datastructures::erase_from_slice(ChunkedSlices<PublicationID>& edges, unsigned int begin, unsigned int& count,
+                                      PublicationID target) {
+    PublicationID const* slice = edges.data(begin);
+    if (std::find(slice, slice + count, target) == slice + count) {
+        return; // Nothing to erase, so a block shared with a copy stays shared
     }
+    PublicationID* first = edges.writable(begin);
+    count = std::remove(first, first + count, target) - first;
+}
 
-    std::vector<PublicationID> chain;
-    std::unordered_set<PublicationID> visited;
+// Merges the delta into an already compacted citation graph once the edges added since the previous compaction are
+// a large enough fraction of the graph, so that the cost of compacting is amortized over the additions
+void Datastructures::compact_citation_graph_if_needed() {
+    if (csr_compacted && csr_delta_edges >= CSR_MIN_DELTA && csr_delta_edges >= csr_references.size() / CSR_DELTA_FRACTION) {
+        compact_citation_graph();
+    }
+}
 
-    std::function<void(PublicationID)> dfs = [&](PublicationID current_id) {
-        for (PublicationID ref_id : reverse_references[current_id]) {
-            if (visited.insert(ref_id).second) {
-                chain.push_back(ref_id);
-                dfs(ref_id);
+// Rebuilds the compacted edge arrays from the current slices and delta lists. The publications are laid out in
+// depth-first preorder from the roots, so that the traversals read the arrays mostly front to back.
+void Datastructures::compact_citation_graph() {
+    std::vector<std::pair<PublicationID, PublicationInfo*>> order;
+    order.reserve(publications.size());
+    std::vector<std::pair<PublicationID, PublicationInfo*>> stack;
+    start_traversal();
+    auto visit_from = [&](PublicationID root_id, PublicationInfo& root_info) {
+        if (root_info.visit_mark == traversal_epoch) {
+            return;
+        }
+        root_info.visit_mark = traversal_epoch;
+        stack.emplace_back(root_id, &root_info);
+        while (!stack.empty()) {
+            auto [id, info] = stack.back();
+            stack.pop_back();
+            order.emplace_back(id, info);
+
+            // Pushed in reverse, so that the first reference is visited first
+            Adjacency adjacent = references_of(id, *info);
+            for (auto range = adjacent.rbegin(); range != adjacent.rend(); ++range) {
+                for (auto child = range->second; child != range->first;) {
+                    --child;
+                    auto child_it = publications.find(*child);
+                    if (child_it != publications.end() && child_it->second.visit_mark != traversal_epoch) {
+                        child_it->second.visit_mark = traversal_epoch;
+                        stack.emplace_back(*child, &child_it->second);
+                    }
+                }
             }
         }
     };
 
-    dfs(id);
-    return chain;
+    // Roots first, then whatever is only reachable through reference cycles
+    for (auto& [id, info] : publications) {
+        Adjacency referrers = referrers_of(id);
+        if (referrers[0].first == referrers[0].second && referrers[1].first == referrers[1].second) {
+            visit_from(id, info);
+        }
+    }
+    for (auto& [id, info] : publications) {
+        visit_from(id, info);
+    }
+
+    // Every slice is appended at its full length and filled in from the ranges
+    auto append_slice = [](ChunkedSlices<PublicationID>& edges, Adjacency const& adjacent, unsigned int& begin,
+                           unsigned int& count) {
+        count = (adjacent[0].second - adjacent[0].first) + (adjacent[1].second - adjacent[1].first);
+        begin = edges.append(count);
+        PublicationID* out = edges.writable(begin);
+        for (auto [first, last] : adjacent) {
+            out = std::copy(first, last, out);
+        }
+    };
+    ChunkedSlices<PublicationID> references;
+    ChunkedSlices<PublicationID> referrers;
+    HybridIdMap<CsrSlices> slices;
+    for (auto [id, info] : order) {
+        CsrSlices& slice = slices[id];
+        append_slice(references, references_of(id, *info), slice.references_begin, slice.references_count);
+        append_slice(referrers, referrers_of(id), slice.referrers_begin, slice.referrers_count);
+        info->references.reset();
+    }
+
+    csr_references = std::move(references);
+    csr_referrers = std::move(referrers);
+    csr_slices = std::move(slices);
+    reverse_references.clear();
+    csr_compacted = true;
+    csr_delta_edges = 0;
 }
 
-// Retrieves all publications referenced by a specified publication
-std::vector<PublicationID> Datastructures::get_all_references(PublicationID id)
+// Starts a new traversal epoch, so that no publication counts as visited
+void Datastructures::start_traversal() {
+    if (++traversal_epoch == 0) {
+        // The epoch counter wrapped around, so old marks could be mistaken for current ones
+        for (auto& [id, info] : publications) {
+            info.visit_mark = 0;
+        }
+        traversal_epoch = 1;
+    }
+    traversal_stack.clear();
+}
+
+Datastructures::EpochVisits::EpochVisits(Datastructures& ds) : publications_(ds.publications), stack_(ds.traversal_stack) {
+    ds.start_traversal();
+    epoch_ = ds.traversal_epoch;
+}
+
+// Appends the publications reachable from start to result in depth-first preorder, each one at most once.
+// Neighbours maps a publication (ID and info) to the Adjacency ranges of the publications adjacent to it, and
+// Visits is the visited set and the stack of the search, EpochVisits or LocalVisits.
+template <typename Neighbours, typename Visits>
+void Datastructures::collect_reachable(PublicationID start, PublicationInfo const& start_info, Neighbours neighbours,
+                                       Visits& visits, std::vector<PublicationID>& result) const
 {
+    // The delta is pushed first, so that the CSR slice on top of it is walked first. Unrolled by hand, since looping
+    // over the ranges with reverse iterators compiled to code that was over twice as slow on long chains.
+    std::vector<PublicationRange>& stack = visits.stack();
+    auto push = [&stack](Adjacency const& adjacent) {
+        if (adjacent[1].first != adjacent[1].second) {
+            stack.emplace_back(adjacent[1].first, adjacent[1].second);
+        }
+        if (adjacent[0].first != adjacent[0].second) {
+            stack.emplace_back(adjacent[0].first, adjacent[0].second);
+        }
+    };
+
+    push(neighbours(start, start_info));
+    while (!stack.empty()) {
+        auto& range = stack.back();
+        if (range.first == range.second) {
+            stack.pop_back();
+            continue;
+        }
+
+        PublicationID id = *range.first++;
+        auto it = publications.find(id);
+        if (it == publications.end() || !visits.insert(id, it->second)) {
+            continue;
+        }
+        result.push_back(id);
+        push(neighbours(id, it->second));
+    }
+}
+
+// The traversal queries are answered by const bodies that take the visited set as a parameter. The non-const
+// overloads do the lazy maintenance first and pass epoch stamps, the const ones pass a local set.
+template <typename Visits>
+std::vector<PublicationID> Datastructures::referenced_by_chain(PublicationID id, Visits&& visits) const {
+    auto it = publications.find(id);
+    if (it == publications.end()) {
+        return {NO_PUBLICATION}; // Publication does not exist
+    }
+
+    std::vector<PublicationID> chain;
+    collect_reachable(id, it->second, [this](PublicationID current, PublicationInfo const&) {
+        return referrers_of(current);
+    }, visits, chain);
+    return chain;
+}
+
+template <typename Visits>
+std::vector<PublicationID> Datastructures::all_references(PublicationID id, Visits&& visits) const {
     auto it = publications.find(id);
     if (it == publications.end()) {
         return {NO_PUBLICATION}; // Handle non-existing publication
     }
 
-    std::unordered_set<PublicationID> visited;
+    if (SubtreeRange const* range = subtree_range(id)) {
+        return std::vector<PublicationID>(subtree_order.begin() + range->begin + 1, subtree_order.begin() + range->end);
+    }
+
+    // The work counts towards rebuilding the layout, which the next non-const query or prepare_for_reads does
+    // once it is due
     std::vector<PublicationID> result;
-    std::function<void(PublicationID)> dfs = [&](PublicationID current_id) {
-        for (PublicationID ref_id : publications[current_id].references) {
-            if (visited.insert(ref_id).second) { // Avoid duplicates
-                result.push_back(ref_id);
-                dfs(ref_id);
+    collect_reachable(id, it->second, [this](PublicationID current, PublicationInfo const& info) {
+        return references_of(current, info);
+    }, visits, result);
+    subtree_fallback_work.fetch_add(result.size() + 1, std::memory_order_relaxed);
+    return result;
+}
+
+template <typename Visits>
+int Datastructures::count_references(PublicationID id, Visits&& visits) const {
+    auto it = publications.find(id);
+    if (it == publications.end()) {
+        return NO_VALUE;
+    }
+
+    if (SubtreeRange const* range = subtree_range(id)) {
+        return range->end - range->begin - 1;
+    }
+    return static_cast<int>(all_references(id, visits).size());
+}
+
+// Retrieves a chain of publications that reference a specific publication
+std::vector<PublicationID> Datastructures::get_referenced_by_chain(PublicationID id) {
+    compact_citation_graph_if_needed();
+    return std::as_const(*this).referenced_by_chain(id, EpochVisits(*this));
+}
+
+std::vector<PublicationID> Datastructures::get_referenced_by_chain(PublicationID id) const {
+    return referenced_by_chain(id, LocalVisits());
+}
+
+// Retrieves all publications referenced by a specified publication
+std::vector<PublicationID> Datastructures::get_all_references(PublicationID id)
+{
+    rebuild_subtree_layout_if_due();
+    compact_citation_graph_if_needed();
+    return std::as_const(*this).all_references(id, EpochVisits(*this));
+}
+
+std::vector<PublicationID> Datastructures::get_all_references(PublicationID id) const
+{
+    return all_references(id, LocalVisits());
+}
+
+// Counts all publications referenced by a specified publication
+int Datastructures::count_all_references(PublicationID id)
+{
+    rebuild_subtree_layout_if_due();
+    compact_citation_graph_if_needed();
+    return std::as_const(*this).count_references(id, EpochVisits(*this));
+}
+
+int Datastructures::count_all_references(PublicationID id) const
+{
+    return count_references(id, LocalVisits());
+}
+
+void Datastructures::invalidate_subtree_layout() {
+    subtree_layout_valid = false;
+    subtree_fallback_work = 0;
+}
+
+// Drops the ranges of the publication and of everything that references it directly or indirectly, the only
+// subtrees that change when its references do. Stops at publications already dropped, as everything referencing
+// them has been dropped with them. Ranges are checked through the const interface first, so that only the chunks
+// of the dropped ranges get cloned.
+void Datastructures::invalidate_subtree_ranges_from(PublicationID id) {
+    if (!subtree_layout_valid) {
+        return;
+    }
+    std::vector<PublicationID> stack{id};
+    while (!stack.empty()) {
+        PublicationID current = stack.back();
+        stack.pop_back();
+        auto range_it = std::as_const(subtree_ranges).find(current);
+        if (range_it == subtree_ranges.end() || range_it->second.begin == SubtreeRange::NOT_IN_LAYOUT) {
+            continue;
+        }
+        subtree_ranges.find(current)->second.begin = SubtreeRange::NOT_IN_LAYOUT;
+        subtree_layout_stale = true;
+        for (auto [first, last] : referrers_of(current)) {
+            stack.insert(stack.end(), first, last);
+        }
+    }
+}
+
+// Tells whether the traversals since the layout changed have done as much work as a rebuild costs
+bool Datastructures::subtree_layout_due() const {
+    return (!subtree_layout_valid || subtree_layout_stale) && subtree_fallback_work >= publications.size();
+}
+
+void Datastructures::rebuild_subtree_layout_if_due() {
+    if (subtree_layout_due()) {
+        rebuild_subtree_layout();
+    }
+}
+
+// The range of the publication in the layout, or null if its references can't be read from the layout
+Datastructures::SubtreeRange const* Datastructures::subtree_range(PublicationID id) const {
+    if (!subtree_layout_valid) {
+        return nullptr;
+    }
+    auto it = subtree_ranges.find(id);
+    return it != subtree_ranges.end() && it->second.begin != SubtreeRange::NOT_IN_LAYOUT ? &it->second : nullptr;
+}
+
+// Lays out the reference forest in depth-first preorder, so that everything a publication references follows it
+// contiguously. If some publication is referenced twice the references don't form a forest and the layout stays
+// invalid. Publications caught in reference cycles are left out of the layout. The publications are only read,
+// so chunks shared with copies stay shared.
+void Datastructures::rebuild_subtree_layout() {
+    subtree_fallback_work = 0;
+    subtree_layout_stale = false;
+    ChunkedVector<PublicationID> order;
+    HybridIdMap<SubtreeRange> ranges;
+    order.reserve(publications.size());
+
+    // The roots are the publications nothing references
+    std::vector<std::pair<PublicationID, Adjacency>> stack;
+    for (auto const& [root_id, root_info] : std::as_const(publications)) {
+        Adjacency referrers = referrers_of(root_id);
+        if (referrers[0].first != referrers[0].second || referrers[1].first != referrers[1].second) {
+            continue;
+        }
+
+        ranges[root_id].begin = order.size();
+        order.push_back(root_id);
+        stack.emplace_back(root_id, references_of(root_id, root_info));
+        while (!stack.empty()) {
+            auto& [id, adjacent] = stack.back();
+            auto& range = adjacent[0].first != adjacent[0].second ? adjacent[0] : adjacent[1];
+            if (range.first == range.second) {
+                ranges[id].end = order.size();
+                stack.pop_back();
+                continue;
             }
+
+            PublicationID child = *range.first++;
+            auto child_it = std::as_const(publications).find(child);
+            if (child_it == publications.end()) {
+                continue;
+            }
+            SubtreeRange& child_range = ranges[child];
+            if (child_range.begin != SubtreeRange::NOT_IN_LAYOUT) {
+                return; // Referenced twice, not a forest
+            }
+            child_range.begin = order.size();
+            order.push_back(child);
+            stack.emplace_back(child, references_of(child, child_it->second));
         }
+    }
+
+    subtree_order = std::move(order);
+    subtree_ranges = std::move(ranges);
+    subtree_layout_valid = true;
+}
+
+// Returns the grid cell containing the given coordinate (cells extend towards negative infinity as well)
+Coord Datastructures::grid_cell_of(Coord xy) const {
+    auto floor_div = [this](int value) {
+        return value >= 0 ? value / grid_cell_size : -(-(value + 1) / grid_cell_size) - 1;
     };
+    return {floor_div(xy.x), floor_div(xy.y)};
+}
 
-    dfs(id);
+// Adds an affiliation to the grid cell of its coordinate and extends the bounding box of the grid
+void Datastructures::grid_insert(AffiliationHandle affiliation, Coord xy) {
+    Coord cell = grid_cell_of(xy);
+    writable_affiliation_indexes().grid[cell].emplace_back(xy, affiliation);
+
+    if (grid_min_cell == NO_COORD) {
+        grid_min_cell = cell;
+        grid_max_cell = cell;
+    } else {
+        grid_min_cell = {std::min(grid_min_cell.x, cell.x), std::min(grid_min_cell.y, cell.y)};
+        grid_max_cell = {std::max(grid_max_cell.x, cell.x), std::max(grid_max_cell.y, cell.y)};
+    }
+}
 
-    return result;
+// Removes an affiliation from the grid cell of its coordinate (the bounding box is only shrunk on rebuild)
+void Datastructures::grid_erase(AffiliationHandle affiliation, Coord xy) {
+    auto& grid = writable_affiliation_indexes().grid;
+    auto cell_it = grid.find(grid_cell_of(xy));
+    if (cell_it == grid.end()) {
+        return;
+    }
+
+    auto& entries = cell_it->second;
+    auto entry_it = std::find_if(entries.begin(), entries.end(), [affiliation](auto const& entry) { return entry.second == affiliation; });
+    if (entry_it != entries.end()) {
+        *entry_it = std::move(entries.back());
+        entries.pop_back();
+    }
+    if (entries.empty()) {
+        grid.erase(cell_it);
+    }
+}
+
+// Number of cells in the rectangle of cells with the given corners, as a double because it can exceed 2^64
+double Datastructures::grid_cells_between(Coord min_cell, Coord max_cell) const {
+    double width = static_cast<double>(max_cell.x) - min_cell.x + 1;
+    double height = static_cast<double>(max_cell.y) - min_cell.y + 1;
+    return width > 0 && height > 0 ? width * height : 0;
+}
+
+// Rebuilds the grid when the affiliations have grown fourfold since it was sized, or when its bounding box has grown
+// to span many more cells than there are affiliations, so that searches never walk long stretches of empty cells
+void Datastructures::rebuild_affiliation_grid_if_due() {
+    std::size_t affiliation_count = affiliation_indexes->handles.size();
+    bool grown = affiliation_count >= GRID_MIN_REBUILD_SIZE && affiliation_count >= 4 * grid_sized_for;
+    bool sparse = grid_cells_between(grid_min_cell, grid_max_cell)
+                  > static_cast<double>(GRID_MAX_CELLS_PER_AFFILIATION * std::max(affiliation_count, GRID_MIN_REBUILD_SIZE));
+    if (grown || sparse) {
+        rebuild_affiliation_grid();
+    }
 }
 
-std::vector<AffiliationID> Datastructures::get_affiliations_closest_to(Coord xy)
+// Chooses a cell size giving roughly two affiliations per cell over the current bounding box and refills the grid.
+// The cells are also at least 1/n of the longer side of the box, so that affiliations spread along a line don't
+// leave the box spanning more than about 2.5 n cells.
+void Datastructures::rebuild_affiliation_grid() {
+    AffiliationIndexes& indexes = writable_affiliation_indexes();
+    indexes.grid.clear();
+    grid_min_cell = NO_COORD;
+    grid_max_cell = NO_COORD;
+    grid_sized_for = indexes.handles.size();
+    if (indexes.handles.empty()) {
+        grid_cell_size = INITIAL_GRID_CELL_SIZE;
+        return;
+    }
+
+    // The coordinate arrays are scanned directly, skipping the free handles. The arrays are only read, so they are
+    // accessed as const and the chunks shared with copies stay shared.
+    auto const& ids = affiliation_ids;
+    auto const& xs = affiliation_xs;
+    auto const& ys = affiliation_ys;
+    Coord min = {std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    Coord max = {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+    for (AffiliationHandle handle = 0; handle < ids.size(); ++handle) {
+        if (ids[handle] == NO_AFFILIATION) {
+            continue;
+        }
+        min = {std::min(min.x, xs[handle]), std::min(min.y, ys[handle])};
+        max = {std::max(max.x, xs[handle]), std::max(max.y, ys[handle])};
+    }
+
+    double area = (static_cast<double>(max.x) - min.x + 1) * (static_cast<double>(max.y) - min.y + 1);
+    double longer_side = std::max(static_cast<double>(max.x) - min.x + 1, static_cast<double>(max.y) - min.y + 1);
+    double side = std::ceil(std::max(std::sqrt(2.0 * area / indexes.handles.size()), longer_side / indexes.handles.size()));
+    grid_cell_size = static_cast<int>(std::clamp(side, 1.0, static_cast<double>(std::numeric_limits<int>::max() / 4)));
+
+    indexes.grid.reserve(indexes.handles.size() / 2 + 1);
+    for (AffiliationHandle handle = 0; handle < ids.size(); ++handle) {
+        if (ids[handle] != NO_AFFILIATION) {
+            grid_insert(handle, affiliation_coord(handle));
+        }
+    }
+}
+
+// Returns the (at most) three affiliations closest to the given coordinate, ties broken by affiliation ID
+std::vector<AffiliationID> Datastructures::get_affiliations_closest_to(Coord xy) const
+{
+    return get_affiliations_closest_to(xy, 3);
+}
+
+// Returns the (at most) k affiliations closest to the given coordinate in distance order, ties broken by affiliation ID
+std::vector<AffiliationID> Datastructures::get_affiliations_closest_to(Coord xy, unsigned int k) const
 {
-    std::vector<std::pair<Distance, AffiliationID>> distances;
-    for (const auto& aff : affiliations) {
-        Coord aff_coord = std::get<1>(aff.second);
-        int dx = aff_coord.x - xy.x;
-        int dy = aff_coord.y - xy.y;
-        Distance dist = dx * dx + dy * dy;
-        distances.emplace_back(dist, aff.first);
+    std::size_t const wanted = k;
+    auto const& grid = affiliation_indexes->grid;
+    if (grid.empty() || wanted == 0) {
+        return {};
     }
 
-    std::sort(distances.begin(), distances.end());
+    // Max-heap of the closest candidates found so far, the farthest one on top
+    using Candidate = std::pair<long long, AffiliationHandle>;
+    auto closer = [this](Candidate const& a, Candidate const& b) {
+        return a.first < b.first || (a.first == b.first && affiliation_ids[a.second] < affiliation_ids[b.second]);
+    };
+    std::vector<Candidate> best;
+    best.reserve(std::min(wanted, affiliation_indexes->handles.size()));
+
+    auto visit_entries = [&](auto const& entries) {
+        for (const auto& [coord, handle] : entries) {
+            long long dx = static_cast<long long>(coord.x) - xy.x;
+            long long dy = static_cast<long long>(coord.y) - xy.y;
+            Candidate candidate{dx * dx + dy * dy, handle};
+            if (best.size() < wanted) {
+                best.push_back(candidate);
+                std::push_heap(best.begin(), best.end(), closer);
+            } else if (closer(candidate, best.front())) {
+                std::pop_heap(best.begin(), best.end(), closer);
+                best.back() = candidate;
+                std::push_heap(best.begin(), best.end(), closer);
+            }
+        }
+    };
+    auto visit_cell = [&](long long cx, long long cy) {
+        auto it = grid.find({static_cast<int>(cx), static_cast<int>(cy)});
+        if (it != grid.end()) {
+            visit_entries(it->second);
+        }
+    };
+
+    Coord centre = grid_cell_of(xy);
+    long long const cx = centre.x, cy = centre.y;
+    long long const min_x = grid_min_cell.x, min_y = grid_min_cell.y;
+    long long const max_x = grid_max_cell.x, max_y = grid_max_cell.y;
+    long long const size = grid_cell_size;
+
+    // Cells of the bounding box at most `ring` cells from the centre cell
+    auto cells_within = [&](long long ring) {
+        if (ring < 0) {
+            return 0.0;
+        }
+        Coord low = {static_cast<int>(std::max(cx - ring, min_x)), static_cast<int>(std::max(cy - ring, min_y))};
+        Coord high = {static_cast<int>(std::min(cx + ring, max_x)), static_cast<int>(std::min(cy + ring, max_y))};
+        return grid_cells_between(low, high);
+    };
+
+    // Rings that lie completely outside the bounding box of the grid can be skipped. Once the rings would have
+    // looked up more cells than the grid has occupied ones, the occupied cells not visited yet are scanned
+    // directly instead, so a sparse grid costs at most twice its number of occupied cells.
+    long long ring = std::max({0LL, min_x - cx, cx - max_x, min_y - cy, cy - max_y});
+    double looked_up = 0;
+    for (;; ++ring) {
+        looked_up += cells_within(ring) - cells_within(ring - 1);
+        if (looked_up > static_cast<double>(grid.size())) {
+            for (auto const& [cell, entries] : grid) {
+                if (std::max(std::abs(cell.x - cx), std::abs(cell.y - cy)) >= ring) {
+                    visit_entries(entries);
+                }
+            }
+            break;
+        }
+
+        // Visit the cells at Chebyshev distance `ring` from the centre cell, clipped to the bounding box
+        for (long long y = std::max(cy - ring, min_y); y <= std::min(cy + ring, max_y); ++y) {
+            if (y == cy - ring || y == cy + ring) {
+                for (long long x = std::max(cx - ring, min_x); x <= std::min(cx + ring, max_x); ++x) {
+                    visit_cell(x, y);
+                }
+            } else {
+                if (cx - ring >= min_x) { visit_cell(cx - ring, y); }
+                if (cx + ring <= max_x) { visit_cell(cx + ring, y); }
+            }
+        }
 
+        if (cx - ring <= min_x && cx + ring >= max_x && cy - ring <= min_y && cy + ring >= max_y) {
+            break; // Every cell has been visited
+        }
+
+        if (best.size() == wanted) {
+            // Any affiliation outside the visited square is at least this far away
+            long long bound = std::min({xy.x - (cx - ring) * size + 1, (cx + ring + 1) * size - xy.x,
+                                        xy.y - (cy - ring) * size + 1, (cy + ring + 1) * size - xy.y});
+            if (best.front().first < bound * bound) {
+                break;
+            }
+        }
+    }
+
+    std::sort_heap(best.begin(), best.end(), closer);
     std::vector<AffiliationID> closest;
-    for (int i = 0; i < std::min(3, static_cast<int>(distances.size())); ++i) {
-        closest.push_back(distances[i].second);
+    for (const auto& candidate : best) {
+        closest.push_back(affiliation_ids[candidate.second]);
     }
 
     return closest;
 }
 
+// Collects the grid entries whose coordinates lie inside the given rectangle (bounds inclusive). The cells of the
+// rectangle are looked up one by one, or the occupied cells scanned instead if there are fewer of them.
+std::vector<std::pair<Coord, AffiliationHandle> const*> Datastructures::grid_entries_in_rect(Coord min, Coord max) const
+{
+    std::vector<std::pair<Coord, AffiliationHandle> const*> entries;
+    auto const& grid = affiliation_indexes->grid;
+    if (grid.empty() || min.x > max.x || min.y > max.y) {
+        return entries;
+    }
+
+    auto collect = [&](auto const& cell_entries) {
+        for (const auto& entry : cell_entries) {
+            Coord c = entry.first;
+            if (c.x >= min.x && c.x <= max.x && c.y >= min.y && c.y <= max.y) {
+                entries.push_back(&entry);
+            }
+        }
+    };
+
+    // The cells of the rectangle, clipped to the bounding box of the grid
+    Coord min_cell = grid_cell_of(min);
+    Coord max_cell = grid_cell_of(max);
+    min_cell = {std::max(min_cell.x, grid_min_cell.x), std::max(min_cell.y, grid_min_cell.y)};
+    max_cell = {std::min(max_cell.x, grid_max_cell.x), std::min(max_cell.y, grid_max_cell.y)};
+
+    if (grid_cells_between(min_cell, max_cell) > static_cast<double>(grid.size())) {
+        for (auto const& [cell, cell_entries] : grid) {
+            if (cell.x >= min_cell.x && cell.x <= max_cell.x && cell.y >= min_cell.y && cell.y <= max_cell.y) {
+                collect(cell_entries);
+            }
+        }
+        return entries;
+    }
+
+    for (int y = min_cell.y; y <= max_cell.y; ++y) {
+        for (int x = min_cell.x; x <= max_cell.x; ++x) {
+            auto it = grid.find({x, y});
+            if (it != grid.end()) {
+                collect(it->second);
+            }
+        }
+    }
+    return entries;
+}
+
+// Returns the affiliations within the given distance of a coordinate in distance order, ties broken by affiliation ID
+std::vector<AffiliationID> Datastructures::get_affiliations_within(Coord xy, Distance radius) const
+{
+    if (radius < 0) {
+        return {};
+    }
+
+    auto clamp_to_int = [](long long value) {
+        return static_cast<int>(std::clamp<long long>(value, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()));
+    };
+    Coord min = {clamp_to_int(static_cast<long long>(xy.x) - radius), clamp_to_int(static_cast<long long>(xy.y) - radius)};
+    Coord max = {clamp_to_int(static_cast<long long>(xy.x) + radius), clamp_to_int(static_cast<long long>(xy.y) + radius)};
+
+    long long const limit = static_cast<long long>(radius) * radius;
+    std::vector<std::pair<long long, AffiliationHandle>> found;
+    for (auto entry : grid_entries_in_rect(min, max)) {
+        long long dx = static_cast<long long>(entry->first.x) - xy.x;
+        long long dy = static_cast<long long>(entry->first.y) - xy.y;
+        if (dx * dx + dy * dy <= limit) {
+            found.emplace_back(dx * dx + dy * dy, entry->second);
+        }
+    }
+
+    std::sort(found.begin(), found.end(), [this](auto const& a, auto const& b) {
+        return a.first < b.first || (a.first == b.first && affiliation_ids[a.second] < affiliation_ids[b.second]);
+    });
+    std::vector<AffiliationID> result;
+    result.reserve(found.size());
+    for (const auto& [distance, handle] : found) {
+        result.push_back(affiliation_ids[handle]);
+    }
+    return result;
+}
+
+// Returns the affiliations inside the given rectangle (bounds inclusive) in increasing distance from the origin,
+// ties broken by affiliation ID, like get_affiliations_distance_increasing
+std::vector<AffiliationID> Datastructures::get_affiliations_in_rect(Coord min, Coord max) const
+{
+    std::vector<std::pair<Distance, AffiliationHandle>> found;
+    for (auto entry : grid_entries_in_rect(min, max)) {
+        found.emplace_back(calculate_distance_from_origin(entry->first), entry->second);
+    }
+
+    std::sort(found.begin(), found.end(), [this](auto const& a, auto const& b) {
+        return a.first < b.first || (a.first == b.first && affiliation_ids[a.second] < affiliation_ids[b.second]);
+    });
+    std::vector<AffiliationID> result;
+    result.reserve(found.size());
+    for (const auto& [distance, handle] : found) {
+        result.push_back(affiliation_ids[handle]);
+    }
+    return result;
+}
+
+// Removes an affiliation in time proportional to the number of its publications, keeping every index consistent
 bool Datastructures::remove_affiliation(AffiliationID id)
 {
-    auto aff_it = affiliations.find(id);
-    if (aff_it == affiliations.end()) {
+    AffiliationHandle handle = handle_of(id);
+    if (handle == NO_HANDLE) {
         return false;
     }
 
-    for (auto& pub : publications) {
-        pub.second.affiliations.erase(
-            std::remove(pub.second.affiliations.begin(), pub.second.affiliations.end(), id),
-            pub.second.affiliations.end());
+    // Only the publications of this affiliation can refer to it
+    for (PublicationID publicationid : affiliation_publications[handle]) {
+        auto pub_it = publications.find(publicationid);
+        if (pub_it != publications.end()) {
+            auto& affs = pub_it->second.affiliations;
+            affs.erase(std::remove(affs.begin(), affs.end(), handle), affs.end());
+        }
+    }
+    affiliation_publications[handle].reset();
+    affiliation_years[handle].entries.clear();
+    affiliation_years[handle].entries.shrink_to_fit();
+    affiliation_years[handle].sorted_size = 0;
+
+    // Remove the affiliation from the spatial and sorted indexes while its name and coordinates are still there
+    grid_erase(handle, affiliation_coord(handle));
+    erase_from_sorted_affiliations(sorted_affiliations_by_name, unmerged_affiliations_by_name, handle, AffiliationsByName{this});
+    erase_from_sorted_affiliations(sorted_affiliations_by_distance, unmerged_affiliations_by_distance, handle, AffiliationsByDistance{this});
+    affiliations_sorted_by_name = unmerged_affiliations_by_name.empty();
+    affiliations_sorted_by_distance = unmerged_affiliations_by_distance.empty();
+
+    // Free the handle for reuse
+    affiliation_ids[handle] = NO_AFFILIATION;
+    affiliation_names[handle].clear();
+    free_affiliation_handles.push_back(handle);
+    writable_affiliation_indexes().handles.erase(id);
+    if (journal) {
+        journal->record_remove_affiliation(id);
     }
-
-    affiliations.erase(aff_it);
     return true;
 }
 
-// Utility function to get the ancestors of a publication
-std::vector<PublicationID> Datastructures::get_ancestors(PublicationID id) {
-    std::vector<PublicationID> ancestors;
-    while (id != NO_PUBLICATION) {
-        ancestors.push_back(id);
-        id = get_parent(id); // Assuming get_parent returns NO_PUBLICATION if parent doesn't exist
+// Fills in the depth and the 2^i-th ancestors of a publication whose parent's jump table is up to date
+void Datastructures::compute_ancestor_jumps(PublicationInfo& info, PublicationID parent) {
+    info.ancestor_jumps.clear();
+    if (parent == NO_PUBLICATION) {
+        info.depth = 0;
+        return;
+    }
+
+    // The ancestors are only read, so they are looked up through the const map and chunks shared with copies stay
+    // shared
+    auto const& all = std::as_const(publications);
+    info.depth = all.find(parent)->second.depth + 1;
+    info.ancestor_jumps.push_back(parent);
+
+    // The 2^i-th ancestor is the 2^(i-1)-th ancestor of the 2^(i-1)-th ancestor
+    for (std::size_t i = 1; (std::size_t{1} << i) <= info.depth; ++i) {
+        auto const& half_way = all.find(info.ancestor_jumps[i - 1])->second;
+        info.ancestor_jumps.push_back(half_way.ancestor_jumps[i - 1]);
+    }
+}
+
+// Recomputes the jump tables of a publication and everything below it after its parent has changed. Gives up and
+// invalidates the whole ancestor index if the subtree turns out to be so large that a rebuild is about as cheap.
+void Datastructures::refresh_ancestor_subtree(PublicationID id) {
+    std::size_t const budget = publications.size() / ANCESTOR_REFRESH_FRACTION + ANCESTOR_REFRESH_MIN;
+    std::vector<PublicationID> queue{id};
+    for (std::size_t next = 0; next < queue.size(); ++next) {
+        if (next == budget) {
+            ancestor_index_valid = false;
+            return;
+        }
+
+        PublicationID current = queue[next];
+        auto& info = publications.find(current)->second;
+        compute_ancestor_jumps(info, publications.count(info.parent) != 0 ? info.parent : NO_PUBLICATION);
+        for (auto [first, last] : references_of(current, info)) {
+            for (; first != last; ++first) {
+                auto const& all = std::as_const(publications);
+                auto child_it = all.find(*first);
+                if (child_it != all.end() && child_it->second.parent == current) {
+                    queue.push_back(*first);
+                }
+            }
+        }
     }
-    return ancestors;
 }
 
-// Function to find the closest common parent of two publications
+// Recomputes every jump table top-down from the roots of the reference forest
+void Datastructures::rebuild_ancestor_index() {
+    std::vector<PublicationID> queue;
+    queue.reserve(publications.size());
+
+    // Publications with no (existing) parent are roots, and so are publications caught in reference cycles
+    for (auto& [id, info] : publications) {
+        info.depth = 0;
+        info.ancestor_jumps.clear();
+        if (info.parent == NO_PUBLICATION || publications.find(info.parent) == publications.end()) {
+            queue.push_back(id);
+        }
+    }
+
+    for (std::size_t next = 0; next < queue.size(); ++next) {
+        PublicationID parent = queue[next];
+        for (auto [first, last] : references_of(parent, publications.find(parent)->second)) {
+            for (; first != last; ++first) {
+                auto& child_info = publications.find(*first)->second;
+                if (child_info.parent == parent) {
+                    compute_ancestor_jumps(child_info, parent);
+                    queue.push_back(*first);
+                }
+            }
+        }
+    }
+
+    ancestor_index_valid = true;
+}
+
+// Returns the ancestor the given number of steps above a publication, which must be at most its depth
+PublicationID Datastructures::lift(PublicationID id, unsigned int steps) const {
+    for (std::size_t i = 0; steps != 0; ++i, steps >>= 1) {
+        if (steps & 1) {
+            id = publications.find(id)->second.ancestor_jumps[i];
+        }
+    }
+    return id;
+}
+
+// Function to find the closest common parent of two publications, i.e. the deepest publication that is
+// a (direct or indirect) parent of both
 PublicationID Datastructures::get_closest_common_parent(PublicationID id1, PublicationID id2) {
-    std::vector<PublicationID> ancestors1 = get_ancestors(id1);
-    std::vector<PublicationID> ancestors2 = get_ancestors(id2);
+    if (!ancestor_index_valid) {
+        rebuild_ancestor_index();
+    }
+    return std::as_const(*this).get_closest_common_parent(id1, id2);
+}
+
+PublicationID Datastructures::get_closest_common_parent(PublicationID id1, PublicationID id2) const {
+    PublicationID parent1 = get_parent(id1);
+    PublicationID parent2 = get_parent(id2);
+    if (publications.find(parent1) == publications.end() || publications.find(parent2) == publications.end()) {
+        return NO_PUBLICATION;
+    }
+
+    if (!ancestor_index_valid) {
+        // Collect the ancestors of both parents by walking the parent links. A parent whose chain runs into a
+        // reference cycle counts as a root of its own, like in rebuild_ancestor_index.
+        auto climb = [this](PublicationID start, std::unordered_set<PublicationID>& ancestors) {
+            for (auto it = publications.find(start); it != publications.end(); it = publications.find(it->second.parent)) {
+                if (!ancestors.insert(it->first).second) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        std::unordered_set<PublicationID> ancestors1;
+        std::unordered_set<PublicationID> ancestors2;
+        if (!climb(parent1, ancestors1) || !climb(parent2, ancestors2)) {
+            return parent1 == parent2 ? parent1 : NO_PUBLICATION;
+        }
+        for (auto it = publications.find(parent2); it != publications.end(); it = publications.find(it->second.parent)) {
+            if (ancestors1.count(it->first) != 0) {
+                return it->first;
+            }
+        }
+        return NO_PUBLICATION;
+    }
+
+    // Lift the deeper of the parents to the depth of the other one
+    unsigned int depth1 = publications.find(parent1)->second.depth;
+    unsigned int depth2 = publications.find(parent2)->second.depth;
+    if (depth1 > depth2) {
+        parent1 = lift(parent1, depth1 - depth2);
+    } else {
+        parent2 = lift(parent2, depth2 - depth1);
+    }
+    if (parent1 == parent2) {
+        return parent1;
+    }
+
+    // Climb with decreasing jump lengths as long as the ancestors differ, ending just below the common parent
+    auto const* jumps1 = &publications.find(parent1)->second.ancestor_jumps;
+    auto const* jumps2 = &publications.find(parent2)->second.ancestor_jumps;
+    for (std::size_t i = jumps1->size(); i-- > 0; ) {
+        if (i < jumps1->size() && (*jumps1)[i] != (*jumps2)[i]) {
+            jumps1 = &publications.find((*jumps1)[i])->second.ancestor_jumps;
+            jumps2 = &publications.find((*jumps2)[i])->second.ancestor_jumps;
+        }
+    }
+
+    // Publications in different trees end up at two distinct roots
+    return jumps1->empty() ? NO_PUBLICATION : jumps1->front();
+}
 
-    // Reverse the ancestor vectors to start comparing from the root
-    std::reverse(ancestors1.begin(), ancestors1.end());
-    std::reverse(ancestors2.begin(), ancestors2.end());
+// Brings every lazily maintained index up to date, so that the const queries find them valid
+void Datastructures::prepare_for_reads() {
+    update_sorted_affiliations_by_name();
+    update_sorted_affiliations_by_distance();
+    for (AffiliationHandle handle : unsorted_year_indexes) {
+        sort_year_index(affiliation_years[handle]);
+    }
+    unsorted_year_indexes.clear();
+    if (!ancestor_index_valid) {
+        rebuild_ancestor_index();
+    }
+    compact_citation_graph_if_needed();
+    rebuild_subtree_layout_if_due();
+}
 
-    // Find the first common ancestor
-    for (auto ancestor1 : ancestors1) {
-        if (std::find(ancestors2.begin(), ancestors2.end(), ancestor1) != ancestors2.end()) {
-            return ancestor1;
+// Brings the lazily maintained indexes up to date like prepare_for_reads, except for the buffers that are still
+// small compared to what they would be merged into. Merging those on every call would rewrite the sorted orders
+// and year indexes, and so clone all of their chunks, after every few mutations.
+void Datastructures::prepare_for_copies() {
+    if (unmerged_affiliations_by_name.size() * BULK_REBUILD_FRACTION >= sorted_affiliations_by_name.size()) {
+        update_sorted_affiliations_by_name();
+    }
+    if (unmerged_affiliations_by_distance.size() * BULK_REBUILD_FRACTION >= sorted_affiliations_by_distance.size()) {
+        update_sorted_affiliations_by_distance();
+    }
+    auto still_unsorted = std::remove_if(unsorted_year_indexes.begin(), unsorted_year_indexes.end(), [this](AffiliationHandle handle) {
+        YearIndex const& index = std::as_const(affiliation_years)[handle];
+        if (index.sorted()) {
+            return true; // Already sorted by get_publications_after
         }
+        if ((index.entries.size() - index.sorted_size) * BULK_REBUILD_FRACTION < index.sorted_size) {
+            return false;
+        }
+        sort_year_index(affiliation_years[handle]);
+        return true;
+    });
+    unsorted_year_indexes.erase(still_unsorted, unsorted_year_indexes.end());
+    if (!ancestor_index_valid) {
+        rebuild_ancestor_index();
+    }
+    compact_citation_graph_if_needed();
+    rebuild_subtree_layout_if_due();
+}
+
+void Datastructures::take_traversal_work(Datastructures const& copy) {
+    std::size_t work = copy.subtree_fallback_work.load(std::memory_order_relaxed);
+    if (work > subtree_fallback_work) {
+        subtree_fallback_work = work;
     }
+}
 
-    return NO_PUBLICATION; // Return NO_PUBLICATION if there's no common ancestor
+bool Datastructures::prepared_for_reads() const {
+    bool compaction_due = csr_compacted && csr_delta_edges >= CSR_MIN_DELTA
+                          && csr_delta_edges >= csr_references.size() / CSR_DELTA_FRACTION;
+    return affiliations_sorted_by_name && affiliations_sorted_by_distance && unsorted_year_indexes.empty()
+           && ancestor_index_valid && !compaction_due && !subtree_layout_due();
 }
 
+// Answers get_closest_common_parent for many pairs at once with Tarjan's offline lowest common ancestor algorithm
+std::vector<PublicationID> Datastructures::get_closest_common_parents(std::vector<std::pair<PublicationID, PublicationID>> const& pairs) const
+{
+    std::vector<PublicationID> result(pairs.size(), NO_PUBLICATION);
+
+    // Number the publications densely and store the forest as child lists indexed by those numbers
+    std::vector<PublicationID> ids;
+    ids.reserve(publications.size());
+    std::unordered_map<PublicationID, std::size_t> index_of;
+    index_of.reserve(publications.size());
+    for (const auto& [id, info] : publications) {
+        index_of.emplace(id, ids.size());
+        ids.push_back(id);
+    }
+    std::size_t const n = ids.size();
+
+    std::vector<std::size_t> parent_of(n, n);
+    std::vector<std::size_t> child_start(n + 1, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+        auto parent_it = index_of.find(publications.find(ids[i])->second.parent);
+        if (parent_it != index_of.end()) {
+            parent_of[i] = parent_it->second;
+            ++child_start[parent_it->second + 1];
+        }
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        child_start[i + 1] += child_start[i];
+    }
+    std::vector<std::size_t> children(child_start[n]);
+    std::vector<std::size_t> fill(child_start.begin(), child_start.end() - 1);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (parent_of[i] != n) {
+            children[fill[parent_of[i]]++] = i;
+        }
+    }
+
+    // The pairs are answered for the parents of the given publications, attached to both of them. A pair with the
+    // same parent twice is answered right away with that parent, as get_closest_common_parent does, also when the
+    // parent is in a reference cycle, which the search from the roots never reaches.
+    std::vector<std::size_t> query_start(n + 1, 0);
+    std::vector<std::pair<std::size_t, std::size_t>> query_nodes(pairs.size(), {n, n});
+    for (std::size_t q = 0; q < pairs.size(); ++q) {
+        auto it1 = index_of.find(get_parent(pairs[q].first));
+        auto it2 = index_of.find(get_parent(pairs[q].second));
+        if (it1 != index_of.end() && it2 != index_of.end() && it1->second == it2->second) {
+            result[q] = ids[it1->second];
+        } else if (it1 != index_of.end() && it2 != index_of.end()) {
+            query_nodes[q] = {it1->second, it2->second};
+            ++query_start[it1->second + 1];
+            ++query_start[it2->second + 1];
+        }
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        query_start[i + 1] += query_start[i];
+    }
+    std::vector<std::size_t> queries(query_start[n]);
+    fill.assign(query_start.begin(), query_start.end() - 1);
+    for (std::size_t q = 0; q < pairs.size(); ++q) {
+        if (query_nodes[q].first != n) {
+            queries[fill[query_nodes[q].first]++] = q;
+            queries[fill[query_nodes[q].second]++] = q;
+        }
+    }
+
+    // Union-find over the finished subtrees, each set remembering its topmost node still on the DFS stack
+    std::vector<std::size_t> set_parent(n);
+    std::vector<std::size_t> set_ancestor(n);
+    std::vector<std::size_t> tree_of(n, n);
+    std::vector<bool> finished(n, false);
+    for (std::size_t i = 0; i < n; ++i) {
+        set_parent[i] = i;
+    }
+    auto find = [&set_parent](std::size_t x) {
+        std::size_t root = x;
+        while (set_parent[root] != root) {
+            root = set_parent[root];
+        }
+        while (set_parent[x] != root) {
+            std::size_t next = set_parent[x];
+            set_parent[x] = root;
+            x = next;
+        }
+        return root;
+    };
+
+    // Iterative DFS from every root, the stack holding (node, next child position)
+    std::vector<std::pair<std::size_t, std::size_t>> stack;
+    for (std::size_t root = 0; root < n; ++root) {
+        if (parent_of[root] != n) {
+            continue;
+        }
+        stack.emplace_back(root, child_start[root]);
+        tree_of[root] = root;
+        set_ancestor[root] = root;
+        while (!stack.empty()) {
+            auto& [node, next_child] = stack.back();
+            if (next_child < child_start[node + 1]) {
+                std::size_t child = children[next_child++];
+                tree_of[child] = root;
+                set_ancestor[child] = child;
+                stack.emplace_back(child, child_start[child]);
+                continue;
+            }
+
+            std::size_t done = node;
+            finished[done] = true;
+            for (std::size_t i = query_start[done]; i < query_start[done + 1]; ++i) {
+                std::size_t q = queries[i];
+                std::size_t other = query_nodes[q].first == done ? query_nodes[q].second : query_nodes[q].first;
+                if (finished[other] && tree_of[other] == root) {
+                    result[q] = ids[set_ancestor[find(other)]];
+                }
+            }
+            stack.pop_back();
+
+            if (!stack.empty()) {
+                std::size_t up = stack.back().first;
+                set_parent[find(done)] = find(up);
+                set_ancestor[find(up)] = up;
+            }
+        }
+    }
+
+    return result;
+}
+
+// Removes a publication in time proportional to the number of its references, referrers and affiliations
 bool Datastructures::remove_publication(PublicationID publicationid)
 {
     auto pub_it = publications.find(publicationid);
@@ -447,31 +1849,69 @@ bool Datastructures::remove_publication(PublicationID publicationid)
         return false; // Publication does not exist
     }
 
+    invalidate_subtree_ranges_from(publicationid);
+
     // Remove publication from affiliations' publications list
-    for (const auto& affiliation_id : pub_it->second.affiliations) {
-        auto& pubs = affiliations_publications[affiliation_id];
+    for (AffiliationHandle affiliation : pub_it->second.affiliations) {
+        auto& pubs = affiliation_publications[affiliation];
         pubs.erase(std::remove(pubs.begin(), pubs.end(), publicationid), pubs.end());
+        year_index_erase(affiliation, pub_it->second.year, publicationid);
     }
 
-    // Remove the publication from reverse_references of its references
-    for (auto& reference_id : pub_it->second.references) {
-        if (publications.find(reference_id) != publications.end()) {
-            auto& reverse_refs = reverse_references[reference_id];
-            reverse_refs.erase(std::remove(reverse_refs.begin(), reverse_refs.end(), publicationid), reverse_refs.end());
+    // The publications it references lose their link to it and become roots unless they were re-attached elsewhere.
+    // The edges are removed from both the compacted slices and the delta lists.
+    for (auto [first, last] : references_of(publicationid, pub_it->second)) {
+        for (; first != last; ++first) {
+            PublicationID reference_id = *first;
+            auto ref_it = publications.find(reference_id);
+            if (ref_it == publications.end()) {
+                continue;
+            }
+            auto& ref_info = ref_it->second;
+            if (ref_info.parent == publicationid) {
+                ref_info.parent = NO_PUBLICATION;
+                if (ancestor_index_valid) {
+                    refresh_ancestor_subtree(reference_id);
+                }
+            }
+            auto slices_it = csr_slices.find(reference_id);
+            if (slices_it != csr_slices.end()) {
+                auto& slices = slices_it->second;
+                erase_from_slice(csr_referrers, slices.referrers_begin, slices.referrers_count, publicationid);
+            }
+            auto reverse_it = reverse_references.find(reference_id);
+            if (reverse_it != reverse_references.end()) {
+                auto& reverse_refs = reverse_it->second;
+                reverse_refs.erase(std::remove(reverse_refs.begin(), reverse_refs.end(), publicationid), reverse_refs.end());
+                if (reverse_refs.empty()) {
+                    reverse_references.erase(reverse_it);
+                }
+            }
         }
     }
 
-    // Update references in other publications that reference this publication
-    for (auto& [id, pub] : publications) {
-        pub.references.erase(
-            std::remove(pub.references.begin(), pub.references.end(), publicationid),
-            pub.references.end());
+    // Update references in the publications that reference this publication
+    for (auto [first, last] : referrers_of(publicationid)) {
+        for (; first != last; ++first) {
+            auto parent_it = publications.find(*first);
+            if (parent_it != publications.end()) {
+                auto slices_it = csr_slices.find(*first);
+                if (slices_it != csr_slices.end()) {
+                    auto& slices = slices_it->second;
+                    erase_from_slice(csr_references, slices.references_begin, slices.references_count, publicationid);
+                }
+                auto& refs = parent_it->second.references;
+                refs.erase(std::remove(refs.begin(), refs.end(), publicationid), refs.end());
+            }
+        }
     }
-
-    // Remove the publication from reverse_references map
     reverse_references.erase(publicationid);
+    csr_slices.erase(publicationid);
 
     // Finally, remove the publication
     publications.erase(pub_it);
+    if (journal) {
+        journal->record_remove_publication(publicationid);
+    }
     return true;
 }
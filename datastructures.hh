@@ -12,7 +12,15 @@
 #include <limits>
 #include <functional>
 #include <exception>
-#include <set>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "flatmap.hh"
+#include "smallvector.hh"
 
 // Types for IDs
 using AffiliationID = std::string;
@@ -34,15 +42,32 @@ int const NO_VALUE = std::numeric_limits<int>::min();
 
 // *********************OMA LISÄÄMÄ******************** HOX
 struct PublicationInfo;
+class MutationJournal;
+
+// Dense internal handle of an affiliation, AffiliationIDs are only used at the public interface
+using AffiliationHandle = std::uint32_t;
+AffiliationHandle const NO_HANDLE = std::numeric_limits<AffiliationHandle>::max();
+
+// Short lists kept inline: a publication usually has a few affiliations, at most a couple of direct references
+// and a single referrer, and an affiliation a few publications
+using AffiliationList = SmallVector<AffiliationHandle, 4>;
+using PublicationList = SmallVector<PublicationID, 2>;
+using AffiliationPublicationList = SmallVector<PublicationID, 4>;
 
 // Definition of the PublicationInfo struct
 struct PublicationInfo
 {
     Name name;
     Year year;
-    std::vector<AffiliationID> affiliations;
-    std::vector<PublicationID> references;
+    AffiliationList affiliations;
+    // References added after the last compaction of the citation graph, the older ones are in its CSR arrays
+    PublicationList references;
     PublicationID parent = NO_PUBLICATION;
+    // Ancestor index for binary lifting: depth below the root and the 2^i-th parents
+    unsigned int depth = 0;
+    std::vector<PublicationID> ancestor_jumps;
+    // Traversal epoch in which the publication was last visited, see Datastructures::EpochVisits
+    unsigned int visit_mark = 0;
 };
 
 // Type for a coordinate (x, y)
@@ -52,6 +77,22 @@ struct Coord
     int y = NO_VALUE;
 };
 
+// Records for the bulk insertion operations
+struct AffiliationRecord
+{
+    AffiliationID id;
+    Name name;
+    Coord xy;
+};
+
+struct PublicationRecord
+{
+    PublicationID id;
+    Name name;
+    Year year;
+    std::vector<AffiliationID> affiliations;
+};
+
 
 // Example: Defining == and hash function for Coord so that it can be used
 // as key for std::unordered_map/set, if needed
@@ -107,9 +148,17 @@ public:
     Datastructures();
     ~Datastructures();
 
+    // Estimate of performance: O(n / c), where n is the total number of affiliations, publications and references
+    // and c the number of elements in a chunk
+    // Short rationale for estimate: The chunked containers and the affiliation indexes are shared with the copy
+    // until one of the two writes to them, so only their chunk pointers and the small buffers are copied, see
+    // chunkedvector.hh. The copy gets no journal.
+    Datastructures(Datastructures const& other);
+    Datastructures& operator=(Datastructures const&) = delete;
+
     // Estimate of performance: O(1)
     // Short rationale for estimate: Returns the size of a hash map, which is an O(1) operation.
-    unsigned int get_affiliation_count();
+    unsigned int get_affiliation_count() const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Clears all elements in hash maps, which takes linear time in the number of elements.
@@ -117,31 +166,39 @@ public:
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Iterates over all elements in a hash map, which takes linear time.
-    std::vector<AffiliationID> get_all_affiliations();
+    std::vector<AffiliationID> get_all_affiliations() const;
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: Inserts an element into a hash map, which is an average constant time operation.
+    // Estimate of performance: O(1) on average
+    // Short rationale for estimate: Inserts an element into a hash map and appends it to the spatial grid and the
+    // insert buffers of the sorted orders, which are merged by the next query reading them. The grid is rebuilt in
+    // O(n) when the affiliations have grown fourfold or spread over many more cells than there are affiliations.
     bool add_affiliation(AffiliationID id, Name const& name, Coord xy);
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses an element in a hash map.
-    Name get_affiliation_name(AffiliationID id);
+    Name get_affiliation_name(AffiliationID id) const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses an element in a hash map.
-    Coord get_affiliation_coord(AffiliationID id);
+    Coord get_affiliation_coord(AffiliationID id) const;
 
-    // Estimate of performance: O(n * log(n))
-    // Short rationale for estimate: Sorts affiliations based on names, which takes O(n log n) time.
+    // Estimate of performance: O(n + k * log(k)), where k is the number of affiliations added since the last call
+    // Short rationale for estimate: Sorts only the buffered additions and merges them into the sorted vector in
+    // linear time, then copies the IDs in order.
     std::vector<AffiliationID> get_affiliations_alphabetically();
+    // Const version for concurrent readers: merges a sorted copy of the buffered additions on the fly instead
+    // of merging them into the order.
+    std::vector<AffiliationID> get_affiliations_alphabetically() const;
 
-    // Estimate of performance: O(n * log(n))
-    // Short rationale for estimate: Sorts affiliations based on distance, which takes O(n log n) time.
+    // Estimate of performance: O(n + k * log(k)), where k is the number of affiliations added or moved since the last call
+    // Short rationale for estimate: Same as above, for the order by distance.
     std::vector<AffiliationID> get_affiliations_distance_increasing();
+    // Const version for concurrent readers, see above.
+    std::vector<AffiliationID> get_affiliations_distance_increasing() const;
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Iterates over all elements in a hash map to find an affiliation with a specific coordinate.
-    AffiliationID find_affiliation_with_coord(Coord xy);
+    // Estimate of performance: O(1) on average
+    // Short rationale for estimate: Scans the single spatial grid cell containing the coordinate.
+    AffiliationID find_affiliation_with_coord(Coord xy) const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses and modifies an element in a hash map, which is a constant time operation.
@@ -151,21 +208,41 @@ public:
     // Short rationale for estimate: Inserts an element into a hash map and updates affiliations, taking O(k) time on average, where k is the number of affiliations.
     bool add_publication(PublicationID id, Name const& name, Year year, const std::vector<AffiliationID> & affiliations);
 
+    // Estimate of performance: O(n + k), where k is the number of records (O(k) on average for small batches)
+    // Short rationale for estimate: Reserves the hash map and handle arrays up front and stores each record in O(1)
+    // on average, then rebuilds the spatial grid once. The records are sorted into the sorted orders with a single
+    // sort and merge by the next query needing them.
+    unsigned int add_affiliations(std::vector<AffiliationRecord> const& records);
+
+    // Estimate of performance: O(a + k * p), where k is the number of records and p the affiliations per publication
+    // Short rationale for estimate: Reserves the publication map, stores the records and then grows the lists of each
+    // of the a affiliations once to their final size before filling them.
+    unsigned int add_publications(std::vector<PublicationRecord> const& records);
+
+    // Estimate of performance: O(k) on average, where k is the number of references
+    // Short rationale for estimate: Links each pair in O(1). The ancestor index and the subtree layout are rebuilt
+    // once on the next query instead of being refreshed after every reference. Small batches are added one by one.
+    unsigned int add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references);
+
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses the size of a hash map, which is a constant time operation.
-    std::vector<PublicationID> all_publications();
+    std::vector<PublicationID> all_publications() const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Returns the size of a hash map, which is an O(1) operation.
+    unsigned int get_publication_count() const;
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: Accesses an element in a hash map, which is a constant time operation.
-    Name get_publication_name(PublicationID id);
+    Name get_publication_name(PublicationID id) const;
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: Accesses an element in a hash map, which is a constant time operation.
-    Year get_publication_year(PublicationID id);
+    Year get_publication_year(PublicationID id) const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses an element in a hash map, which is a constant time operation.
-    std::vector<AffiliationID> get_affiliations(PublicationID id);
+    std::vector<AffiliationID> get_affiliations(PublicationID id) const;
 
     // Estimate of performance: O(n) on average
     // Short rationale for estimate: Accesses and modifies elements in hash maps, which is an average constant time operation.
@@ -173,7 +250,7 @@ public:
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses an element in a hash map, which is a constant time operation.
-    std::vector<PublicationID> get_direct_references(PublicationID id);
+    std::vector<PublicationID> get_direct_references(PublicationID id) const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses and modifies elements in hash maps, which is an average constant time operation.
@@ -181,55 +258,372 @@ public:
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Accesses an element in a hash map, which is an average constant time operation.
-    std::vector<PublicationID> get_publications(AffiliationID id);
+    std::vector<PublicationID> get_publications(AffiliationID id) const;
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: Accesses an element in a hash map, which is a constant time operation.
-    PublicationID get_parent(PublicationID id);
+    PublicationID get_parent(PublicationID id) const;
 
-    // Estimate of performance: O(n * log(n))
-    // Short rationale for estimate: Iterates over elements and sorts them based on year, taking O(m log m) time, where m is the number of publications.
-    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year);
+    // Estimate of performance: O(n + e)
+    // Short rationale for estimate: Packs the references and referrers of all n publications into two contiguous
+    // edge arrays of e edges each, ordered by a depth-first preorder of the reference forest. After the first call
+    // the edges added later are merged in automatically by the traversals.
+    void compact_citation_graph();
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Performs depth-first search over a graph structure, where n is the number of nodes and e is the number of edges.
+    // Estimate of performance: O(log(m) + k), where m is the number of publications of the affiliation and k the size of the result
+    // Short rationale for estimate: Binary search in the affiliation's (year, id) ordered index followed by a copy of its tail.
+    // Out-of-order insertions since the last query are sorted among themselves and merged into the index first.
+    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year);
+    // Const version for concurrent readers: the unmerged insertions are filtered, sorted in a copy and merged into
+    // the result.
+    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year) const;
+
+    // Estimate of performance: O(n + e)
+    // Short rationale for estimate: Iterative depth-first search over the reverse references, where n is the number of
+    // nodes and e the number of edges reached. Visited marks are epoch stamps, so only the result vector is allocated.
+    // The edges are read from the compacted CSR arrays when the citation graph has been compacted.
     std::vector<PublicationID> get_referenced_by_chain(PublicationID id);
+    // Const version for concurrent readers: keeps the visited set and the stack of the search in local variables.
+    std::vector<PublicationID> get_referenced_by_chain(PublicationID id) const;
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Performs depth-first search over a graph structure, where n is the number of nodes and e is the number of edges.
+    // Estimate of performance: O(k), where k is the size of the result (amortized, O(n + e) after mutations)
+    // Short rationale for estimate: The references form one contiguous slice of the preorder layout, which is copied.
+    // After mutations the query falls back to an iterative depth-first search over the n nodes and e edges reached
+    // until that work has paid for rebuilding the layout.
     std::vector<PublicationID> get_all_references(PublicationID id);
-
-    // Not implemented yet
-    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy);
-
-    // Not implemented yet
+    // Const version for concurrent readers: copies the slice of a valid layout, otherwise searches with local state.
+    std::vector<PublicationID> get_all_references(PublicationID id) const;
+
+    // Estimate of performance: O(1) (amortized, O(n + e) after mutations)
+    // Short rationale for estimate: Subtracts the ends of the publication's range in the preorder layout.
+    int count_all_references(PublicationID id);
+    // Const version for concurrent readers, see above.
+    int count_all_references(PublicationID id) const;
+
+    // Estimate of performance: O(1) on average, O(n) worst case
+    // Short rationale for estimate: Searches the spatial grid ring by ring outwards from the cell of xy and stops
+    // as soon as no unvisited cell can contain a closer affiliation, so only a few nearby cells are visited. If the
+    // rings would look up more cells than are occupied, the occupied cells are scanned directly instead.
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy) const;
+
+    // Estimate of performance: O(k * log(k)) on average, O(n * log(k)) worst case
+    // Short rationale for estimate: Same ring search as above, keeping the k best candidates in a bounded heap.
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy, unsigned int k) const;
+
+    // Estimate of performance: O(c + m * log(m)), where c is the smaller of the number of grid cells the circle
+    // overlaps and the number of occupied cells, and m the number of affiliations found
+    // Short rationale for estimate: Scans only the grid cells overlapping the circle, or the occupied cells if
+    // there are fewer of them, and sorts just the matches.
+    std::vector<AffiliationID> get_affiliations_within(Coord xy, Distance radius) const;
+
+    // Estimate of performance: O(c + m * log(m)), where c is the smaller of the number of grid cells the
+    // rectangle overlaps and the number of occupied cells, and m the number of affiliations found
+    // Short rationale for estimate: Same cell scan as above, then sorts just the matches.
+    std::vector<AffiliationID> get_affiliations_in_rect(Coord min, Coord max) const;
+
+    // Estimate of performance: O(m * k + n), where m is the number of publications of the affiliation
+    // and k the number of affiliations per publication
+    // Short rationale for estimate: Visits only the affiliation's own publications and erases it from the hash maps,
+    // the spatial grid and the two sorted vectors. The vectors are binary searched, and the erase shifts the
+    // handles after it, which is a fast memmove of 4-byte elements.
     bool remove_affiliation(AffiliationID id);
 
-    // Not implemented yet
+    // Estimate of performance: O(log(d)), where d is the depth of the publications in the reference tree
+    // Short rationale for estimate: Lifts both parents to the same depth and then upwards together using the
+    // binary lifting jump tables. Re-attaching or detaching a subtree refreshes the tables below it, except for
+    // very large subtrees and cycles, after which the tables are rebuilt once on the next query in O(n * log(d)).
     PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2);
-
-    // Not implemented yet
+    // Const version for concurrent readers: without a valid ancestor index the parents climb one step at a time.
+    PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2) const;
+
+    // Estimate of performance: O((n + q) * α(n)), where q is the number of pairs
+    // Short rationale for estimate: Tarjan's offline algorithm answers every pair during a single depth-first pass
+    // over the reference forest, using union-find with path compression.
+    std::vector<PublicationID> get_closest_common_parents(std::vector<std::pair<PublicationID, PublicationID>> const& pairs) const;
+
+    // Estimate of performance: O(d + Σ m), where d is the number of publications linked to the removed one
+    // and m the publication counts of its affiliations
+    // Short rationale for estimate: Only the neighbours found through references, reverse_references and the
+    // affiliations are updated instead of scanning every publication.
     bool remove_publication(PublicationID publicationid);
 
+    // Estimate of performance: O(n + e + a * log(a)), where a is the number of affiliations
+    // Short rationale for estimate: Compacts the citation graph if needed and writes every element once into a buffer,
+    // the affiliation orders are brought up to date first.
+    bool save_snapshot(std::string const& filename);
+
+    // Estimate of performance: O(n + e + a)
+    // Short rationale for estimate: Reads the memory-mapped file once. The sorted orders are read back as they are
+    // and the citation graph is read in CSR form, so nothing is sorted or compacted again.
+    bool load_snapshot(std::string const& filename);
+
+    // Estimate of performance: O(1), O(j) when an existing journal of j bytes is continued
+    // Short rationale for estimate: Opens the journal file, after checking the records of an existing journal so
+    // that a record torn by a crash can be cut off. From then on every mutation is journaled, see journal.hh.
+    bool start_journal(std::string const& filename, unsigned int sync_every);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Commits the last group of records and closes the file.
+    // Returns false if some records couldn't be written, see journal.hh.
+    bool stop_journal();
+
+    // Estimate of performance: O(r * m), where r is the number of records and m the cost of each mutation
+    // Short rationale for estimate: Applies the records directly through the mutation operations. Returns the
+    // number of records replayed, or NO_VALUE if the file isn't a journal or journaling is on.
+    int replay_journal(std::string const& filename);
+
+    // Estimate of performance: O(1) when nothing has changed, at most the cost of the lazy rebuilds otherwise
+    // Short rationale for estimate: Merges the buffered orders, sorts the year indexes appended out of order and
+    // rebuilds the ancestor index, the compacted citation graph and the subtree layout when they are due, so that the
+    // const queries take their fast paths. The const queries are safe to call from many threads at once as long as
+    // nothing else runs at the same time, see shareddatastructures.hh.
+    void prepare_for_reads();
+
+    // Estimate of performance: amortized O(1) per mutation since the previous call, plus the lazy rebuilds that are
+    // due
+    // Short rationale for estimate: Like prepare_for_reads, but the buffered orders and the unsorted tails of the
+    // year indexes are only merged once they are 1/BULK_REBUILD_FRACTION of what they are merged into. Until then
+    // the const queries merge sorted copies of them. For front-ends that copy the structure after every few
+    // mutations, see versioneddatastructures.hh.
+    void prepare_for_copies();
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Takes the larger of two counters.
+    // Counts the work the const traversal queries have done on a copy of this structure without the subtree layout
+    // towards rebuilding the layout of this one, for front-ends whose readers only query copies.
+    void take_traversal_work(Datastructures const& copy);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Checks the same flags and counters as prepare_for_reads
+    bool prepared_for_reads() const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: The key of get_affiliations_distance_increasing, shared with the front-ends
+    // that merge orders
+    static Distance calculate_distance_from_origin(Coord coord);
+
 private:
-    std::unordered_map<PublicationID, PublicationInfo> publications;
-    std::unordered_map<AffiliationID, std::vector<PublicationID>> affiliations_publications;
-    std::unordered_map<AffiliationID, std::tuple<Name, Coord>> affiliations;
-    std::unordered_map<PublicationID, std::vector<PublicationID>> reverse_references;
-    std::unordered_map<Coord, std::vector<AffiliationID>, CoordHash> coord_to_affiliation;
-    // Additional members for optimization
-    std::set<std::pair<Name, AffiliationID>> sorted_affiliations_by_name;
-    std::set<std::pair<Distance, AffiliationID>> sorted_affiliations_by_distance;
+    // PublicationID keyed data is stored by ID in a vector while the IDs are dense and hashed otherwise, see flatmap.hh
+    HybridIdMap<PublicationInfo> publications;
+    HybridIdMap<PublicationList> reverse_references;
+
+    // Per-affiliation (year, id) ordered publication index. Out-of-order appends collect after the sorted prefix
+    // and are sorted and merged into it lazily.
+    struct YearIndex
+    {
+        bool sorted() const { return sorted_size == entries.size(); }
+
+        std::vector<std::pair<Year, PublicationID>> entries;
+        std::size_t sorted_size = 0; // Length of the sorted prefix of the entries
+    };
+
+    // Node-based indexes of the affiliations: the handles by ID, and the spatial index, where the affiliations are
+    // bucketed into square cells of side grid_cell_size, keyed by cell coordinate. Copies of the structure share
+    // one bundle until either of them changes it, see writable_affiliation_indexes.
+    struct AffiliationIndexes
+    {
+        std::unordered_map<AffiliationID, AffiliationHandle> handles;
+        std::unordered_map<Coord, std::vector<std::pair<Coord, AffiliationHandle>>, CoordHash> grid;
+    };
+    std::shared_ptr<AffiliationIndexes const> affiliation_indexes = std::make_shared<AffiliationIndexes>();
+
+    // Affiliations are stored as parallel arrays indexed by their handles. Handles of removed affiliations
+    // (marked with NO_AFFILIATION) are reused by later additions. The arrays are chunked, so that copies of the
+    // structure share the chunks neither of them has written to, see chunkedvector.hh.
+    ChunkedVector<AffiliationID> affiliation_ids;
+    ChunkedVector<Name> affiliation_names;
+    ChunkedVector<int> affiliation_xs;
+    ChunkedVector<int> affiliation_ys;
+    ChunkedVector<AffiliationPublicationList> affiliation_publications;
+    ChunkedVector<YearIndex> affiliation_years;
+    std::vector<AffiliationHandle> unsorted_year_indexes; // Handles whose year index has unmerged appends
+    std::vector<AffiliationHandle> free_affiliation_handles;
+
+    // Orders of affiliation handles by (name, id) and by (distance from origin, id)
+    struct AffiliationsByName
+    {
+        Datastructures const* ds;
+        bool operator()(AffiliationHandle a, AffiliationHandle b) const;
+    };
+    struct AffiliationsByDistance
+    {
+        Datastructures const* ds;
+        bool operator()(AffiliationHandle a, AffiliationHandle b) const;
+    };
+
+    // Additional members for optimization: the two orders are sorted (chunked) vectors of handles. New handles go to an
+    // unsorted buffer first, which the next read of the order sorts and merges in. The flags are false while the
+    // buffer of the order isn't empty.
+    ChunkedVector<AffiliationHandle> sorted_affiliations_by_name;
+    ChunkedVector<AffiliationHandle> sorted_affiliations_by_distance;
+    std::vector<AffiliationHandle> unmerged_affiliations_by_name;
+    std::vector<AffiliationHandle> unmerged_affiliations_by_distance;
     bool affiliations_sorted_by_name = true;
     bool affiliations_sorted_by_distance = true;
+    // Batches below 1/BULK_REBUILD_FRACTION of the existing elements update the indexes per element instead
+    static std::size_t const BULK_REBUILD_FRACTION = 8;
+    bool ancestor_index_valid = true;
+    static std::size_t const ANCESTOR_REFRESH_FRACTION = 8;
+    static std::size_t const ANCESTOR_REFRESH_MIN = 64;
+
+    // Citation graph in compressed sparse row form: the references and referrers of each publication are slices
+    // of these arrays. Edges added later go to the delta lists (PublicationInfo::references and reverse_references).
+    // Once the graph has been compacted, the delta is merged in automatically when it has grown large enough.
+    ChunkedSlices<PublicationID> csr_references;
+    ChunkedSlices<PublicationID> csr_referrers;
+    // Slices at positions begin of the edge arrays by publication. They are kept apart from PublicationInfo, so
+    // that finding the next publication of a traversal doesn't wait for the info of the current one to load.
+    struct CsrSlices
+    {
+        unsigned int references_begin = 0;
+        unsigned int references_count = 0;
+        unsigned int referrers_begin = 0;
+        unsigned int referrers_count = 0;
+    };
+    HybridIdMap<CsrSlices> csr_slices;
+    bool csr_compacted = false;
+    std::size_t csr_delta_edges = 0;
+    static std::size_t const CSR_DELTA_FRACTION = 4;
+    static std::size_t const CSR_MIN_DELTA = 1024;
+
+    // Adjacent publications as [first, last) pointer ranges: the CSR slice first, then the delta
+    using PublicationRange = std::pair<PublicationID const*, PublicationID const*>;
+    using Adjacency = std::array<PublicationRange, 2>;
+
+    // Reusable state of the iterative depth-first traversals
+    std::vector<PublicationRange> traversal_stack;
+    unsigned int traversal_epoch = 0;
+
+    // Preorder layout of the reference forest, rebuilt lazily once queries have done as much traversal work
+    // as a rebuild costs. The ranges [begin, end) of the publications and everything they reference in the
+    // layout are kept apart from PublicationInfo, so that a rebuild doesn't write to the publications. A new
+    // reference only drops the ranges of the publications that reach it, the others stay in use (stale).
+    struct SubtreeRange
+    {
+        static unsigned int const NOT_IN_LAYOUT = std::numeric_limits<unsigned int>::max();
+        unsigned int begin = NOT_IN_LAYOUT;
+        unsigned int end = NOT_IN_LAYOUT;
+    };
+    ChunkedVector<PublicationID> subtree_order;
+    HybridIdMap<SubtreeRange> subtree_ranges;
+    bool subtree_layout_valid = false;
+    bool subtree_layout_stale = false; // Some ranges have been dropped since the rebuild
+    // Counted by the const queries too, so it is the one member they update
+    mutable std::atomic<std::size_t> subtree_fallback_work{0};
+
+    // Parameters of the spatial index in affiliation_indexes
+    int grid_cell_size = INITIAL_GRID_CELL_SIZE;
+    std::size_t grid_sized_for = 0; // Affiliation count the cell size was last chosen for
+    Coord grid_min_cell = NO_COORD; // Bounding box of the cells that may contain affiliations
+    Coord grid_max_cell = NO_COORD;
+    static int const INITIAL_GRID_CELL_SIZE = 1024;
+    static constexpr std::size_t GRID_MIN_REBUILD_SIZE = 64;
+    // The grid is also rebuilt once its bounding box spans this many cells per affiliation
+    static constexpr std::size_t GRID_MAX_CELLS_PER_AFFILIATION = 8;
+
+    // Write-ahead journal of the mutations, null when journaling is off
+    std::unique_ptr<MutationJournal> journal;
 
     // Utility functions
+    AffiliationHandle append_affiliation(AffiliationID const& id, Name const& name, Coord xy);
     void update_sorted_affiliations_by_name();
     void update_sorted_affiliations_by_distance();
-    Distance calculate_distance_from_origin(Coord coord);
-    // Utility function to get ancestors of a publication
-
-    std::vector<PublicationID> get_ancestors(PublicationID id);
+    template <typename Compare>
+    static void merge_unmerged_affiliations(ChunkedVector<AffiliationHandle>& sorted, std::vector<AffiliationHandle>& unmerged,
+                                            Compare compare);
+    template <typename Compare>
+    static void erase_from_sorted_affiliations(ChunkedVector<AffiliationHandle>& sorted, std::vector<AffiliationHandle>& unmerged,
+                                               AffiliationHandle handle, Compare compare);
+    void year_index_insert(AffiliationHandle affiliation, Year year, PublicationID publicationid);
+    void year_index_erase(AffiliationHandle affiliation, Year year, PublicationID publicationid);
+    static void sort_year_index(YearIndex& index);
+
+    // Utility functions for affiliation handles. The indexes shared with copies are only changed through
+    // writable_affiliation_indexes, which gives this structure a bundle of its own first.
+    AffiliationIndexes& writable_affiliation_indexes();
+    AffiliationHandle handle_of(AffiliationID const& id) const;
+    Coord affiliation_coord(AffiliationHandle affiliation) const;
+    std::vector<AffiliationID> ids_of(AffiliationList const& handles) const;
+    template <typename Compare>
+    std::vector<AffiliationID> ids_in_order(ChunkedVector<AffiliationHandle> const& sorted, std::vector<AffiliationHandle> const& unmerged,
+                                            Compare compare) const;
+
+    // Utility functions for the spatial grid
+    Coord grid_cell_of(Coord xy) const;
+    void grid_insert(AffiliationHandle affiliation, Coord xy);
+    void grid_erase(AffiliationHandle affiliation, Coord xy);
+    void rebuild_affiliation_grid();
+    void rebuild_affiliation_grid_if_due();
+    double grid_cells_between(Coord min_cell, Coord max_cell) const;
+    std::vector<std::pair<Coord, AffiliationHandle> const*> grid_entries_in_rect(Coord min, Coord max) const;
+
+    // Utility function for load_snapshot: reads the file while the journal is detached
+    bool read_snapshot(std::string const& filename);
+
+    // Utility functions for the binary lifting ancestor index
+    void compute_ancestor_jumps(PublicationInfo& info, PublicationID parent);
+    void refresh_ancestor_subtree(PublicationID id);
+    void rebuild_ancestor_index();
+    PublicationID lift(PublicationID id, unsigned int steps) const;
+
+    // Utility functions for the compacted citation graph
+    Adjacency references_of(PublicationID id, PublicationInfo const& info) const;
+    Adjacency referrers_of(PublicationID id) const;
+    static void erase_from_slice(ChunkedSlices<PublicationID>& edges, unsigned int begin, unsigned int& count, PublicationID target);
+    void compact_citation_graph_if_needed();
+
+    // Visited sets of the reference traversals. EpochVisits stamps the publications with a new traversal epoch and
+    // reuses the member stack, so it needs the structure to itself. LocalVisits keeps both in local variables, so
+    // that any number of const queries can search at the same time.
+    class EpochVisits
+    {
+    public:
+        explicit EpochVisits(Datastructures& ds);
+        bool insert(PublicationID id, PublicationInfo const& info)
+        {
+            if (info.visit_mark == epoch_) {
+                return false;
+            }
+            // Stamped through the non-const map, which first clones the chunk of the info if a copy shares it
+            publications_.find(id)->second.visit_mark = epoch_;
+            return true;
+        }
+        std::vector<PublicationRange>& stack() { return stack_; }
+
+    private:
+        HybridIdMap<PublicationInfo>& publications_;
+        std::vector<PublicationRange>& stack_;
+        unsigned int epoch_ = 0;
+    };
+
+    class LocalVisits
+    {
+    public:
+        bool insert(PublicationID id, PublicationInfo const&) { return visited_.insert(id).second; }
+        std::vector<PublicationRange>& stack() { return stack_; }
+
+    private:
+        std::vector<PublicationRange> stack_;
+        std::unordered_set<PublicationID> visited_;
+    };
+
+    // Utility functions for the reference traversals
+    void start_traversal();
+    template <typename Neighbours, typename Visits>
+    void collect_reachable(PublicationID start, PublicationInfo const& start_info, Neighbours neighbours, Visits& visits,
+                           std::vector<PublicationID>& result) const;
+    template <typename Visits>
+    std::vector<PublicationID> referenced_by_chain(PublicationID id, Visits&& visits) const;
+    template <typename Visits>
+    std::vector<PublicationID> all_references(PublicationID id, Visits&& visits) const;
+    template <typename Visits>
+    int count_references(PublicationID id, Visits&& visits) const;
+    void invalidate_subtree_layout();
+    void invalidate_subtree_ranges_from(PublicationID id);
+    bool subtree_layout_due() const;
+    void rebuild_subtree_layout();
+    void rebuild_subtree_layout_if_due();
+    SubtreeRange const* subtree_range(PublicationID id) const;
 };
 
 #endif // DATASTRUCTURES_HH
@@ -0,0 +1,375 @@
+// Flatmap.hh
+//
+// Student name: Taisto Tammilehto
+//
+// FlatHashMap is an open-addressing hash map with Robin Hood probing. The entries themselves are kept densely
+// packed in one vector, and the probed table only holds 8-byte buckets (probe distance, a hash fingerprint and
+// the index of the entry). A lookup therefore scans a few neighbouring buckets and touches a single entry,
+// instead of chasing the node pointers of std::unordered_map, and growing the table never moves the entries.
+//
+// Unlike std::unordered_map, inserting may move every entry and erasing moves the last entry into the erased
+// one's place, so references and iterators are only valid until the next insertion or erase.
+//
+// HybridIdMap stores the values of integer IDs that are (nearly) contiguous from zero directly in a vector
+// indexed by the ID and only hashes the IDs that fall outside that dense range. The same invalidation rules apply.
+//
+// Both keep their storage in ChunkedVectors, so copies of a map share it until written, see chunkedvector.hh.
+// Lookups through the const interface never copy anything.
+
+#ifndef FLATMAP_HH
+#define FLATMAP_HH
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+
+#include "chunkedvector.hh"
+
+// Fibonacci hashing: multiplying by 2^64 / golden ratio spreads consecutive and strided IDs over the high bits,
+// which the table uses as the bucket index
+struct FibonacciHash
+{
+    std::uint64_t operator()(unsigned long long key) const
+    {
+        return key * 11400714819323198485ull;
+    }
+};
+
+template <typename Key, typename Value, typename Hash = FibonacciHash>
+class FlatHashMap
+{
+public:
+    using value_type = std::pair<Key, Value>;
+    using iterator = typename ChunkedVector<value_type>::iterator;
+    using const_iterator = typename ChunkedVector<value_type>::const_iterator;
+
+    // Iteration goes through the packed entries, in no particular order
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+
+    std::size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    void clear()
+    {
+        entries_.clear();
+        buckets_.clear();
+        shift_ = 64;
+    }
+
+    // Makes room for n entries without rehashing
+    void reserve(std::size_t n)
+    {
+        entries_.reserve(n);
+        std::size_t capacity = MIN_CAPACITY;
+        while (capacity * MAX_LOAD_NUMERATOR < n * MAX_LOAD_DENOMINATOR) { capacity *= 2; }
+        if (capacity > buckets_.size()) { rehash(capacity); }
+    }
+
+    iterator find(Key const& key)
+    {
+        std::size_t bucket = find_bucket(key);
+        return bucket == NOT_FOUND ? entries_.end() : entries_.begin() + std::as_const(buckets_)[bucket].entry;
+    }
+
+    const_iterator find(Key const& key) const
+    {
+        std::size_t bucket = find_bucket(key);
+        return bucket == NOT_FOUND ? entries_.end() : entries_.begin() + buckets_[bucket].entry;
+    }
+
+    std::size_t count(Key const& key) const { return find_bucket(key) == NOT_FOUND ? 0 : 1; }
+
+    // Returns the value of the key, inserting a default-constructed one first if the key is not in the map
+    Value& operator[](Key const& key)
+    {
+        std::size_t bucket = find_bucket(key);
+        if (bucket != NOT_FOUND) {
+            return entries_[std::as_const(buckets_)[bucket].entry].second;
+        }
+
+        if ((entries_.size() + 1) * MAX_LOAD_DENOMINATOR > buckets_.size() * MAX_LOAD_NUMERATOR) {
+            rehash(buckets_.empty() ? MIN_CAPACITY : 2 * buckets_.size());
+        }
+        entries_.emplace_back(key, Value{});
+        insert_bucket(key, static_cast<std::uint32_t>(entries_.size() - 1));
+        return entries_.back().second;
+    }
+
+    void erase(const_iterator position)
+    {
+        std::size_t entry = position - entries_.cbegin();
+        erase_bucket(find_bucket(position->first));
+
+        // Keep the entries packed by moving the last one into the hole
+        if (entry + 1 != entries_.size()) {
+            buckets_[find_bucket(entries_.back().first)].entry = static_cast<std::uint32_t>(entry);
+            entries_[entry] = std::move(entries_.back());
+        }
+        entries_.pop_back();
+    }
+
+    std::size_t erase(Key const& key)
+    {
+        auto it = find(key);
+        if (it == entries_.end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+private:
+    // Probe distance (starting from 1, 0 means an empty bucket) in the high bits and a fingerprint of the hash in
+    // the low byte. Comparing the combined values orders the buckets both for Robin Hood and for early exits.
+    struct Bucket
+    {
+        std::uint32_t distance_and_fingerprint;
+        std::uint32_t entry;
+    };
+    static constexpr std::uint32_t DISTANCE_INCREMENT = 1u << 8;
+    static constexpr std::uint32_t FINGERPRINT_MASK = DISTANCE_INCREMENT - 1;
+
+    static constexpr std::size_t NOT_FOUND = static_cast<std::size_t>(-1);
+    static constexpr std::size_t MIN_CAPACITY = 16;
+    // Grow when more than 7/8 of the buckets would be in use
+    static constexpr std::size_t MAX_LOAD_NUMERATOR = 7;
+    static constexpr std::size_t MAX_LOAD_DENOMINATOR = 8;
+
+    std::size_t next(std::size_t bucket) const { return (bucket + 1) & (buckets_.size() - 1); }
+
+    // Returns the home bucket of the key and its first (distance 1) distance_and_fingerprint
+    std::pair<std::size_t, std::uint32_t> home_of(Key const& key) const
+    {
+        std::uint64_t hash = hash_(key);
+        return {static_cast<std::size_t>(hash >> shift_), DISTANCE_INCREMENT | (hash & FINGERPRINT_MASK)};
+    }
+
+    std::size_t find_bucket(Key const& key) const
+    {
+        if (entries_.empty()) {
+            return NOT_FOUND;
+        }
+        auto [bucket, distance_and_fingerprint] = home_of(key);
+        // An entry is never stored after a bucket that is closer to its home than the entry would be
+        for (;;) {
+            Bucket const& current = buckets_[bucket];
+            if (current.distance_and_fingerprint == distance_and_fingerprint && entries_[current.entry].first == key) {
+                return bucket;
+            }
+            if (current.distance_and_fingerprint < distance_and_fingerprint) {
+                return NOT_FOUND;
+            }
+            distance_and_fingerprint += DISTANCE_INCREMENT;
+            bucket = next(bucket);
+        }
+    }
+
+    // Adds a bucket for an entry whose key is not in the table yet
+    void insert_bucket(Key const& key, std::uint32_t entry)
+    {
+        auto [bucket, distance_and_fingerprint] = home_of(key);
+        while (std::as_const(buckets_)[bucket].distance_and_fingerprint >= distance_and_fingerprint) {
+            distance_and_fingerprint += DISTANCE_INCREMENT;
+            bucket = next(bucket);
+        }
+
+        // Robin Hood: the richer buckets from here on are shifted one step further from their homes
+        Bucket carried{distance_and_fingerprint, entry};
+        while (buckets_[bucket].distance_and_fingerprint != 0) {
+            std::swap(carried, buckets_[bucket]);
+            carried.distance_and_fingerprint += DISTANCE_INCREMENT;
+            bucket = next(bucket);
+        }
+        buckets_[bucket] = carried;
+    }
+
+    // Backward shift deletion: the following buckets move one step closer to home, so no tombstones are needed
+    void erase_bucket(std::size_t bucket)
+    {
+        for (std::size_t following = next(bucket); std::as_const(buckets_)[following].distance_and_fingerprint >= 2 * DISTANCE_INCREMENT;
+             following = next(following)) {
+            buckets_[bucket] = buckets_[following];
+            buckets_[bucket].distance_and_fingerprint -= DISTANCE_INCREMENT;
+            bucket = following;
+        }
+        buckets_[bucket] = Bucket{0, 0};
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        buckets_.assign(capacity, Bucket{0, 0});
+        shift_ = 64;
+        for (std::size_t bits = capacity; bits > 1; bits /= 2) { --shift_; }
+
+        for (std::size_t entry = 0; entry < entries_.size(); ++entry) {
+            insert_bucket(std::as_const(entries_)[entry].first, static_cast<std::uint32_t>(entry));
+        }
+    }
+
+    ChunkedVector<value_type> entries_;
+    ChunkedVector<Bucket> buckets_;
+    unsigned int shift_ = 64;
+    Hash hash_;
+};
+
+template <typename Value>
+class HybridIdMap
+{
+public:
+    using Key = unsigned long long;
+    using value_type = std::pair<Key, Value>;
+
+    // Walks the dense range first (skipping the unused IDs) and then the hashed entries
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using Map = std::conditional_t<Const, HybridIdMap const, HybridIdMap>;
+        using Entry = std::conditional_t<Const, value_type const, value_type>;
+
+        Iterator(Map* map, std::size_t index) : map_(map), index_(index) { skip_unused(); }
+        // Iterators convert to const_iterators
+        operator Iterator<true>() const { return Iterator<true>(map_, index_); }
+
+        Entry& operator*() const
+        {
+            std::size_t dense_size = map_->dense_.size();
+            return index_ < dense_size ? map_->dense_[index_] : *(map_->sparse_.begin() + (index_ - dense_size));
+        }
+        Entry* operator->() const { return &**this; }
+        Iterator& operator++() { ++index_; skip_unused(); return *this; }
+        bool operator==(Iterator const& other) const { return index_ == other.index_; }
+        bool operator!=(Iterator const& other) const { return index_ != other.index_; }
+
+    private:
+        friend class HybridIdMap;
+        void skip_unused()
+        {
+            while (index_ < map_->dense_.size() && std::as_const(map_->dense_)[index_].first != index_) { ++index_; }
+        }
+
+        Map* map_;
+        std::size_t index_;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, dense_.size() + sparse_.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, dense_.size() + sparse_.size()); }
+
+    std::size_t size() const { return dense_count_ + sparse_.size(); }
+    bool empty() const { return size() == 0; }
+
+    void clear()
+    {
+        dense_.clear();
+        dense_count_ = 0;
+        sparse_.clear();
+    }
+
+    // Makes room for n more keys, none of them above max_key: the dense range is extended in one step if the keys
+    // will fit in it, otherwise the hash table is sized for them
+    void reserve(std::size_t n, Key max_key)
+    {
+        std::size_t limit = MIN_DENSE_SIZE + DENSE_SLACK * (size() + n);
+        if (max_key < limit) {
+            if (max_key >= dense_.size()) {
+                grow_dense(max_key + 1);
+            }
+        } else {
+            sparse_.reserve(sparse_.size() + n);
+        }
+    }
+
+    iterator find(Key key) { return iterator(this, find_index(key)); }
+    const_iterator find(Key key) const { return const_iterator(this, find_index(key)); }
+    std::size_t count(Key key) const { return find_index(key) == dense_.size() + sparse_.size() ? 0 : 1; }
+
+    // Returns the value of the key, inserting a default-constructed one first if the key is not in the map
+    Value& operator[](Key key)
+    {
+        if (key >= dense_.size()) {
+            // Extend the dense range if at least every DENSE_SLACK-th slot of it would then be in use
+            std::size_t limit = MIN_DENSE_SIZE + DENSE_SLACK * (size() + 1);
+            if (key >= limit) {
+                return sparse_[key];
+            }
+            grow_dense(std::max<std::size_t>(key + 1, std::min(std::max(2 * dense_.size(), MIN_DENSE_SIZE), limit)));
+        }
+
+        value_type& entry = dense_[key];
+        if (entry.first != key) {
+            entry.first = key;
+            ++dense_count_;
+        }
+        return entry.second;
+    }
+
+    void erase(const_iterator position)
+    {
+        std::size_t dense_size = dense_.size();
+        if (position.index_ < dense_size) {
+            dense_[position.index_] = value_type{UNUSED, Value{}};
+            --dense_count_;
+        } else {
+            sparse_.erase(sparse_.begin() + (position.index_ - dense_size));
+        }
+    }
+
+    std::size_t erase(Key key)
+    {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+private:
+    // Key stored in the unused slots of the dense range, it never equals the index of the slot
+    static constexpr Key UNUSED = static_cast<Key>(-1);
+    static constexpr std::size_t MIN_DENSE_SIZE = 64;
+    static constexpr std::size_t DENSE_SLACK = 2;
+
+    // Returns the iterator index of the key, or the end index if the key is not in the map
+    std::size_t find_index(Key key) const
+    {
+        if (key < dense_.size()) {
+            return dense_[key].first == key ? key : dense_.size() + sparse_.size();
+        }
+        auto it = sparse_.find(key);
+        return dense_.size() + (it - sparse_.begin());
+    }
+
+    // Extends the dense range and moves the hashed entries that now fall inside it
+    void grow_dense(std::size_t new_size)
+    {
+        dense_.resize(new_size, value_type{UNUSED, Value{}});
+        for (auto it = sparse_.begin(); it != sparse_.end();) {
+            if (it->first < new_size) {
+                Key key = it->first;
+                dense_[key].first = key;
+                dense_[key].second = std::move(it->second);
+                ++dense_count_;
+                sparse_.erase(it); // Moves the last hashed entry here
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    ChunkedVector<value_type> dense_;
+    std::size_t dense_count_ = 0;
+    FlatHashMap<Key, Value> sparse_;
+};
+
+#endif // FLATMAP_HH
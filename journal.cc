@@ -0,0 +1,380 @@
+// Journal.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "journal.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+namespace
+{
+
+char const JOURNAL_MAGIC[8] = {'S', 'C', 'H', 'N', 'J', 'R', 'N', 'L'};
+std::uint32_t const JOURNAL_VERSION = 1;
+
+// Makes the written data durable, where the platform offers a way to do that. Returns false if the sync failed.
+bool sync_file(std::FILE* file)
+{
+#ifdef BINARYIO_USE_MMAP
+    return ::fsync(::fileno(file)) == 0;
+#else
+    (void)file;
+    return true;
+#endif
+}
+
+} // namespace
+
+MutationJournal::MutationJournal(std::string const& filename, std::FILE* file, unsigned int sync_every)
+    : filename_(filename), file_(file), sync_every_(sync_every)
+{
+}
+
+MutationJournal::~MutationJournal()
+{
+    commit();
+    std::fclose(file_);
+}
+
+std::unique_ptr<MutationJournal> MutationJournal::open(std::string const& filename, unsigned int sync_every)
+{
+    // An existing journal is continued after its last intact record, anything else in the file is refused
+    std::size_t intact = 0;
+    std::size_t size = 0;
+    {
+        MappedFile existing(filename);
+        size = existing.size();
+        if (size > 0) {
+            intact = for_each_record(existing.data(), size, [](RecordType, unsigned char const*, std::size_t) {});
+            if (intact == 0) {
+                return nullptr;
+            }
+        }
+    }
+    if (intact != 0 && intact < size) {
+        std::error_code error;
+        std::filesystem::resize_file(filename, intact, error);
+        if (error) {
+            return nullptr;
+        }
+    }
+
+    std::FILE* file = std::fopen(filename.c_str(), "ab");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    // The group buffer is the only buffering, so that each group goes out in a single write
+    std::setvbuf(file, nullptr, _IONBF, 0);
+
+    std::unique_ptr<MutationJournal> journal(new MutationJournal(filename, file, sync_every));
+    if (intact == 0) {
+        ByteWriter header;
+        header.bytes.assign(std::begin(JOURNAL_MAGIC), std::end(JOURNAL_MAGIC));
+        header.put<std::uint32_t>(JOURNAL_VERSION);
+        header.put<std::uint32_t>(0);
+        if (std::fwrite(header.bytes.data(), 1, header.bytes.size(), file) != header.bytes.size() || !sync_file(file)) {
+            return nullptr;
+        }
+    }
+    return journal;
+}
+
+void MutationJournal::record_add_affiliation(AffiliationID const& id, Name const& name, Coord xy)
+{
+    std::size_t record = begin_record(RecordType::ADD_AFFILIATION);
+    group_.put_string(id);
+    group_.put_string(name);
+    group_.put<std::int32_t>(xy.x);
+    group_.put<std::int32_t>(xy.y);
+    end_record(record);
+}
+
+void MutationJournal::record_add_publication(PublicationID id, Name const& name, Year year,
+                                             std::vector<AffiliationID> const& affiliations)
+{
+    std::size_t record = begin_record(RecordType::ADD_PUBLICATION);
+    group_.put<PublicationID>(id);
+    group_.put_string(name);
+    group_.put<Year>(year);
+    group_.put<std::uint32_t>(affiliations.size());
+    for (auto const& affiliation : affiliations) {
+        group_.put_string(affiliation);
+    }
+    end_record(record);
+}
+
+void MutationJournal::record_add_reference(PublicationID id, PublicationID parentid)
+{
+    std::size_t record = begin_record(RecordType::ADD_REFERENCE);
+    group_.put<PublicationID>(id);
+    group_.put<PublicationID>(parentid);
+    end_record(record);
+}
+
+void MutationJournal::record_add_affiliation_to_publication(AffiliationID const& affiliationid, PublicationID publicationid)
+{
+    std::size_t record = begin_record(RecordType::ADD_AFFILIATION_TO_PUBLICATION);
+    group_.put_string(affiliationid);
+    group_.put<PublicationID>(publicationid);
+    end_record(record);
+}
+
+void MutationJournal::record_change_affiliation_coord(AffiliationID const& id, Coord newcoord)
+{
+    std::size_t record = begin_record(RecordType::CHANGE_AFFILIATION_COORD);
+    group_.put_string(id);
+    group_.put<std::int32_t>(newcoord.x);
+    group_.put<std::int32_t>(newcoord.y);
+    end_record(record);
+}
+
+void MutationJournal::record_remove_affiliation(AffiliationID const& id)
+{
+    std::size_t record = begin_record(RecordType::REMOVE_AFFILIATION);
+    group_.put_string(id);
+    end_record(record);
+}
+
+void MutationJournal::record_remove_publication(PublicationID publicationid)
+{
+    std::size_t record = begin_record(RecordType::REMOVE_PUBLICATION);
+    group_.put<PublicationID>(publicationid);
+    end_record(record);
+}
+
+void MutationJournal::record_clear_all()
+{
+    end_record(begin_record(RecordType::CLEAR_ALL));
+}
+
+// Starts a record in the group buffer, its size is filled in by end_record
+std::size_t MutationJournal::begin_record(RecordType type)
+{
+    std::size_t record_begin = group_.bytes.size();
+    group_.put<std::uint8_t>(static_cast<std::uint8_t>(type));
+    group_.put<std::uint32_t>(0);
+    return record_begin;
+}
+
+// Fills in the payload size, appends the checksum and commits the group once it is complete
+void MutationJournal::end_record(std::size_t record_begin)
+{
+    std::uint32_t payload_size = group_.bytes.size() - record_begin - 5;
+    for (std::size_t i = 0; i < 4; ++i) {
+        group_.bytes[record_begin + 1 + i] = static_cast<unsigned char>(payload_size >> (8 * i));
+    }
+    group_.put<std::uint32_t>(fnv1a(group_.bytes.data() + record_begin, group_.bytes.size() - record_begin));
+
+    ++group_records_;
+    if (sync_every_ > 0 ? group_records_ >= sync_every_ : group_.bytes.size() >= UNSYNCED_GROUP_BYTES) {
+        write_group(sync_every_ > 0);
+    }
+}
+
+bool MutationJournal::commit()
+{
+    write_group(sync_every_ > 0);
+    return !failed_;
+}
+
+bool MutationJournal::failed() const
+{
+    return failed_;
+}
+
+// The file is unbuffered, so a group that fwrite accepted in full has reached the operating system. After a
+// failure the groups are dropped, see journal.hh.
+void MutationJournal::write_group(bool sync)
+{
+    if (!group_.bytes.empty() && !failed_) {
+        if (std::fwrite(group_.bytes.data(), 1, group_.bytes.size(), file_) != group_.bytes.size()) {
+            fail("write");
+        } else if (sync && !sync_file(file_)) {
+            fail("sync");
+        }
+    }
+    group_.bytes.clear();
+    group_records_ = 0;
+}
+
+void MutationJournal::fail(char const* operation)
+{
+    failed_ = true;
+    std::cerr << "Cannot " << operation << " journal '" << filename_ << "': " << std::strerror(errno)
+              << ", mutations are no longer journaled until the next snapshot" << std::endl;
+}
+
+void MutationJournal::checkpoint()
+{
+    group_.bytes.clear();
+    group_records_ = 0;
+    std::error_code error;
+    std::filesystem::resize_file(filename_, HEADER_SIZE, error);
+    if (error) {
+        errno = error.value();
+        fail("truncate");
+    } else if (!sync_file(file_)) {
+        fail("sync");
+    } else {
+        failed_ = false;
+    }
+}
+
+template <typename Apply>
+std::size_t MutationJournal::for_each_record(unsigned char const* data, std::size_t size, Apply apply)
+{
+    if (size < HEADER_SIZE || std::memcmp(data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        return 0;
+    }
+    ByteReader header(data + sizeof(JOURNAL_MAGIC), HEADER_SIZE - sizeof(JOURNAL_MAGIC));
+    if (header.get<std::uint32_t>() != JOURNAL_VERSION) {
+        return 0;
+    }
+
+    std::size_t pos = HEADER_SIZE;
+    while (size - pos >= RECORD_OVERHEAD) {
+        ByteReader prefix(data + pos, 5);
+        auto type = static_cast<RecordType>(prefix.get<std::uint8_t>());
+        std::size_t payload_size = prefix.get<std::uint32_t>();
+        if (size - pos - RECORD_OVERHEAD < payload_size) {
+            break;
+        }
+        ByteReader checksum(data + pos + 5 + payload_size, 4);
+        if (checksum.get<std::uint32_t>() != static_cast<std::uint32_t>(fnv1a(data + pos, 5 + payload_size))) {
+            break;
+        }
+        apply(type, data + pos + 5, payload_size);
+        pos += RECORD_OVERHEAD + payload_size;
+    }
+    return pos;
+}
+
+int MutationJournal::replay(std::string const& filename, Datastructures& ds)
+{
+    MappedFile file(filename);
+    int replayed = 0;
+    bool intact = true;
+    auto apply = [&ds, &replayed, &intact](RecordType type, unsigned char const* payload, std::size_t size) {
+        // Records after a malformed one are skipped, as the state they were made in can't be reproduced
+        if (!intact) {
+            return;
+        }
+        ByteReader reader(payload, size);
+        auto get_coord = [&reader]() {
+            int x = reader.get<std::int32_t>();
+            return Coord{x, reader.get<std::int32_t>()};
+        };
+        switch (type) {
+        case RecordType::ADD_AFFILIATION: {
+            AffiliationID id = reader.get_string();
+            Name name = reader.get_string();
+            Coord xy = get_coord();
+            if (reader.at_end() && !reader.failed) {
+                ds.add_affiliation(id, name, xy);
+            }
+            break;
+        }
+        case RecordType::ADD_PUBLICATION: {
+            PublicationID id = reader.get<PublicationID>();
+            Name name = reader.get_string();
+            Year year = reader.get<Year>();
+            std::vector<AffiliationID> affiliations(reader.get_count(sizeof(std::uint32_t)));
+            for (auto& affiliation : affiliations) {
+                affiliation = reader.get_string();
+            }
+            if (reader.at_end() && !reader.failed) {
+                ds.add_publication(id, name, year, affiliations);
+            }
+            break;
+        }
+        case RecordType::ADD_REFERENCE: {
+            PublicationID id = reader.get<PublicationID>();
+            PublicationID parentid = reader.get<PublicationID>();
+            if (reader.at_end() && !reader.failed) {
+                ds.add_reference(id, parentid);
+            }
+            break;
+        }
+        case RecordType::ADD_AFFILIATION_TO_PUBLICATION: {
+            AffiliationID affiliationid = reader.get_string();
+            PublicationID publicationid = reader.get<PublicationID>();
+            if (reader.at_end() && !reader.failed) {
+                ds.add_affiliation_to_publication(affiliationid, publicationid);
+            }
+            break;
+        }
+        case RecordType::CHANGE_AFFILIATION_COORD: {
+            AffiliationID id = reader.get_string();
+            Coord newcoord = get_coord();
+            if (reader.at_end() && !reader.failed) {
+                ds.change_affiliation_coord(id, newcoord);
+            }
+            break;
+        }
+        case RecordType::REMOVE_AFFILIATION: {
+            AffiliationID id = reader.get_string();
+            if (reader.at_end() && !reader.failed) {
+                ds.remove_affiliation(id);
+            }
+            break;
+        }
+        case RecordType::REMOVE_PUBLICATION: {
+            PublicationID publicationid = reader.get<PublicationID>();
+            if (reader.at_end() && !reader.failed) {
+                ds.remove_publication(publicationid);
+            }
+            break;
+        }
+        case RecordType::CLEAR_ALL:
+            ds.clear_all();
+            break;
+        default:
+            reader.failed = true;
+            break;
+        }
+        if (reader.failed || !reader.at_end()) {
+            intact = false;
+        } else {
+            ++replayed;
+        }
+    };
+
+    if (for_each_record(file.data(), file.size(), apply) == 0) {
+        return NO_VALUE;
+    }
+    return replayed;
+}
+
+// Starts journaling every mutation into the file, returns false (keeping the current journal) if it can't be opened
+bool Datastructures::start_journal(std::string const& filename, unsigned int sync_every)
+{
+    if (journal) {
+        journal->commit();
+    }
+    auto opened = MutationJournal::open(filename, sync_every);
+    if (!opened) {
+        return false;
+    }
+    journal = std::move(opened);
+    return true;
+}
+
+bool Datastructures::stop_journal()
+{
+    bool intact = !journal || journal->commit();
+    journal.reset();
+    return intact;
+}
+
+// Replays the mutations of a journal file. Refused while journaling, as the journal could be the file being read.
+int Datastructures::replay_journal(std::string const& filename)
+{
+    if (journal) {
+        return NO_VALUE;
+    }
+    return MutationJournal::replay(filename, *this);
+}
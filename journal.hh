@@ -0,0 +1,114 @@
+// Journal.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Append-only write-ahead journal of the mutations of a Datastructures instance. Every successful mutation is
+// appended as a binary record, so the state can be recovered after a crash by loading the latest snapshot and
+// replaying the journal on top of it. Saving or loading a snapshot truncates the journal (a checkpoint), so it
+// only ever holds the mutations made after the snapshot.
+//
+// The file is a 16-byte header (magic "SCHNJRNL", version and a reserved word, all little-endian u32s after the
+// magic) followed by records of the form
+//
+//   type (u8) | payload size (u32) | payload | checksum (u32, the low half of FNV-1a 64 over the preceding bytes)
+//
+// Records are committed in groups: they are collected in memory and every sync_every records are written with
+// a single write and made durable with a single fsync. With sync_every == 0 the groups are only written to the
+// operating system, without fsync, whenever the buffer fills up. A crash loses at most the uncommitted group,
+// and a record torn by the crash is recognised by its checksum, so replay stops there and reopening the journal
+// truncates it away.
+//
+// If writing or syncing a group fails (e.g. the disk is full) the failure is reported on standard error and the
+// journal stops taking records, since a replay can't skip the lost group. A checkpoint starts it again, as the
+// snapshot holds everything the journal lost.
+
+#ifndef JOURNAL_HH
+#define JOURNAL_HH
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "datastructures.hh"
+#include "binaryio.hh"
+
+class MutationJournal
+{
+public:
+    // Opens a journal for appending, creating it if needed. Returns nullptr if the file can't be opened or isn't
+    // a journal.
+    static std::unique_ptr<MutationJournal> open(std::string const& filename, unsigned int sync_every);
+
+    // Commits the records of the last, incomplete group
+    ~MutationJournal();
+
+    MutationJournal(MutationJournal const&) = delete;
+    MutationJournal& operator=(MutationJournal const&) = delete;
+
+    // Estimate of performance: O(s), where s is the size of the record
+    // Short rationale for estimate: Appends the record to the group buffer, every sync_every records the group is
+    // written and synced, which costs one system call pair per group instead of per record.
+    void record_add_affiliation(AffiliationID const& id, Name const& name, Coord xy);
+    void record_add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations);
+    void record_add_reference(PublicationID id, PublicationID parentid);
+    void record_add_affiliation_to_publication(AffiliationID const& affiliationid, PublicationID publicationid);
+    void record_change_affiliation_coord(AffiliationID const& id, Coord newcoord);
+    void record_remove_affiliation(AffiliationID const& id);
+    void record_remove_publication(PublicationID publicationid);
+    void record_clear_all();
+
+    // Writes and syncs the current group even if it isn't full yet, returns false if a group has failed
+    bool commit();
+
+    // Discards every record, those in the current group included, as they are all in a snapshot now
+    void checkpoint();
+
+    // Tells whether a group failed to be written since the journal was opened or last checkpointed
+    bool failed() const;
+
+    // Estimate of performance: O(r * m), where r is the number of records and m the cost of the mutation
+    // Short rationale for estimate: Decodes the records straight from the memory-mapped file and calls the
+    // mutations of ds directly, without going through the command parser. Returns the number of records
+    // replayed, or NO_VALUE if the file isn't a journal.
+    static int replay(std::string const& filename, Datastructures& ds);
+
+private:
+    MutationJournal(std::string const& filename, std::FILE* file, unsigned int sync_every);
+
+    // Record types, stored in the journal files, so existing values must not change
+    enum class RecordType : unsigned char
+    {
+        ADD_AFFILIATION = 1,
+        ADD_PUBLICATION = 2,
+        ADD_REFERENCE = 3,
+        ADD_AFFILIATION_TO_PUBLICATION = 4,
+        CHANGE_AFFILIATION_COORD = 5,
+        REMOVE_AFFILIATION = 6,
+        REMOVE_PUBLICATION = 7,
+        CLEAR_ALL = 8
+    };
+
+    // Utility functions for building the records in the group buffer
+    std::size_t begin_record(RecordType type);
+    void end_record(std::size_t record_begin);
+    void write_group(bool sync);
+    void fail(char const* operation);
+
+    // Utility function for open and replay: calls apply(type, payload, size) for each intact record and returns
+    // the length of the intact prefix of the file, or 0 if the file has no valid header
+    template <typename Apply>
+    static std::size_t for_each_record(unsigned char const* data, std::size_t size, Apply apply);
+
+    std::string filename_;
+    std::FILE* file_;
+    unsigned int sync_every_;
+    ByteWriter group_;
+    unsigned int group_records_ = 0;
+    bool failed_ = false;
+
+    static std::size_t const HEADER_SIZE = 16;
+    static std::size_t const RECORD_OVERHEAD = 9;
+    static std::size_t const UNSYNCED_GROUP_BYTES = 64 * 1024;
+};
+
+#endif // JOURNAL_HH
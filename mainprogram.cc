@@ -30,6 +30,7 @@ using std::ostream;
 
 #include <fstream>
 using std::ifstream;
+using std::ofstream;
 
 #include <sstream>
 using std::istringstream;
@@ -103,6 +104,9 @@ using std::abs;
 #include <cstdlib>
 using std::div;
 
+#include <cstdio>
+using std::remove;
+
 #include <algorithm>
 using std::transform;
 
@@ -112,10 +116,19 @@ using std::back_inserter;
 #include <cstddef>
 #include <cassert>
 
+#include <atomic>
+#include <thread>
+
 
 #include "mainprogram.hh"
 
 #include "datastructures.hh"
+#include "bulkimport.hh"
+#include "shareddatastructures.hh"
+#include "versioneddatastructures.hh"
+#include "shardeddatastructures.hh"
+#include "queryserver.hh"
+#include "binaryprotocol.hh"
 
 #ifdef GRAPHICAL_GUI
 #include "mainwindow.hh"
@@ -306,6 +319,66 @@ MainProgram::CmdResult MainProgram::cmd_get_affiliations_closest_to(std::ostream
     return {ResultType::IDLIST, CmdResultIDs{{}, affiliations}};
 }
 
+MainProgram::CmdResult MainProgram::cmd_get_affiliations_k_closest_to(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    string kstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+    unsigned int k = convert_string_to<unsigned int>(kstr);
+
+    auto affiliations = ds_.get_affiliations_closest_to({x,y}, k);
+    if (affiliations.empty())
+    {
+        output << "No affiliations!" << endl;
+    }
+
+    return {ResultType::IDLIST, CmdResultIDs{{}, affiliations}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_get_affiliations_within(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    string radiusstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+    Distance radius = convert_string_to<Distance>(radiusstr);
+
+    auto affiliations = ds_.get_affiliations_within({x,y}, radius);
+    if (affiliations.empty())
+    {
+        output << "No affiliations within distance " << radius << "!" << endl;
+    }
+
+    return {ResultType::IDLIST, CmdResultIDs{{}, affiliations}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_get_affiliations_in_rect(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    string minxstr = *begin++;
+    string minystr = *begin++;
+    string maxxstr = *begin++;
+    string maxystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    Coord min = {convert_string_to<int>(minxstr), convert_string_to<int>(minystr)};
+    Coord max = {convert_string_to<int>(maxxstr), convert_string_to<int>(maxystr)};
+
+    auto affiliations = ds_.get_affiliations_in_rect(min, max);
+    if (affiliations.empty())
+    {
+        output << "No affiliations in the rectangle!" << endl;
+    }
+
+    return {ResultType::IDLIST, CmdResultIDs{{}, affiliations}};
+}
+
 MainProgram::CmdResult MainProgram::cmd_get_closest_common_parent(std::ostream &output, MatchIter begin, MatchIter end)
 {
     PublicationID publicationid1 = convert_string_to<PublicationID>(*begin++);
@@ -322,6 +395,62 @@ MainProgram::CmdResult MainProgram::cmd_get_closest_common_parent(std::ostream &
     return {ResultType::IDLIST, CmdResultIDs{{publicationid1, publicationid2, publicationid}, {}}};
 }
 
+MainProgram::CmdResult MainProgram::cmd_closest_common_parents_batch(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    string infilename = *begin++;
+    string outfilename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    // The input file contains whitespace separated pairs of publication IDs, read without regex parsing
+    ifstream input(infilename);
+    if (!input)
+    {
+        output << "Cannot open file '" << infilename << "'!" << endl;
+        return {};
+    }
+
+    vector<pair<PublicationID, PublicationID>> pairs;
+    PublicationID id1 = NO_PUBLICATION;
+    PublicationID id2 = NO_PUBLICATION;
+    while (input >> id1 >> id2)
+    {
+        pairs.emplace_back(id1, id2);
+    }
+    if (!input.eof())
+    {
+        output << "Invalid publication ID pair after " << pairs.size() << " pairs in '" << infilename << "'!" << endl;
+        return {};
+    }
+
+    auto parents = ds_.get_closest_common_parents(pairs);
+
+    ofstream resultfile;
+    ostream* results = &output;
+    if (!outfilename.empty())
+    {
+        resultfile.open(outfilename);
+        if (!resultfile)
+        {
+            output << "Cannot open file '" << outfilename << "'!" << endl;
+            return {};
+        }
+        results = &resultfile;
+    }
+
+    for (std::size_t i = 0; i < pairs.size(); ++i)
+    {
+        *results << pairs[i].first << " " << pairs[i].second << " ";
+        if (parents[i] == NO_PUBLICATION) { *results << "--NO_PUBLICATION--"; }
+        else { *results << parents[i]; }
+        *results << '\n';
+    }
+    output << "Answered " << pairs.size() << " publication pairs";
+    if (!outfilename.empty()) { output << " into '" << outfilename << "'"; }
+    output << "." << endl;
+
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_remove_publication(std::ostream &output, MatchIter begin, MatchIter end)
 {
     PublicationID pubid = convert_string_to<PublicationID>(*begin++);
@@ -402,6 +531,15 @@ void MainProgram::test_get_all_references()
     }
 }
 
+void MainProgram::test_count_all_references()
+{
+    if (random_publications_added_ > 0) // Don't do anything if there's no publications
+    {
+        auto id = random_root_publication();
+        ds_.count_all_references(id);
+    }
+}
+
 MainProgram::CmdResult MainProgram::cmd_remove_affiliation(ostream& output, MatchIter begin, MatchIter end)
 {
     string id = *begin++;
@@ -426,22 +564,34 @@ void MainProgram::test_remove_affiliation()
     // Choose random number to remove
     if (random_affiliations_added_ > 0) // Don't remove if there's nothing to remove
     {
-        auto affiliationid = random_affiliation(); // there is a risk of getting the same id to remove multiple times -> usually takes less time than with existing affiliation
-        ds_.remove_affiliation(affiliationid);
+        auto affiliationid = random_existing_affiliation(); // Removing an already removed id would take less time than an existing one
+        if (affiliationid != NO_AFFILIATION)
+        {
+            ds_.remove_affiliation(affiliationid);
+        }
     }
 }
 
 void MainProgram::add_random_affiliations_publications(unsigned int size, Coord min, Coord max)
 {
+    // The data is generated first in the same random order as adding it one by one would use, and then added
+    // through the bulk operations
+    vector<AffiliationRecord> new_affiliations;
+    new_affiliations.reserve(size);
     for (unsigned int i = 0; i < size; ++i)
     {
         auto name = n_to_name(random_affiliations_added_);
         AffiliationID id = n_to_affiliationid(random_affiliations_added_);
 
-        ds_.add_affiliation(id, name, get_random_coords(min, max));
+        new_affiliations.push_back({id, name, get_random_coords(min, max)});
 
         ++random_affiliations_added_;
     }
+
+    vector<PublicationRecord> new_publications;
+    new_publications.reserve(size);
+    vector<std::pair<PublicationID, PublicationID>> new_references;
+    new_references.reserve(size);
     for (unsigned int i = 0; i< size; ++i) {
         auto publicationid = n_to_publicationid(random_publications_added_);
 
@@ -450,16 +600,27 @@ void MainProgram::add_random_affiliations_publications(unsigned int size, Coord
         {
             affiliations.push_back(random_affiliation());
         }
-        ds_.add_publication(publicationid, convert_to_string(publicationid), get_random_year(), std::move(affiliations));
+        new_publications.push_back({publicationid, convert_to_string(publicationid), get_random_year(), std::move(affiliations)});
 
-        // Add area as subarea so that we get a binary tree
+        // Add area as subarea so that we get a binary tree, or a deep and unbalanced one
+        // where each publication references one of the latest publications
         if (random_publications_added_ > 0)
         {
-            auto parentid = n_to_publicationid(random_publications_added_ / 2);
-            ds_.add_reference(publicationid, parentid);
+            auto parentn = random_publications_added_ / 2;
+            if (tree_shape_ == TreeShape::DEEP)
+            {
+                auto window = std::min<unsigned long int>(random_publications_added_, DEEP_TREE_PARENT_WINDOW);
+                parentn = random<unsigned long int>(random_publications_added_ - window, random_publications_added_);
+            }
+            auto parentid = n_to_publicationid(parentn);
+            new_references.emplace_back(publicationid, parentid);
         }
         ++random_publications_added_;
     }
+
+    ds_.add_affiliations(new_affiliations);
+    ds_.add_publications(new_publications);
+    ds_.add_references(new_references);
 }
 
 MainProgram::CmdResult MainProgram::cmd_random_affiliations(ostream& output, MatchIter begin, MatchIter end)
@@ -510,6 +671,30 @@ MainProgram::CmdResult MainProgram::cmd_random_affiliations(ostream& output, Mat
     return {};
 }
 
+MainProgram::CmdResult MainProgram::cmd_random_tree_shape(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string balanced = *begin++;
+    string deep = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    if (!balanced.empty())
+    {
+        tree_shape_ = TreeShape::BALANCED;
+        output << "Random publications form a balanced binary tree" << endl;
+    }
+    else if (!deep.empty())
+    {
+        tree_shape_ = TreeShape::DEEP;
+        output << "Random publications form a deep, unbalanced tree" << endl;
+    }
+    else
+    {
+        assert(!"Impossible tree shape!");
+    }
+
+    return {};
+}
+
 void MainProgram::test_random_affiliations()
 {
     add_random_affiliations_publications(1);
@@ -523,6 +708,45 @@ void MainProgram::test_remove_publication()
     }
 }
 
+MainProgram::CmdResult MainProgram::cmd_remove_random_publications(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string countstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    unsigned int count = convert_string_to<unsigned int>(countstr);
+
+    unsigned int removed = 0;
+    for (unsigned int attempt = 0; removed < count && attempt < count * RANDOM_EXISTING_ATTEMPTS; ++attempt)
+    {
+        auto publicationid = random_existing_publication();
+        if (publicationid != NO_PUBLICATION && ds_.remove_publication(publicationid))
+        {
+            ++removed;
+        }
+    }
+
+    output << "Removed: " << removed << " publications." << endl;
+
+    view_dirty = true;
+
+    return {};
+}
+
+void MainProgram::test_remove_publication_with_queries()
+{
+    if (random_publications_added_ > 0){
+        // Remove a publication that still exists and then query the reference structure around the removal
+        auto publicationid = random_existing_publication();
+        if (publicationid != NO_PUBLICATION)
+        {
+            ds_.remove_publication(publicationid);
+        }
+        ds_.get_all_references(random_root_publication());
+        ds_.get_referenced_by_chain(random_leaf_publication());
+        ds_.get_closest_common_parent(random_leaf_publication(), random_leaf_publication());
+    }
+}
+
 void MainProgram::test_get_parent()
 {
     if (random_publications_added_ > 0){
@@ -565,6 +789,11 @@ void MainProgram::test_get_all_publications()
     ds_.all_publications();
 }
 
+void MainProgram::test_compact_citation_graph()
+{
+    ds_.compact_citation_graph();
+}
+
 void MainProgram::test_add_affiliation_to_publication()
 {
     if (random_publications_added_ > 0 || random_affiliations_added_ > 0) {
@@ -671,6 +900,21 @@ MainProgram::CmdResult MainProgram::cmd_get_all_references(std::ostream &output,
     return {ResultType::IDLIST, CmdResultIDs{references, {}}};
 }
 
+MainProgram::CmdResult MainProgram::cmd_count_all_references(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    PublicationID publicationid = convert_string_to<PublicationID>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto count = ds_.count_all_references(publicationid);
+    if (count == NO_VALUE)
+    {
+        return {ResultType::IDLIST, CmdResultIDs{{NO_PUBLICATION}, {}}};
+    }
+
+    output << "Number of (direct and indirect) references: " << count << endl;
+    return {ResultType::IDLIST, CmdResultIDs{{publicationid}, {}}};
+}
+
 Distance MainProgram::calc_distance(Coord c1, Coord c2)
 {
     if (c1 == NO_COORD || c2 == NO_COORD) { return NO_DISTANCE; }
@@ -872,6 +1116,32 @@ PublicationID MainProgram::random_leaf_publication()
     return n_to_publicationid(random<decltype(random_publications_added_)>(start, random_publications_added_));
 }
 
+PublicationID MainProgram::random_existing_publication()
+{
+    for (unsigned int attempt = 0; attempt < RANDOM_EXISTING_ATTEMPTS; ++attempt)
+    {
+        auto publicationid = random_publication();
+        if (ds_.get_publication_year(publicationid) != NO_YEAR)
+        {
+            return publicationid;
+        }
+    }
+    return NO_PUBLICATION;
+}
+
+AffiliationID MainProgram::random_existing_affiliation()
+{
+    for (unsigned int attempt = 0; attempt < RANDOM_EXISTING_ATTEMPTS; ++attempt)
+    {
+        auto affiliationid = random_affiliation();
+        if (ds_.get_affiliation_name(affiliationid) != NO_NAME)
+        {
+            return affiliationid;
+        }
+    }
+    return NO_AFFILIATION;
+}
+
 void MainProgram::test_find_affiliation_with_coord()
 {
     ds_.find_affiliation_with_coord(get_random_coords());
@@ -892,6 +1162,23 @@ void MainProgram::test_affiliations_closest_to()
     ds_.get_affiliations_closest_to(get_random_coords());
 }
 
+void MainProgram::test_affiliations_k_closest_to()
+{
+    ds_.get_affiliations_closest_to(get_random_coords(), random<unsigned int>(1, MAX_PERFTEST_K+1));
+}
+
+void MainProgram::test_affiliations_within()
+{
+    ds_.get_affiliations_within(get_random_coords(), random<Distance>(0, MAX_PERFTEST_RADIUS+1));
+}
+
+void MainProgram::test_affiliations_in_rect()
+{
+    auto corner = get_random_coords();
+    auto extent = random<Distance>(1, 2*MAX_PERFTEST_RADIUS+1);
+    ds_.get_affiliations_in_rect(corner, {corner.x+extent, corner.y+extent});
+}
+
 void MainProgram::test_get_closest_common_parent()
 {
     if (random_publications_added_ > 0) // Don't do anything if there's no publications
@@ -902,6 +1189,19 @@ void MainProgram::test_get_closest_common_parent()
     }
 }
 
+void MainProgram::test_closest_common_parents_batch()
+{
+    if (random_publications_added_ > 0) // Don't do anything if there's no publications
+    {
+        vector<pair<PublicationID, PublicationID>> pairs;
+        for (unsigned int i = 0; i < PERFTEST_BATCH_SIZE; ++i)
+        {
+            pairs.emplace_back(random_leaf_publication(), random_leaf_publication());
+        }
+        ds_.get_closest_common_parents(pairs);
+    }
+}
+
 MainProgram::CmdResult MainProgram::cmd_randseed(std::ostream& output, MatchIter begin, MatchIter end)
 {
     string seedstr = *begin++;
@@ -1152,83 +1452,266 @@ string const publicationidx = "([0-9]+)";
 string const namex = "([ a-zA-Z0-9-]+)";
 string const timex = "([0-9]+)";
 string const numx = "([0-9]+)";
-string const optcoordx = "\\([[:space:]]*[0-9]+[[:space:]]*,[[:space:]]*[0-9]+[[:space:]]*\\)";
-string const coordx = "\\([[:space:]]*([0-9]+)[[:space:]]*,[[:space:]]*([0-9]+)[[:space:]]*\\)";
-string const wsx = "[[:space:]]+";
+MainProgram::CmdResult MainProgram::cmd_compact_citation_graph(ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
 
+    ds_.compact_citation_graph();
 
-vector<MainProgram::CmdInfo> MainProgram::cmds_ =
-    {
-        {"get_affiliation_count", "", "", &MainProgram::cmd_get_affiliation_count, &MainProgram::test_get_affiliation_count },
-        {"clear_all", "", "", &MainProgram::cmd_clear_all, nullptr }, // clear all probably shouldn't be perftested since it will ... clear everything
-        {"get_all_affiliations", "", "", &MainProgram::cmd_get_all_affiliations, &MainProgram::NoParListTestCmd<&Datastructures::get_all_affiliations>},
-        {"add_affiliation", "AffiliationID \"Name\" (x,y)", affiliationidx+wsx+'"'+namex+'"'+wsx+coordx, &MainProgram::cmd_add_affiliation, nullptr }, // tested within each perftest, separate perftesting not necessary
-        {"affiliation_info", "AffiliationID", affiliationidx, &MainProgram::cmd_affiliation_info, &MainProgram::test_affiliation_info },
-        {"get_affiliations_alphabetically", "", "", &MainProgram::NoParListCmd<&Datastructures::get_affiliations_alphabetically>, &MainProgram::NoParListTestCmd<&Datastructures::get_affiliations_alphabetically> },
-        {"get_affiliations_distance_increasing", "", "", &MainProgram::NoParListCmd<&Datastructures::get_affiliations_distance_increasing>,
-         &MainProgram::NoParListTestCmd<&Datastructures::get_affiliations_distance_increasing> },
-        {"find_affiliation_with_coord", "(x,y)", coordx, &MainProgram::cmd_find_affiliation_with_coord, &MainProgram::test_find_affiliation_with_coord },
-        {"change_affiliation_coord", "AffiliationID (x,y)", affiliationidx+wsx+coordx, &MainProgram::cmd_change_affiliation_coord, &MainProgram::test_change_affiliation_coord },
-        {"get_publications_after", "AffiliationID Time", affiliationidx+wsx+timex, &MainProgram::cmd_get_publications_after, &MainProgram::test_get_publications_after },
-        {"add_publication", "PublicationID \"Name\" Year AffiliationID AffiliationID ...", publicationidx+wsx+'"'+namex+'"'+wsx+timex+"((?:"+wsx+affiliationlistx+")*)", &MainProgram::cmd_add_publication, nullptr }, // tested within each perftest, separate perftesting not necessary
-        {"get_all_publications", "", "", &MainProgram::cmd_get_all_publications, &MainProgram::test_get_all_publications},
-        {"publication_info", "PublicationID", publicationidx, &MainProgram::cmd_publication_info, &MainProgram::test_publication_info },
-        {"add_reference", "PublicationID parentPublicationID", publicationidx+wsx+publicationidx, &MainProgram::cmd_add_reference, nullptr },
-        {"add_affiliation_to_publication", "AffiliationID PublicationID", affiliationidx+wsx+publicationidx, &MainProgram::cmd_add_affiliation_to_publication, &MainProgram::test_add_affiliation_to_publication},
-        {"get_publications", "AffiliationID", affiliationidx, &MainProgram::cmd_get_publications, &MainProgram::test_get_publications },
-        {"get_all_references", "PublicationID", publicationidx, &MainProgram::cmd_get_all_references, &MainProgram::test_get_all_references },
-        {"get_affiliations_closest_to", "(x,y)", coordx, &MainProgram::cmd_get_affiliations_closest_to, &MainProgram::test_affiliations_closest_to },
-        {"remove_affiliation", "AffiliationID", affiliationidx, &MainProgram::cmd_remove_affiliation, &MainProgram::test_remove_affiliation },
-        {"get_closest_common_parent", "PublicationID1 PublicationID2", publicationidx+wsx+publicationidx, &MainProgram::cmd_get_closest_common_parent, &MainProgram::test_get_closest_common_parent },
-        {"quit", "", "", nullptr, nullptr },
-        {"help", "", "", &MainProgram::help_command, nullptr },
-        {"random_add", "number_of_affiliations_to_add  (minx,miny) (maxx,maxy) (coordinates optional)",
-         numx+"(?:"+wsx+coordx+wsx+coordx+")?", &MainProgram::cmd_random_affiliations, &MainProgram::test_random_affiliations },
-        {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
-        {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
-        {"perftest", "cmd1[;cmd2...] timeout repeat_count n1[;n2...] (parts in [] are optional, alternatives separated by |)",
-         "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest, nullptr },
-        {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
-        {"random_seed", "new-random-seed-integer", numx, &MainProgram::cmd_randseed, nullptr },
-        {"#", "comment text", ".*", &MainProgram::cmd_comment, nullptr },
-        {"remove_publication","PublicationID",publicationidx, &MainProgram::cmd_remove_publication, &MainProgram::test_remove_publication},
-        {"get_parent","PublicationID",publicationidx,&MainProgram::cmd_get_parent, &MainProgram::test_get_parent},
-        {"get_referenced_by_chain","PublicationID",publicationidx,&MainProgram::cmd_get_referenced_by_chain,&MainProgram::test_get_referenced_by_chain},
-        {"get_affiliations", "PublicationID", publicationidx, &MainProgram::cmd_get_affiliations, &MainProgram::test_get_affiliations},
-        {"get_direct_references", "PublicationID", publicationidx, &MainProgram::cmd_get_direct_references, &MainProgram::test_get_direct_references},
-        };
+    output << "Compacted the citation graph" << endl;
 
-MainProgram::CmdResult MainProgram::help_command(std::ostream& output, MatchIter /*begin*/, MatchIter /*end*/)
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_save_snapshot(ostream& output, MatchIter begin, MatchIter end)
 {
-    output << "Commands:" << endl;
-    for (auto& i : cmds_)
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (ds_.save_snapshot(filename))
     {
-        output << "  " << i.cmd << " " << i.info << endl;
+        output << "Saved snapshot to '" << filename << "'" << endl;
+    }
+    else
+    {
+        output << "Cannot write snapshot file '" << filename << "'!" << endl;
     }
 
     return {};
 }
 
-MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end)
+MainProgram::CmdResult MainProgram::cmd_load_snapshot(ostream& output, MatchIter begin, MatchIter end)
 {
-#ifdef _GLIBCXX_DEBUG
-    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
-#endif // _GLIBCXX_DEBUG
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
 
-    try {
-        // Note: everything below is indented too little by one indentation level! (because of try block above)
+    if (ds_.load_snapshot(filename))
+    {
+        output << "Loaded snapshot from '" << filename << "'" << endl;
+    }
+    else
+    {
+        output << "Cannot load snapshot file '" << filename << "'!" << endl;
+    }
 
-        string commandstr = *begin++;
-        unsigned int timeout = convert_string_to<unsigned int>(*begin++);
-        unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
-        string sizes = *begin++;
-        assert(begin == end && "Invalid number of parameters");
+    return {};
+}
 
-        vector<string> testcmds;
-        smatch scmd;
-        auto cbeg = commandstr.cbegin();
-        auto cend = commandstr.cend();
-        for ( ; regex_search(cbeg, cend, scmd, commands_regex_); cbeg = scmd.suffix().first)
+MainProgram::CmdResult MainProgram::cmd_import(ostream& output, MatchIter begin, MatchIter end)
+{
+    string kind = *begin++;
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    BulkImport::Result parsed;
+    unsigned int added = 0;
+    if (kind == "affiliations")
+    {
+        vector<AffiliationRecord> records;
+        parsed = BulkImport::parse_affiliations(filename, records);
+        added = ds_.add_affiliations(records);
+    }
+    else if (kind == "publications")
+    {
+        vector<PublicationRecord> records;
+        parsed = BulkImport::parse_publications(filename, records);
+        added = ds_.add_publications(records);
+    }
+    else
+    {
+        vector<std::pair<PublicationID, PublicationID>> records;
+        parsed = BulkImport::parse_references(filename, records);
+        added = ds_.add_references(records);
+    }
+
+    if (!parsed.opened)
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+        return {};
+    }
+    output << "Imported " << added << " of " << parsed.records << " " << kind << " from '" << filename << "'";
+    if (parsed.invalid_lines > 0)
+    {
+        output << ", skipped " << parsed.invalid_lines << " invalid line(s)";
+    }
+    output << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_start_journal(ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    string sync_every_str = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    unsigned int sync_every = sync_every_str.empty() ? 1 : convert_string_to<unsigned int>(sync_every_str);
+    if (ds_.start_journal(filename, sync_every))
+    {
+        output << "Journaling to '" << filename << "', ";
+        if (sync_every == 0) { output << "without fsync" << endl; }
+        else { output << "fsync every " << sync_every << " mutation(s)" << endl; }
+    }
+    else
+    {
+        output << "Cannot open journal file '" << filename << "'!" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_stop_journal(ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    if (ds_.stop_journal())
+    {
+        output << "Journaling stopped" << endl;
+    }
+    else
+    {
+        output << "Journaling stopped, but some mutations couldn't be written to the journal!" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_replay_journal(ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    int replayed = ds_.replay_journal(filename);
+    if (replayed != NO_VALUE)
+    {
+        output << "Replayed " << replayed << " mutation(s) from '" << filename << "'" << endl;
+    }
+    else
+    {
+        output << "Cannot replay journal file '" << filename << "' (journaling must be stopped first)!" << endl;
+    }
+
+    return {};
+}
+
+string const optcoordx = "\\([[:space:]]*[0-9]+[[:space:]]*,[[:space:]]*[0-9]+[[:space:]]*\\)";
+string const coordx = "\\([[:space:]]*([0-9]+)[[:space:]]*,[[:space:]]*([0-9]+)[[:space:]]*\\)";
+string const wsx = "[[:space:]]+";
+
+
+vector<MainProgram::CmdInfo> MainProgram::cmds_ =
+    {
+        {"get_affiliation_count", "", "", &MainProgram::cmd_get_affiliation_count, &MainProgram::test_get_affiliation_count },
+        {"clear_all", "", "", &MainProgram::cmd_clear_all, nullptr }, // clear all probably shouldn't be perftested since it will ... clear everything
+        {"get_all_affiliations", "", "", &MainProgram::cmd_get_all_affiliations, &MainProgram::NoParConstListTestCmd<&Datastructures::get_all_affiliations>},
+        {"add_affiliation", "AffiliationID \"Name\" (x,y)", affiliationidx+wsx+'"'+namex+'"'+wsx+coordx, &MainProgram::cmd_add_affiliation, nullptr }, // tested within each perftest, separate perftesting not necessary
+        {"affiliation_info", "AffiliationID", affiliationidx, &MainProgram::cmd_affiliation_info, &MainProgram::test_affiliation_info },
+        {"get_affiliations_alphabetically", "", "", &MainProgram::NoParListCmd<&Datastructures::get_affiliations_alphabetically>, &MainProgram::NoParListTestCmd<&Datastructures::get_affiliations_alphabetically> },
+        {"get_affiliations_distance_increasing", "", "", &MainProgram::NoParListCmd<&Datastructures::get_affiliations_distance_increasing>,
+         &MainProgram::NoParListTestCmd<&Datastructures::get_affiliations_distance_increasing> },
+        {"find_affiliation_with_coord", "(x,y)", coordx, &MainProgram::cmd_find_affiliation_with_coord, &MainProgram::test_find_affiliation_with_coord },
+        {"change_affiliation_coord", "AffiliationID (x,y)", affiliationidx+wsx+coordx, &MainProgram::cmd_change_affiliation_coord, &MainProgram::test_change_affiliation_coord },
+        {"get_publications_after", "AffiliationID Time", affiliationidx+wsx+timex, &MainProgram::cmd_get_publications_after, &MainProgram::test_get_publications_after },
+        {"add_publication", "PublicationID \"Name\" Year AffiliationID AffiliationID ...", publicationidx+wsx+'"'+namex+'"'+wsx+timex+"((?:"+wsx+affiliationlistx+")*)", &MainProgram::cmd_add_publication, nullptr }, // tested within each perftest, separate perftesting not necessary
+        {"get_all_publications", "", "", &MainProgram::cmd_get_all_publications, &MainProgram::test_get_all_publications},
+        {"publication_info", "PublicationID", publicationidx, &MainProgram::cmd_publication_info, &MainProgram::test_publication_info },
+        {"add_reference", "PublicationID parentPublicationID", publicationidx+wsx+publicationidx, &MainProgram::cmd_add_reference, nullptr },
+        {"add_affiliation_to_publication", "AffiliationID PublicationID", affiliationidx+wsx+publicationidx, &MainProgram::cmd_add_affiliation_to_publication, &MainProgram::test_add_affiliation_to_publication},
+        {"get_publications", "AffiliationID", affiliationidx, &MainProgram::cmd_get_publications, &MainProgram::test_get_publications },
+        {"get_all_references", "PublicationID", publicationidx, &MainProgram::cmd_get_all_references, &MainProgram::test_get_all_references },
+        {"count_all_references", "PublicationID", publicationidx, &MainProgram::cmd_count_all_references, &MainProgram::test_count_all_references },
+        {"get_affiliations_closest_to", "(x,y)", coordx, &MainProgram::cmd_get_affiliations_closest_to, &MainProgram::test_affiliations_closest_to },
+        {"get_affiliations_k_closest_to", "(x,y) k", coordx+wsx+numx, &MainProgram::cmd_get_affiliations_k_closest_to, &MainProgram::test_affiliations_k_closest_to },
+        {"get_affiliations_within", "(x,y) radius", coordx+wsx+numx, &MainProgram::cmd_get_affiliations_within, &MainProgram::test_affiliations_within },
+        {"get_affiliations_in_rect", "(minx,miny) (maxx,maxy)", coordx+wsx+coordx, &MainProgram::cmd_get_affiliations_in_rect, &MainProgram::test_affiliations_in_rect },
+        {"remove_affiliation", "AffiliationID", affiliationidx, &MainProgram::cmd_remove_affiliation, &MainProgram::test_remove_affiliation },
+        {"get_closest_common_parent", "PublicationID1 PublicationID2", publicationidx+wsx+publicationidx, &MainProgram::cmd_get_closest_common_parent, &MainProgram::test_get_closest_common_parent },
+        {"closest_common_parents_batch", "\"in-filename\" [\"out-filename\"]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"\"([-a-zA-Z0-9 ./:_]+)\")?",
+         &MainProgram::cmd_closest_common_parents_batch, &MainProgram::test_closest_common_parents_batch },
+        {"quit", "", "", nullptr, nullptr },
+        {"help", "", "", &MainProgram::help_command, nullptr },
+        {"random_add", "number_of_affiliations_to_add  (minx,miny) (maxx,maxy) (coordinates optional)",
+         numx+"(?:"+wsx+coordx+wsx+coordx+")?", &MainProgram::cmd_random_affiliations, &MainProgram::test_random_affiliations },
+        {"random_tree_shape", "balanced|deep (alternatives separated by |)", "(?:(balanced)|(deep))", &MainProgram::cmd_random_tree_shape, nullptr },
+        {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
+        {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
+        {"perftest", "cmd1[;cmd2...] timeout repeat_count n1[;n2...] (parts in [] are optional, alternatives separated by |)",
+         "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest, nullptr },
+        {"perftest_publication_maps", "repeat_count n1[;n2...]", numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest_publication_maps, nullptr },
+        {"perftest_affiliation_orders", "additions_per_query1[;additions_per_query2...] n1[;n2...]",
+         "([0-9]+(?:;[0-9]+)*)"+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest_affiliation_orders, nullptr },
+        {"perftest_journal", "\"journal-filename\" mutations_per_fsync1[;mutations_per_fsync2...] n1[;n2...]",
+         "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"([0-9]+(?:;[0-9]+)*)"+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest_journal, nullptr },
+        {"perftest_concurrent_reads", "threads1[;threads2...] query_count n1[;n2...]",
+         "([0-9]+(?:;[0-9]+)*)"+wsx+"([0-9]+)"+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest_concurrent_reads, nullptr },
+        {"perftest_versions", "readers1[;readers2...] additions n1[;n2...]",
+         "([0-9]+(?:;[0-9]+)*)"+wsx+"([0-9]+)"+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest_versions, nullptr },
+        {"perftest_sharded", "shards1[;shards2...] query_count n1[;n2...]",
+         "([0-9]+(?:;[0-9]+)*)"+wsx+"([0-9]+)"+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest_sharded, nullptr },
+        {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
+        {"random_seed", "new-random-seed-integer", numx, &MainProgram::cmd_randseed, nullptr },
+        {"#", "comment text", ".*", &MainProgram::cmd_comment, nullptr },
+        {"remove_publication","PublicationID",publicationidx, &MainProgram::cmd_remove_publication, &MainProgram::test_remove_publication},
+        {"remove_random_publications", "number_of_publications_to_remove", numx, &MainProgram::cmd_remove_random_publications, &MainProgram::test_remove_publication_with_queries },
+        {"get_parent","PublicationID",publicationidx,&MainProgram::cmd_get_parent, &MainProgram::test_get_parent},
+        {"get_referenced_by_chain","PublicationID",publicationidx,&MainProgram::cmd_get_referenced_by_chain,&MainProgram::test_get_referenced_by_chain},
+        {"get_affiliations", "PublicationID", publicationidx, &MainProgram::cmd_get_affiliations, &MainProgram::test_get_affiliations},
+        {"get_direct_references", "PublicationID", publicationidx, &MainProgram::cmd_get_direct_references, &MainProgram::test_get_direct_references},
+        {"compact_citation_graph", "", "", &MainProgram::cmd_compact_citation_graph, &MainProgram::test_compact_citation_graph},
+        {"save_snapshot", "\"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_save_snapshot, nullptr },
+        {"load_snapshot", "\"in-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_load_snapshot, nullptr },
+        {"import", "affiliations|publications|references \"in-filename\" (alternatives separated by |)",
+         "(affiliations|publications|references)"+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_import, nullptr },
+        {"start_journal", "\"out-filename\" [mutations_per_fsync]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+numx+")?", &MainProgram::cmd_start_journal, nullptr },
+        {"stop_journal", "", "", &MainProgram::cmd_stop_journal, nullptr },
+        {"replay_journal", "\"in-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_replay_journal, nullptr },
+        };
+
+// Commands of the query server. The rest read or write files, run perftests or clear everything.
+vector<string> const MainProgram::served_cmds_ =
+    {
+        "get_affiliation_count", "get_all_affiliations", "affiliation_info", "get_affiliations_alphabetically",
+        "get_affiliations_distance_increasing", "find_affiliation_with_coord", "get_publications_after",
+        "get_all_publications", "publication_info", "get_publications", "get_all_references", "count_all_references",
+        "get_affiliations_closest_to", "get_affiliations_k_closest_to", "get_affiliations_within",
+        "get_affiliations_in_rect", "get_closest_common_parent", "get_parent",
+        "get_referenced_by_chain", "get_affiliations", "get_direct_references",
+        "add_affiliation", "change_affiliation_coord", "add_publication", "add_reference",
+        "add_affiliation_to_publication", "remove_affiliation", "remove_publication",
+        "quit"
+    };
+
+MainProgram::CmdResult MainProgram::help_command(std::ostream& output, MatchIter /*begin*/, MatchIter /*end*/)
+{
+    output << "Commands:" << endl;
+    for (auto& i : cmds_)
+    {
+        output << "  " << i.cmd << " " << i.info << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end)
+{
+#ifdef _GLIBCXX_DEBUG
+    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
+#endif // _GLIBCXX_DEBUG
+
+    try {
+        // Note: everything below is indented too little by one indentation level! (because of try block above)
+
+        string commandstr = *begin++;
+        unsigned int timeout = convert_string_to<unsigned int>(*begin++);
+        unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
+        string sizes = *begin++;
+        assert(begin == end && "Invalid number of parameters");
+
+        vector<string> testcmds;
+        smatch scmd;
+        auto cbeg = commandstr.cbegin();
+        auto cend = commandstr.cend();
+        for ( ; regex_search(cbeg, cend, scmd, commands_regex_); cbeg = scmd.suffix().first)
         {
             testcmds.push_back(scmd[1]);
         }
@@ -1292,12 +1775,15 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
 
             Stopwatch stopwatch(true); // Use also instruction counting, if enabled
 
-            // Add random affiliations
-            for (unsigned int i = 0; i < n / 1000; ++i)
+            // Add random affiliations in batches that double in size, so that every batch goes through the bulk
+            // operations and the timeout is still checked in between
+            for (unsigned int added = 0; added < n;)
             {
+                unsigned int batch = std::min(std::max(1000u, added), n - added);
                 stopwatch.start();
-                add_random_affiliations_publications(1000);
+                add_random_affiliations_publications(batch);
                 stopwatch.stop();
+                added += batch;
 
                 if (stopwatch.elapsed() >= timeout)
                 {
@@ -1314,13 +1800,6 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
             }
             if (stop) { break; }
 
-            if (n % 1000 != 0)
-            {
-                stopwatch.start();
-                add_random_affiliations_publications(n % 1000);
-                stopwatch.stop();
-            }
-
 #ifdef USE_PERF_EVENT
             auto addcount = stopwatch.count();
 #endif
@@ -1401,6 +1880,672 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     return {};
 }
 
+template <typename Map>
+MainProgram::MapTimes MainProgram::time_publication_map(vector<PublicationID> const& ids, vector<PublicationID> const& lookups)
+{
+    MapTimes times{0, 0, 0, 0};
+    Stopwatch stopwatch;
+    Map map;
+
+    stopwatch.start();
+    PublicationID previous = NO_PUBLICATION;
+    for (auto id : ids)
+    {
+        auto& info = map[id];
+        info.year = static_cast<Year>(id % RANDOM_MAX_YEAR);
+        info.parent = previous;
+        previous = id;
+    }
+    stopwatch.stop();
+    times.add = stopwatch.elapsed();
+
+    // Same access pattern as get_parent / get_publication_year, roughly half of the ids are missing
+    stopwatch.reset();
+    stopwatch.start();
+    for (auto id : lookups)
+    {
+        auto it = map.find(id);
+        if (it != map.end() && it->second.parent != id)
+        {
+            times.found += 1 + it->second.year % 2;
+        }
+    }
+    stopwatch.stop();
+    times.lookup = stopwatch.elapsed();
+
+    stopwatch.reset();
+    stopwatch.start();
+    for (auto const& entry : map)
+    {
+        times.found += entry.second.parent == NO_PUBLICATION;
+    }
+    stopwatch.stop();
+    times.iterate = stopwatch.elapsed();
+
+    return times;
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_publication_maps(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<unsigned int> init_ns;
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        init_ns.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    output << "For each N add N publications with perftest ids and perform " << repeat_count << " random lookup(s)" << endl << endl;
+    output << setw(8) << "N" << " , " << setw(13) << "map" << " , " << setw(12) << "add (sec)" << " , " << setw(12) << "lookup (sec)" << " , "
+           << setw(13) << "iterate (sec)" << " , " << setw(10) << "checksum" << endl;
+    flush_output(output);
+
+    for (unsigned int n : init_ns)
+    {
+        vector<PublicationID> ids;
+        ids.reserve(n);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            ids.push_back(n_to_publicationid(i));
+        }
+        vector<PublicationID> lookups;
+        lookups.reserve(repeat_count);
+        for (unsigned int i = 0; i < repeat_count; ++i)
+        {
+            lookups.push_back(n_to_publicationid(random<unsigned long int>(0, 2 * n)));
+        }
+
+        auto print_row = [&output, n](string const& name, MapTimes const& times)
+        {
+            output << setw(8) << n << " , " << setw(13) << name << " , " << setw(12) << times.add << " , " << setw(12) << times.lookup << " , "
+                   << setw(13) << times.iterate << " , " << setw(10) << times.found << endl;
+        };
+        print_row("unordered_map", time_publication_map<std::unordered_map<PublicationID, PublicationInfo>>(ids, lookups));
+        flush_output(output);
+        print_row("FlatHashMap", time_publication_map<FlatHashMap<PublicationID, PublicationInfo>>(ids, lookups));
+        flush_output(output);
+        print_row("HybridIdMap", time_publication_map<HybridIdMap<PublicationInfo>>(ids, lookups));
+        flush_output(output);
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_affiliation_orders(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string ratios = *begin++;
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    auto parse_numbers = [this](string const& numbers)
+    {
+        vector<unsigned int> result;
+        smatch number;
+        for (auto nbeg = numbers.cbegin(); regex_search(nbeg, numbers.cend(), number, sizes_regex_); nbeg = number.suffix().first)
+        {
+            result.push_back(convert_string_to<unsigned int>(number[1]));
+        }
+        return result;
+    };
+    vector<unsigned int> adds_per_query = parse_numbers(ratios);
+    vector<unsigned int> init_ns = parse_numbers(sizes);
+
+    output << "For each N add N affiliations, listing them alphabetically and by distance after every A additions" << endl;
+    output << "(std::set maintains only the two orders, Datastructures does the full add_affiliation)" << endl << endl;
+    output << setw(8) << "N" << " , " << setw(8) << "A" << " , " << setw(14) << "order" << " , " << setw(12) << "time (sec)" << " , "
+           << setw(10) << "checksum" << endl;
+    flush_output(output);
+
+    for (unsigned int n : init_ns)
+    {
+        vector<AffiliationRecord> affiliations;
+        affiliations.reserve(n);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            affiliations.push_back({n_to_affiliationid(i), n_to_name(i), get_random_coords()});
+        }
+
+        for (unsigned int per_query : adds_per_query)
+        {
+            per_query = std::max(per_query, 1u);
+
+            // Baseline: the orders kept in red-black trees of (key, id) pairs, listed by walking the trees
+            Stopwatch stopwatch;
+            unsigned long int checksum = 0;
+            stopwatch.start();
+            {
+                std::set<std::pair<Name, AffiliationID>> by_name;
+                std::set<std::pair<Distance, AffiliationID>> by_distance;
+                for (unsigned int i = 0; i < n; ++i)
+                {
+                    auto const& affiliation = affiliations[i];
+                    by_name.emplace(affiliation.name, affiliation.id);
+                    by_distance.emplace(affiliation.xy.x * affiliation.xy.x + affiliation.xy.y * affiliation.xy.y, affiliation.id);
+                    if ((i + 1) % per_query == 0)
+                    {
+                        vector<AffiliationID> alphabetical;
+                        alphabetical.reserve(by_name.size());
+                        for (auto const& entry : by_name) { alphabetical.push_back(entry.second); }
+                        vector<AffiliationID> increasing;
+                        increasing.reserve(by_distance.size());
+                        for (auto const& entry : by_distance) { increasing.push_back(entry.second); }
+                        checksum += alphabetical.size() + increasing.size();
+                    }
+                }
+            }
+            stopwatch.stop();
+            output << setw(8) << n << " , " << setw(8) << per_query << " , " << setw(14) << "std::set" << " , " << setw(12) << stopwatch.elapsed() << " , "
+                   << setw(10) << checksum << endl;
+            flush_output(output);
+
+            ds_.clear_all();
+            checksum = 0;
+            stopwatch.reset();
+            stopwatch.start();
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                auto const& affiliation = affiliations[i];
+                ds_.add_affiliation(affiliation.id, affiliation.name, affiliation.xy);
+                if ((i + 1) % per_query == 0)
+                {
+                    checksum += ds_.get_affiliations_alphabetically().size() + ds_.get_affiliations_distance_increasing().size();
+                }
+            }
+            stopwatch.stop();
+            output << setw(8) << n << " , " << setw(8) << per_query << " , " << setw(14) << "Datastructures" << " , " << setw(12) << stopwatch.elapsed()
+                   << " , " << setw(10) << checksum << endl;
+            flush_output(output);
+
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                return {};
+            }
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_concurrent_reads(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string threadcounts = *begin++;
+    string countstr = *begin++;
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    auto parse_numbers = [this](string const& numbers)
+    {
+        vector<unsigned int> result;
+        smatch number;
+        for (auto nbeg = numbers.cbegin(); regex_search(nbeg, numbers.cend(), number, sizes_regex_); nbeg = number.suffix().first)
+        {
+            result.push_back(convert_string_to<unsigned int>(number[1]));
+        }
+        return result;
+    };
+    vector<unsigned int> thread_counts = parse_numbers(threadcounts);
+    unsigned int query_count = convert_string_to<unsigned int>(countstr);
+    vector<unsigned int> init_ns = parse_numbers(sizes);
+
+    output << "For each N add N affiliations and publications, then run the query mix from T threads through SharedDatastructures" << endl;
+    output << "(publication name, all references, closest affiliations, publications after, closest common parent)" << endl;
+    output << "Hardware threads: " << std::thread::hardware_concurrency() << endl << endl;
+    output << setw(8) << "N" << " , " << setw(8) << "T" << " , " << setw(12) << "time (sec)" << " , " << setw(14) << "queries/sec" << " , "
+           << setw(8) << "speedup" << " , " << setw(12) << "checksum" << endl;
+    flush_output(output);
+
+    struct Query
+    {
+        PublicationID publication1;
+        PublicationID publication2;
+        AffiliationID affiliation;
+        Coord xy;
+        Year year;
+    };
+
+    for (unsigned int n : init_ns)
+    {
+        ds_.clear_all();
+        init_primes();
+        add_random_affiliations_publications(n);
+
+        // The random engine isn't thread safe, so the parameters are drawn here
+        vector<Query> queries;
+        queries.reserve(query_count);
+        for (unsigned int i = 0; i < query_count; ++i)
+        {
+            queries.push_back({random_publication(), random_publication(), random_affiliation(), get_random_coords(), get_random_year()});
+        }
+
+        // Every row starts with the lazy indexes up to date, instead of the first one paying for them
+        ds_.prepare_for_reads();
+        SharedDatastructures shared(ds_);
+        double first_time = 0;
+        for (unsigned int threads : thread_counts)
+        {
+            threads = std::max(threads, 1u);
+            vector<unsigned long int> checksums(threads, 0);
+            auto run_queries = [&](unsigned int thread)
+            {
+                unsigned long int checksum = 0;
+                for (std::size_t i = thread; i < queries.size(); i += threads)
+                {
+                    auto const& query = queries[i];
+                    switch (i % 5)
+                    {
+                    case 0: checksum += shared.get_publication_name(query.publication1).size(); break;
+                    case 1: checksum += shared.get_all_references(query.publication1).size(); break;
+                    case 2: checksum += shared.get_affiliations_closest_to(query.xy).size(); break;
+                    case 3: checksum += shared.get_publications_after(query.affiliation, query.year).size(); break;
+                    default: checksum += shared.get_closest_common_parent(query.publication1, query.publication2) != NO_PUBLICATION; break;
+                    }
+                }
+                checksums[thread] = checksum;
+            };
+
+            Stopwatch stopwatch;
+            stopwatch.start();
+            vector<std::thread> workers;
+            for (unsigned int thread = 1; thread < threads; ++thread)
+            {
+                workers.emplace_back(run_queries, thread);
+            }
+            run_queries(0);
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+            stopwatch.stop();
+
+            double time = stopwatch.elapsed();
+            if (first_time == 0) { first_time = time; }
+            unsigned long int checksum = 0;
+            for (auto part : checksums) { checksum += part; }
+            output << setw(8) << n << " , " << setw(8) << threads << " , " << setw(12) << time << " , "
+                   << setw(14) << static_cast<unsigned long int>(time > 0 ? query_count / time : 0) << " , "
+                   << setw(8) << std::setprecision(3) << (time > 0 ? first_time / time : 0) << std::setprecision(6) << " , "
+                   << setw(12) << checksum << endl;
+            flush_output(output);
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                return {};
+            }
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_versions(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string readercounts = *begin++;
+    string additionstr = *begin++;
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    auto parse_numbers = [this](string const& numbers)
+    {
+        vector<unsigned int> result;
+        smatch number;
+        for (auto nbeg = numbers.cbegin(); regex_search(nbeg, numbers.cend(), number, sizes_regex_); nbeg = number.suffix().first)
+        {
+            result.push_back(convert_string_to<unsigned int>(number[1]));
+        }
+        return result;
+    };
+    vector<unsigned int> reader_counts = parse_numbers(readercounts);
+    unsigned int additions = convert_string_to<unsigned int>(additionstr);
+    vector<unsigned int> init_ns = parse_numbers(sizes);
+
+    output << "For each N add N affiliations and publications, then add more publications with references from one writer" << endl;
+    output << "while R readers run get_all_references and get_referenced_by_chain, through a shared lock and through versions" << endl << endl;
+    output << setw(8) << "N" << " , " << setw(4) << "R" << " , " << setw(11) << "mode" << " , " << setw(12) << "writes/sec" << " , "
+           << setw(12) << "reads/sec" << " , " << setw(14) << "max read (ms)" << " , " << setw(18) << "versions (freed)" << endl;
+    flush_output(output);
+
+    for (unsigned int n : init_ns)
+    {
+        ds_.clear_all();
+        init_primes();
+        add_random_affiliations_publications(n);
+        ds_.prepare_for_reads();
+        Datastructures const base(ds_);
+
+        // New publications, each referencing a random earlier one, and the publications the readers query. The
+        // random state is restored afterwards, since the new publications are only added to copies.
+        auto initial_publications = random_publications_added_;
+        vector<PublicationRecord> new_publications;
+        vector<PublicationID> new_parents;
+        new_publications.reserve(additions);
+        new_parents.reserve(additions);
+        for (unsigned int i = 0; i < additions; ++i)
+        {
+            PublicationID parent = random_publication();
+            auto publicationid = n_to_publicationid(random_publications_added_++);
+            new_publications.push_back({publicationid, convert_to_string(publicationid), get_random_year(), {random_affiliation()}});
+            new_parents.push_back(parent);
+        }
+        random_publications_added_ = initial_publications;
+        vector<PublicationID> query_ids(4096);
+        for (auto& id : query_ids) { id = random_publication(); }
+
+        for (unsigned int readers : reader_counts)
+        {
+            for (bool versioned_mode : {false, true})
+            {
+                Datastructures locked_copy(base);
+                SharedDatastructures shared(locked_copy);
+                VersionedDatastructures versioned(base);
+
+                std::atomic<bool> writing_done{false};
+                vector<unsigned long int> read_counts(readers, 0);
+                vector<double> max_reads(readers, 0);
+                auto run_reader = [&](unsigned int reader)
+                {
+                    unsigned int slot = versioned.register_reader();
+                    unsigned long int count = 0;
+                    double max_read = 0;
+                    for (std::size_t i = reader; !writing_done.load(std::memory_order_relaxed); i += readers)
+                    {
+                        PublicationID id = query_ids[i % query_ids.size()];
+                        auto start = std::chrono::steady_clock::now();
+                        if (versioned_mode)
+                        {
+                            auto view = versioned.read(slot);
+                            i % 2 == 0 ? view->get_all_references(id) : view->get_referenced_by_chain(id);
+                        }
+                        else
+                        {
+                            i % 2 == 0 ? shared.get_all_references(id) : shared.get_referenced_by_chain(id);
+                        }
+                        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                        max_read = std::max(max_read, elapsed.count());
+                        ++count;
+                    }
+                    versioned.unregister_reader(slot);
+                    read_counts[reader] = count;
+                    max_reads[reader] = max_read;
+                };
+
+                vector<std::thread> workers;
+                for (unsigned int reader = 0; reader < readers; ++reader)
+                {
+                    workers.emplace_back(run_reader, reader);
+                }
+
+                Stopwatch stopwatch;
+                stopwatch.start();
+                for (unsigned int i = 0; i < additions; ++i)
+                {
+                    auto const& publication = new_publications[i];
+                    if (versioned_mode)
+                    {
+                        versioned.add_publication(publication.id, publication.name, publication.year, publication.affiliations);
+                        versioned.add_reference(publication.id, new_parents[i]);
+                    }
+                    else
+                    {
+                        shared.add_publication(publication.id, publication.name, publication.year, publication.affiliations);
+                        shared.add_reference(publication.id, new_parents[i]);
+                    }
+                }
+                if (versioned_mode)
+                {
+                    versioned.publish();
+                }
+                stopwatch.stop();
+                writing_done = true;
+                for (auto& worker : workers)
+                {
+                    worker.join();
+                }
+
+                double time = stopwatch.elapsed();
+                unsigned long int reads = 0;
+                for (auto count : read_counts) { reads += count; }
+                double max_read = readers > 0 ? *std::max_element(max_reads.begin(), max_reads.end()) : 0;
+                output << setw(8) << n << " , " << setw(4) << readers << " , " << setw(11) << (versioned_mode ? "versions" : "shared lock") << " , "
+                       << setw(12) << static_cast<unsigned long int>(time > 0 ? additions / time : 0) << " , "
+                       << setw(12) << static_cast<unsigned long int>(time > 0 ? reads / time : 0) << " , " << setw(14) << max_read << " , ";
+                if (versioned_mode)
+                {
+                    output << setw(18) << (std::to_string(versioned.versions_published()) + " (" + std::to_string(versioned.versions_freed()) + ")");
+                }
+                else
+                {
+                    output << setw(18) << "-";
+                }
+                output << endl;
+                flush_output(output);
+                if (check_stop())
+                {
+                    output << "Stopped!" << endl;
+                    return {};
+                }
+            }
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_sharded(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string shardcounts = *begin++;
+    string countstr = *begin++;
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    auto parse_numbers = [this](string const& numbers)
+    {
+        vector<unsigned int> result;
+        smatch number;
+        for (auto nbeg = numbers.cbegin(); regex_search(nbeg, numbers.cend(), number, sizes_regex_); nbeg = number.suffix().first)
+        {
+            result.push_back(convert_string_to<unsigned int>(number[1]));
+        }
+        return result;
+    };
+    vector<unsigned int> shard_counts = parse_numbers(shardcounts);
+    unsigned int query_count = convert_string_to<unsigned int>(countstr);
+    vector<unsigned int> init_ns = parse_numbers(sizes);
+
+    output << "For each N bulk load N affiliations and publications into S shards, then time the listings (all, alphabetical)," << endl;
+    output << "closest_to, and get_all_references with get_closest_common_parent, Q queries of each (listings Q/1000+1 times)" << endl;
+    output << "Hardware threads: " << std::thread::hardware_concurrency() << endl << endl;
+    output << setw(8) << "N" << " , " << setw(6) << "S" << " , " << setw(12) << "load (sec)" << " , " << setw(14) << "listings (sec)" << " , "
+           << setw(14) << "closest (sec)" << " , " << setw(14) << "graph (sec)" << " , " << setw(12) << "checksum" << endl;
+    flush_output(output);
+
+    for (unsigned int n : init_ns)
+    {
+        // The data is generated into ds_ and read back as bulk records, so that every row loads the same data
+        ds_.clear_all();
+        init_primes();
+        add_random_affiliations_publications(n);
+        vector<AffiliationRecord> affiliations;
+        for (auto const& id : ds_.get_all_affiliations())
+        {
+            affiliations.push_back({id, ds_.get_affiliation_name(id), ds_.get_affiliation_coord(id)});
+        }
+        vector<PublicationRecord> publications;
+        vector<std::pair<PublicationID, PublicationID>> references;
+        for (auto id : ds_.all_publications())
+        {
+            publications.push_back({id, ds_.get_publication_name(id), ds_.get_publication_year(id), ds_.get_affiliations(id)});
+            if (ds_.get_parent(id) != NO_PUBLICATION)
+            {
+                references.emplace_back(id, ds_.get_parent(id));
+            }
+        }
+
+        vector<std::pair<PublicationID, PublicationID>> publication_pairs;
+        vector<Coord> coords;
+        for (unsigned int i = 0; i < query_count; ++i)
+        {
+            publication_pairs.emplace_back(random_publication(), random_publication());
+            coords.push_back(get_random_coords());
+        }
+        unsigned int listing_count = query_count / 1000 + 1;
+
+        for (unsigned int shard_count : shard_counts)
+        {
+            ShardedDatastructures sharded(shard_count);
+            Stopwatch stopwatch;
+            unsigned long int checksum = 0;
+
+            stopwatch.start();
+            sharded.add_affiliations(affiliations);
+            sharded.add_publications(publications);
+            sharded.add_references(references);
+            stopwatch.stop();
+            double load_time = stopwatch.elapsed();
+
+            stopwatch.reset();
+            stopwatch.start();
+            for (unsigned int i = 0; i < listing_count; ++i)
+            {
+                checksum += sharded.get_all_affiliations().size();
+                checksum += sharded.get_affiliations_alphabetically().front().size();
+            }
+            stopwatch.stop();
+            double listing_time = stopwatch.elapsed();
+
+            stopwatch.reset();
+            stopwatch.start();
+            for (auto xy : coords)
+            {
+                for (auto const& id : sharded.get_affiliations_closest_to(xy)) { checksum += id.size(); }
+            }
+            stopwatch.stop();
+            double closest_time = stopwatch.elapsed();
+
+            stopwatch.reset();
+            stopwatch.start();
+            for (auto [id1, id2] : publication_pairs)
+            {
+                checksum += sharded.get_all_references(id1).size();
+                checksum += sharded.get_closest_common_parent(id1, id2) % 1000;
+            }
+            stopwatch.stop();
+            double graph_time = stopwatch.elapsed();
+
+            output << setw(8) << n << " , " << setw(6) << sharded.shard_count() << " , " << setw(12) << load_time << " , " << setw(14) << listing_time << " , "
+                   << setw(14) << closest_time << " , " << setw(14) << graph_time << " , " << setw(12) << checksum << endl;
+            flush_output(output);
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                return {};
+            }
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_journal(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    string syncs = *begin++;
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    auto parse_numbers = [this](string const& numbers)
+    {
+        vector<unsigned int> result;
+        smatch number;
+        for (auto nbeg = numbers.cbegin(); regex_search(nbeg, numbers.cend(), number, sizes_regex_); nbeg = number.suffix().first)
+        {
+            result.push_back(convert_string_to<unsigned int>(number[1]));
+        }
+        return result;
+    };
+    vector<unsigned int> sync_everys = parse_numbers(syncs);
+    vector<unsigned int> init_ns = parse_numbers(sizes);
+
+    output << "For each N add N affiliations and N publications with journaling off and on, then replay the journal" << endl << endl;
+    output << setw(8) << "N" << " , " << setw(16) << "journal" << " , " << setw(12) << "add (sec)" << " , " << setw(12) << "replay (sec)" << " , "
+           << setw(14) << "journal (bytes)" << endl;
+    flush_output(output);
+
+    for (unsigned int n : init_ns)
+    {
+        // Every row adds the same data, so the random state is restored before each of them
+        auto initial_engine = rand_engine_;
+        auto initial_affiliations = random_affiliations_added_;
+        auto initial_publications = random_publications_added_;
+
+        // The first row is without a journal
+        vector<int> configs{-1};
+        configs.insert(configs.end(), sync_everys.begin(), sync_everys.end());
+        for (int sync_every : configs)
+        {
+            ds_.stop_journal();
+            ds_.clear_all();
+            rand_engine_ = initial_engine;
+            random_affiliations_added_ = initial_affiliations;
+            random_publications_added_ = initial_publications;
+            init_primes();
+
+            remove(filename.c_str());
+            if (sync_every >= 0 && !ds_.start_journal(filename, sync_every))
+            {
+                output << "Cannot open journal file '" << filename << "'!" << endl;
+                return {};
+            }
+
+            Stopwatch stopwatch;
+            stopwatch.start();
+            add_random_affiliations_publications(n);
+            ds_.stop_journal(); // Commits the last group
+            stopwatch.stop();
+            double add_time = stopwatch.elapsed();
+
+            output << setw(8) << n << " , ";
+            if (sync_every < 0)
+            {
+                output << setw(16) << "off" << " , " << setw(12) << add_time << " , " << setw(12) << "-" << " , " << setw(14) << "-" << endl;
+            }
+            else
+            {
+                ifstream journal_file(filename, std::ios::binary | std::ios::ate);
+                auto journal_bytes = static_cast<long long int>(journal_file.tellg());
+                ds_.clear_all();
+                stopwatch.reset();
+                stopwatch.start();
+                ds_.replay_journal(filename);
+                stopwatch.stop();
+                string name = sync_every == 0 ? "no fsync" : "fsync/" + std::to_string(sync_every);
+                output << setw(16) << name << " , " << setw(12) << add_time << " , " << setw(12) << stopwatch.elapsed() << " , "
+                       << setw(14) << journal_bytes << endl;
+            }
+            flush_output(output);
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                remove(filename.c_str());
+                return {};
+            }
+        }
+    }
+    remove(filename.c_str());
+
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
 {
     return {};
@@ -1563,6 +2708,21 @@ bool MainProgram::command_parse_line(string inputline, ostream& output)
     return true; // Signal continuing
 }
 
+bool MainProgram::command_parse_served_line(string inputline, ostream& output)
+{
+    smatch match;
+    if (regex_match(inputline, match, cmds_regex_))
+    {
+        string cmd = match[1];
+        if (find(served_cmds_.begin(), served_cmds_.end(), cmd) == served_cmds_.end())
+        {
+            output << "Command '" << cmd << "' is not available in the server!" << endl;
+            return true;
+        }
+    }
+    return command_parse_line(inputline, output);
+}
+
 void MainProgram::command_parser(istream& input, ostream& output, PromptStyle promptstyle)
 {
     string line;
@@ -1637,14 +2797,100 @@ int MainProgram::mainprogram(int argc, char* argv[])
 {
     vector<string> args(argv, argv+argc);
 
-    if (args.size() < 1 || args.size() > 2)
+    bool serve = args.size() >= 2 && args[1] == "--serve";
+    bool load = args.size() >= 2 && args[1] == "--load";
+    bool load_binary = args.size() >= 2 && args[1] == "--load-binary";
+    if (args.size() < 1 || (serve && (args.size() < 3 || args.size() > 4)) || (load && (args.size() < 5 || args.size() > 6))
+        || (load_binary && args.size() != 6) || (!serve && !load && !load_binary && args.size() > 2))
     {
-        cerr << "Usage: " + ((args.size() > 0) ? args[0] : "<program name>") + " [<command file>]" << endl;
+        string program = (args.size() > 0) ? args[0] : "<program name>";
+        cerr << "Usage: " + program + " [<command file>]" << endl
+             << "       " + program + " --serve <socket path> [<command file>]" << endl
+             << "       " + program + " --load <socket path> <clients> <command file> [<repeat>]" << endl
+             << "       " + program + " --load-binary <socket path> <clients> <pipeline depth> <requests per client>" << endl;
         return EXIT_FAILURE;
     }
 
+    if (load_binary)
+    {
+        unsigned int clients = 0;
+        unsigned int depth = 0;
+        unsigned int requests = 0;
+        try
+        {
+            clients = convert_string_to<unsigned int>(args[3]);
+            depth = convert_string_to<unsigned int>(args[4]);
+            requests = convert_string_to<unsigned int>(args[5]);
+        }
+        catch (std::invalid_argument const&)
+        {
+            cout << "Invalid client count, pipeline depth or request count!" << endl;
+            return EXIT_FAILURE;
+        }
+        return LoadGenerator::run_binary(args[2], clients, depth, requests, cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (load)
+    {
+        // Load generator: the commands of the file are sent by every client, the server keeps its own data
+        ifstream input(args[4]);
+        if (!input)
+        {
+            cout << "Cannot open file '" << args[4] << "'!" << endl;
+            return EXIT_FAILURE;
+        }
+        vector<string> commands;
+        for (string line; getline(input, line); )
+        {
+            if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+            if (!line.empty()) { commands.push_back(line); }
+        }
+        unsigned int clients = 0;
+        unsigned int repeat = 1;
+        try
+        {
+            clients = convert_string_to<unsigned int>(args[3]);
+            if (args.size() == 6) { repeat = convert_string_to<unsigned int>(args[5]); }
+        }
+        catch (std::invalid_argument const&)
+        {
+            cout << "Invalid client or repeat count!" << endl;
+            return EXIT_FAILURE;
+        }
+        return LoadGenerator::run(args[2], commands, clients, repeat, cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     MainProgram mainprg;
 
+    if (serve)
+    {
+        // The data is loaded once by the optional command file, and then shared by all clients of the server
+        if (args.size() == 4)
+        {
+            ifstream input(args[3]);
+            if (!input)
+            {
+                cout << "Cannot open file '" << args[3] << "'!" << endl;
+                return EXIT_FAILURE;
+            }
+            mainprg.command_parser(input, cout, MainProgram::PromptStyle::NORMAL);
+        }
+        // MainProgram isn't thread safe, so the text commands run one at a time under the exclusive lock, while
+        // the binary queries run in parallel. The clients may only query and modify the data, not run the commands
+        // that touch files, run perftests or clear everything.
+        SharedDatastructures shared(mainprg.ds_);
+        QueryServer server([&mainprg, &shared](string const& line, ostream& output)
+                           {
+                               bool keep_open = true;
+                               shared.run_exclusive([&](Datastructures&) { keep_open = mainprg.command_parse_served_line(line, output); });
+                               return keep_open;
+                           },
+                           [&shared](unsigned char const* request, std::size_t size, ByteWriter& response)
+                           { BinaryProtocol::execute(shared, request, size, response); },
+                           max(2u, std::thread::hardware_concurrency()));
+        return server.serve(args[2], cerr) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (args.size() == 2 && args[1] != "--console")
     {
         string filename = args[1];
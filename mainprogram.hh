@@ -41,6 +41,18 @@ const Coord RANDOM_MAX_COORD = {10000,10000};
 const Year RANDOM_MIN_YEAR = 0;
 const Year RANDOM_MAX_YEAR = 9998;
 
+const unsigned int MAX_PERFTEST_K = 1000;
+const Distance MAX_PERFTEST_RADIUS = 500;
+
+// Random publications of a deep tree reference one of this many latest publications
+const unsigned int DEEP_TREE_PARENT_WINDOW = 8;
+
+// Number of publication pairs in one perftest batch of closest_common_parents_batch
+const unsigned int PERFTEST_BATCH_SIZE = 1000;
+
+// Number of random IDs tried when looking for one that still exists
+const unsigned int RANDOM_EXISTING_ATTEMPTS = 10;
+
 const double ROOT_BIAS_MULTIPLIER = 0.05;
 const double LEAF_BIAS_MULTIPLIER = 0.5;
 
@@ -58,6 +70,9 @@ public:
     enum class TestStatus { NOT_RUN, NO_DIFFS, DIFFS_FOUND };
 
     bool command_parse_line(std::string input, std::ostream& output);
+    // Like command_parse_line, but only runs the queries and mutations of the data (served_cmds_), the commands
+    // the clients of the query server may send. Any other command gets an error message as its output.
+    bool command_parse_served_line(std::string input, std::ostream& output);
     void command_parser(std::istream& input, std::ostream& output, PromptStyle promptstyle);
 
     void setui(MainWindow* ui);
@@ -81,6 +96,8 @@ private:
     unsigned long int prime2_ = 0; // Will be initialized to random value from above
     unsigned long int random_affiliations_added_ = 0; // Counter for random affiliations added
     unsigned long int random_publications_added_ = 0; // Counter for random publications added
+    enum class TreeShape { BALANCED, DEEP };
+    TreeShape tree_shape_ = TreeShape::BALANCED; // Shape of the reference tree built by random_add and perftest
     void init_primes();
     Name n_to_name(unsigned long int n);
     AffiliationID n_to_affiliationid(unsigned long int n);
@@ -111,6 +128,7 @@ private:
         std::regex param_regex = {};
     };
     static std::vector<CmdInfo> cmds_;
+    static std::vector<std::string> const served_cmds_;
     // Regex objects and their initialization
     std::regex cmds_regex_;
     std::regex coords_regex_;
@@ -136,21 +154,41 @@ private:
     CmdResult cmd_add_affiliation_to_publication(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_publications(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_all_references(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_count_all_references(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_affiliations_closest_to(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_get_affiliations_k_closest_to(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_get_affiliations_within(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_get_affiliations_in_rect(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_remove_affiliation(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_closest_common_parent(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_closest_common_parents_batch(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_remove_publication(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_parent(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_referenced_by_chain(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_direct_references(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_compact_citation_graph(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_save_snapshot(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_load_snapshot(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_import(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_start_journal(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_stop_journal(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_replay_journal(std::ostream& output, MatchIter begin, MatchIter end);
 
     CmdResult help_command(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_randseed(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_random_affiliations(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_random_tree_shape(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_remove_random_publications(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_read(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_testread(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_stopwatch(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_publication_maps(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_affiliation_orders(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_journal(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_concurrent_reads(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_versions(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_sharded(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_comment(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_get_affiliations(std::ostream& output, MatchIter begin, MatchIter end);
 
@@ -161,6 +199,8 @@ private:
     // biased random ids for some perftest
     PublicationID random_root_publication();
     PublicationID random_leaf_publication();
+    PublicationID random_existing_publication();
+    AffiliationID random_existing_affiliation();
 
     void test_get_functions(AffiliationID id);
     void test_affiliation_info();
@@ -170,17 +210,29 @@ private:
     void test_publication_info();
     void test_get_publications();
     void test_get_all_references();
+    void test_count_all_references();
     void test_affiliations_closest_to();
+    void test_affiliations_k_closest_to();
+    void test_affiliations_within();
+    void test_affiliations_in_rect();
     void test_remove_affiliation();
     void test_get_closest_common_parent();
+    void test_closest_common_parents_batch();
     void test_random_affiliations();
     void test_remove_publication();
+    void test_remove_publication_with_queries();
+
+    // Times adding, looking up and iterating the given publications in a PublicationID keyed map type
+    struct MapTimes { double add; double lookup; double iterate; unsigned long int found; };
+    template <typename Map>
+    MapTimes time_publication_map(std::vector<PublicationID> const& ids, std::vector<PublicationID> const& lookups);
     void test_get_parent();
     void test_get_referenced_by_chain();
     void test_get_direct_references();
     void test_get_affiliations();
     void test_get_affiliation_count();
     void test_get_all_publications();
+    void test_compact_citation_graph();
     void test_add_affiliation_to_publication();
 
 
@@ -214,6 +266,9 @@ private:
     template<std::vector<AffiliationID>(Datastructures::*MFUNC)()>
     void NoParListTestCmd();
 
+    template<std::vector<AffiliationID>(Datastructures::*MFUNC)() const>
+    void NoParConstListTestCmd();
+
     friend class MainWindow;
 };
 
@@ -279,6 +334,12 @@ void MainProgram::NoParListTestCmd()
     (ds_.*MFUNC)();
 }
 
+template<std::vector<AffiliationID>(Datastructures::*MFUNC)() const>
+void MainProgram::NoParConstListTestCmd()
+{
+    (ds_.*MFUNC)();
+}
+
 
 #ifdef USE_PERF_EVENT
 extern "C"
@@ -41,10 +41,29 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += \
     datastructures.cc \
     mainwindow.cc \
-    mainprogram.cc
+    mainprogram.cc \
+    snapshot.cc \
+    journal.cc \
+    bulkimport.cc \
+    shareddatastructures.cc \
+    versioneddatastructures.cc \
+    shardeddatastructures.cc \
+    queryserver.cc \
+    binaryprotocol.cc
 
 HEADERS += \
     datastructures.hh \
+    flatmap.hh \
+    chunkedvector.hh \
+    smallvector.hh \
+    binaryio.hh \
+    journal.hh \
+    bulkimport.hh \
+    shareddatastructures.hh \
+    versioneddatastructures.hh \
+    shardeddatastructures.hh \
+    queryserver.hh \
+    binaryprotocol.hh \
     mainwindow.hh \
     mainprogram.hh
 
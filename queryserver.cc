@@ -0,0 +1,708 @@
+// Queryserver.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "queryserver.hh"
+
+#include "binaryprotocol.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+QueryServer::QueryServer(Executor execute, BinaryExecutor execute_binary, unsigned int worker_count)
+    : execute_(std::move(execute)), execute_binary_(std::move(execute_binary)), worker_count_(std::max(worker_count, 1u))
+{
+}
+
+#ifdef __linux__
+
+namespace
+{
+
+// Utility function: fills in the address of the socket path, returns false if the path doesn't fit
+bool make_address(std::string const& path, sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+void watch(int epoll_fd, int fd, std::uint64_t id, std::uint32_t events, int operation = EPOLL_CTL_ADD)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    epoll_ctl(epoll_fd, operation, fd, &event);
+}
+
+}
+
+bool QueryServer::serve(std::string const& socket_path, std::ostream& log)
+{
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) {
+        log << "Invalid socket path " << socket_path << std::endl;
+        return false;
+    }
+
+    // A socket left behind by an earlier server is replaced, anything else at the path is left alone
+    struct stat existing;
+    if (lstat(socket_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        unlink(socket_path.c_str());
+    }
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0 || bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listen_fd_, SOMAXCONN) < 0) {
+        log << "Cannot listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        if (listen_fd_ >= 0) { close(listen_fd_); listen_fd_ = -1; }
+        return false;
+    }
+
+    // The stop signals are delivered through a signalfd. They are blocked before starting the workers, which
+    // inherit the mask, so that no thread gets them asynchronously.
+    sigset_t stop_signals, old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    int signal_fd = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    watch(epoll_fd_, listen_fd_, LISTENER_ID, EPOLLIN);
+    watch(epoll_fd_, wakeup_fd_, WAKEUP_ID, EPOLLIN);
+    watch(epoll_fd_, signal_fd, SIGNALS_ID, EPOLLIN);
+
+    stopping_ = false;
+    for (unsigned int i = 0; i < worker_count_; ++i) {
+        workers_.emplace_back(&QueryServer::run_worker, this);
+    }
+    log << "Serving on " << socket_path << " with " << worker_count_ << " workers" << std::endl;
+
+    std::vector<epoll_event> events(64);
+    bool stop = false;
+    while (!stop) {
+        int ready = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+        if (ready < 0) {
+            if (errno == EINTR) { continue; }
+            log << "Event loop failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            std::uint64_t id = events[i].data.u64;
+            if (id == LISTENER_ID) {
+                accept_clients();
+            } else if (id == WAKEUP_ID) {
+                collect_completions();
+            } else if (id == SIGNALS_ID) {
+                // Consumed here, a signal left pending would be delivered when the old mask is restored
+                signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) > 0) {}
+                stop = true;
+            } else {
+                // The connection may have been closed by an earlier event of the same batch
+                auto iter = connections_.find(id);
+                if (iter == connections_.end()) { continue; }
+                Connection& connection = iter->second;
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    // The client can't receive responses anymore, so its remaining commands are dropped
+                    close_connection(id);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                    read_from(id, connection);
+                    if (connections_.count(id) == 0) { continue; }
+                }
+                if (events[i].events & EPOLLOUT) {
+                    write_to(id, connection);
+                }
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        jobs_.clear();
+    }
+    job_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    completions_.clear();
+
+    while (!connections_.empty()) {
+        close_connection(connections_.begin()->first);
+    }
+    close(epoll_fd_);
+    close(wakeup_fd_);
+    close(signal_fd);
+    close(listen_fd_);
+    epoll_fd_ = wakeup_fd_ = listen_fd_ = -1;
+    unlink(socket_path.c_str());
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    log << "Server stopped" << std::endl;
+    return true;
+}
+
+void QueryServer::accept_clients()
+{
+    while (true) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            // EAGAIN once the backlog is empty; other errors (e.g. out of descriptors) drop this attempt
+            return;
+        }
+        std::uint64_t id = next_connection_id_++;
+        connections_[id].fd = fd;
+        watch(epoll_fd_, fd, id, EPOLLIN | EPOLLRDHUP);
+    }
+}
+
+void QueryServer::read_from(std::uint64_t id, Connection& connection)
+{
+    char buffer[16384];
+    while (!connection.peer_done) {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            connection.input.append(buffer, static_cast<std::size_t>(received));
+        } else if (received == 0) {
+            connection.peer_done = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            close_connection(id);
+            return;
+        }
+    }
+
+    if (connection.peer_done) {
+        // Nothing more to read, level-triggered EPOLLIN would report the end of the stream forever
+        watch(epoll_fd_, connection.fd, id, connection.writing ? EPOLLOUT : 0u, EPOLL_CTL_MOD);
+    }
+    dispatch(id, connection);
+    if (connection.protocol == Protocol::TEXT && connection.input.size() > MAX_LINE_LENGTH
+        && connection.input.find('\n') == std::string::npos) {
+        close_connection(id);
+        return;
+    }
+    close_if_finished(id, connection);
+}
+
+void QueryServer::write_to(std::uint64_t id, Connection& connection)
+{
+    std::size_t written = 0;
+    while (written < connection.output.size()) {
+        ssize_t sent = send(connection.fd, connection.output.data() + written, connection.output.size() - written,
+                            MSG_NOSIGNAL);
+        if (sent >= 0) {
+            written += static_cast<std::size_t>(sent);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            close_connection(id);
+            return;
+        }
+    }
+    connection.output.erase(0, written);
+
+    // Writability is watched only while output is waiting, otherwise every wait would return at once
+    bool writing = !connection.output.empty();
+    if (writing != connection.writing) {
+        connection.writing = writing;
+        std::uint32_t events = (connection.peer_done ? 0u : EPOLLIN | EPOLLRDHUP) | (writing ? EPOLLOUT : 0u);
+        watch(epoll_fd_, connection.fd, id, events, EPOLL_CTL_MOD);
+    }
+    close_if_finished(id, connection);
+}
+
+// One job of a connection is with the workers at a time, which keeps its responses in order
+void QueryServer::dispatch(std::uint64_t id, Connection& connection)
+{
+    if (connection.busy || connection.quitting) { return; }
+
+    if (connection.protocol == Protocol::UNKNOWN) {
+        std::size_t compared = std::min(connection.input.size(), BinaryProtocol::HELLO_SIZE);
+        if (compared == 0) { return; }
+        if (connection.input.compare(0, compared, BinaryProtocol::HELLO, compared) != 0) {
+            connection.protocol = Protocol::TEXT;
+        } else if (compared == BinaryProtocol::HELLO_SIZE) {
+            connection.protocol = Protocol::BINARY;
+            connection.input.erase(0, BinaryProtocol::HELLO_SIZE);
+        } else {
+            return; // The rest of the HELLO bytes are still on their way
+        }
+    }
+
+    if (connection.protocol == Protocol::BINARY) {
+        auto const* data = reinterpret_cast<unsigned char const*>(connection.input.data());
+        if (BinaryProtocol::payload_size(data, connection.input.size()) > BinaryProtocol::MAX_FRAME_SIZE) {
+            // The stream can't be resynchronized, so the connection is closed after the earlier responses
+            connection.quitting = true;
+            connection.input.clear();
+            return;
+        }
+    }
+
+    std::size_t size = complete_requests(connection);
+    if (size == 0) { return; }
+    Job job{id, connection.input.substr(0, size), connection.protocol == Protocol::BINARY};
+    connection.input.erase(0, size);
+    if (!job.binary) {
+        job.requests.pop_back();
+        if (!job.requests.empty() && job.requests.back() == '\r') {
+            job.requests.pop_back();
+        }
+    }
+
+    connection.busy = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(std::move(job));
+    }
+    job_ready_.notify_one();
+}
+
+std::size_t QueryServer::complete_requests(Connection const& connection) const
+{
+    if (connection.protocol == Protocol::TEXT) {
+        auto end = connection.input.find('\n');
+        return end == std::string::npos ? 0 : end + 1;
+    }
+    if (connection.protocol != Protocol::BINARY) { return 0; }
+
+    auto const* data = reinterpret_cast<unsigned char const*>(connection.input.data());
+    std::size_t available = connection.input.size();
+    std::size_t size = 0;
+    while (size < MAX_BATCH_SIZE && available - size >= BinaryProtocol::FRAME_HEADER_SIZE) {
+        std::uint32_t payload = BinaryProtocol::payload_size(data + size, available - size);
+        if (payload > BinaryProtocol::MAX_FRAME_SIZE
+            || available - size - BinaryProtocol::FRAME_HEADER_SIZE < payload) {
+            break;
+        }
+        size += BinaryProtocol::FRAME_HEADER_SIZE + payload;
+    }
+    return size;
+}
+
+void QueryServer::collect_completions()
+{
+    std::uint64_t count;
+    while (read(wakeup_fd_, &count, sizeof(count)) > 0) {}
+
+    std::vector<Completion> completed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        completed.swap(completions_);
+    }
+    for (auto& completion : completed) {
+        // The client may have gone away while its command ran
+        auto iter = connections_.find(completion.connection);
+        if (iter == connections_.end()) { continue; }
+        Connection& connection = iter->second;
+        connection.busy = false;
+        connection.output += completion.output;
+        if (connection.protocol == Protocol::TEXT) {
+            connection.output += RESPONSE_END;
+        }
+        if (!completion.keep_open) {
+            connection.quitting = true;
+            connection.input.clear();
+        }
+        dispatch(completion.connection, connection);
+        write_to(completion.connection, connection);
+    }
+}
+
+bool QueryServer::close_if_finished(std::uint64_t id, Connection& connection)
+{
+    bool more_commands = !connection.quitting && complete_requests(connection) > 0;
+    if ((connection.peer_done || connection.quitting) && !connection.busy && !more_commands
+        && connection.output.empty()) {
+        close_connection(id);
+        return true;
+    }
+    return false;
+}
+
+void QueryServer::close_connection(std::uint64_t id)
+{
+    auto iter = connections_.find(id);
+    if (iter == connections_.end()) { return; }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, iter->second.fd, nullptr);
+    close(iter->second.fd);
+    connections_.erase(iter);
+}
+
+void QueryServer::run_worker()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            job_ready_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+            if (stopping_) { return; }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+
+        std::string output;
+        bool keep_open = true;
+        if (job.binary) {
+            // Every frame of the batch gets its response frame, in order
+            ByteWriter responses;
+            auto const* data = reinterpret_cast<unsigned char const*>(job.requests.data());
+            std::size_t position = 0;
+            while (position < job.requests.size()) {
+                std::uint32_t payload = BinaryProtocol::payload_size(data + position, job.requests.size() - position);
+                position += BinaryProtocol::FRAME_HEADER_SIZE;
+                std::size_t frame = BinaryProtocol::start_frame(responses);
+                execute_binary_(data + position, payload, responses);
+                BinaryProtocol::end_frame(responses, frame);
+                position += payload;
+            }
+            output.assign(responses.bytes.begin(), responses.bytes.end());
+        } else {
+            std::ostringstream text;
+            keep_open = execute_(job.requests, text);
+            output = text.str();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            completions_.push_back({job.connection, std::move(output), keep_open});
+        }
+        std::uint64_t one = 1;
+        (void)!write(wakeup_fd_, &one, sizeof(one));
+    }
+}
+
+namespace
+{
+
+// Utility function: connects a blocking client socket, returns -1 on failure
+int connect_client(sockaddr_un const& address)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool send_all(int fd, char const* data, std::size_t size)
+{
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) { continue; }
+        if (sent <= 0) { return false; }
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+// Utility function: runs run_client(client, latencies) on a thread per client, and prints the latencies (in
+// microseconds) of all clients
+template <typename RunClient>
+bool run_clients(std::string const& socket_path, unsigned int clients, unsigned int depth, RunClient run_client,
+                 std::ostream& output)
+{
+    // Per client, so that the threads don't share anything
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<char> failed(clients, false);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned int client = 0; client < clients; ++client) {
+        threads.emplace_back([&, client]() { failed[client] = !run_client(client, latencies[client]); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> all;
+    for (auto& client_latencies : latencies) {
+        all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+    }
+    auto failures = std::count(failed.begin(), failed.end(), true);
+    if (all.empty()) {
+        output << "No responses from " << socket_path << std::endl;
+        return false;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double fraction) {
+        return all[std::min(all.size() - 1, static_cast<std::size_t>(fraction * all.size()))];
+    };
+
+    output << std::fixed << std::setprecision(1);
+    output << std::setw(8) << "clients" << std::setw(8) << "depth" << std::setw(12) << "requests" << std::setw(12)
+           << "req/s" << std::setw(12) << "p50 (us)" << std::setw(12) << "p99 (us)" << std::setw(12) << "max (us)"
+           << std::endl;
+    output << std::setw(8) << clients << std::setw(8) << depth << std::setw(12) << all.size() << std::setw(12)
+           << all.size() / elapsed.count() << std::setw(12) << percentile(0.5) << std::setw(12) << percentile(0.99)
+           << std::setw(12) << all.back() << std::endl;
+    output << std::defaultfloat;
+    if (failures > 0) {
+        output << failures << " clients failed or lost their connection" << std::endl;
+    }
+    return failures == 0;
+}
+
+// Binary client connection: frames requests and reads the response frames
+class BinaryClient
+{
+public:
+    explicit BinaryClient(int fd) : fd_(fd) {}
+
+    bool send(ByteWriter const& frames)
+    {
+        return send_all(fd_, reinterpret_cast<char const*>(frames.bytes.data()), frames.bytes.size());
+    }
+
+    // Receives the next response frame, whose payload stays valid until the next call
+    bool receive(ByteReader& payload)
+    {
+        input_.erase(input_.begin(), input_.begin() + consumed_);
+        consumed_ = 0;
+        while (input_.size() < BinaryProtocol::FRAME_HEADER_SIZE
+               || input_.size() - BinaryProtocol::FRAME_HEADER_SIZE
+                      < BinaryProtocol::payload_size(input_.data(), input_.size())) {
+            unsigned char buffer[65536];
+            ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) { continue; }
+            if (received <= 0) { return false; }
+            input_.insert(input_.end(), buffer, buffer + received);
+        }
+        std::uint32_t size = BinaryProtocol::payload_size(input_.data(), input_.size());
+        payload = ByteReader(input_.data() + BinaryProtocol::FRAME_HEADER_SIZE, size);
+        consumed_ = BinaryProtocol::FRAME_HEADER_SIZE + size;
+        return true;
+    }
+
+private:
+    int fd_;
+    std::vector<unsigned char> input_;
+    std::size_t consumed_ = 0;
+};
+
+}
+
+bool LoadGenerator::run(std::string const& socket_path, std::vector<std::string> const& commands, unsigned int clients,
+                        unsigned int repeat, std::ostream& output)
+{
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) {
+        output << "Invalid socket path " << socket_path << std::endl;
+        return false;
+    }
+
+    auto run_client = [&](unsigned int, std::vector<double>& latencies) {
+        int fd = connect_client(address);
+        if (fd < 0) { return false; }
+        latencies.reserve(commands.size() * repeat);
+        char buffer[16384];
+        bool ok = true;
+        for (unsigned int round = 0; round < repeat && ok; ++round) {
+            for (auto const& command : commands) {
+                std::string request = command + '\n';
+                auto start = std::chrono::steady_clock::now();
+                if (!send_all(fd, request.data(), request.size())) {
+                    ok = false;
+                    break;
+                }
+                // The response ends at the first RESPONSE_END, and only one request is outstanding
+                bool complete = false;
+                while (!complete) {
+                    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+                    if (received <= 0) { ok = false; break; }
+                    complete = std::memchr(buffer, QueryServer::RESPONSE_END, static_cast<std::size_t>(received)) != nullptr;
+                }
+                if (!ok) { break; }
+                std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+                latencies.push_back(elapsed.count());
+            }
+        }
+        close(fd);
+        return ok;
+    };
+    return run_clients(socket_path, std::max(clients, 1u), 1, run_client, output);
+}
+
+bool LoadGenerator::run_binary(std::string const& socket_path, unsigned int clients, unsigned int depth,
+                               unsigned int requests, std::ostream& output)
+{
+    using Opcode = BinaryProtocol::Opcode;
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) {
+        output << "Invalid socket path " << socket_path << std::endl;
+        return false;
+    }
+    depth = std::max(depth, 1u);
+
+    auto run_client = [&](unsigned int client, std::vector<double>& latencies) {
+        int fd = connect_client(address);
+        if (fd < 0) { return false; }
+        BinaryClient connection(fd);
+        ByteWriter frames;
+        frames.bytes.assign(BinaryProtocol::HELLO, BinaryProtocol::HELLO + BinaryProtocol::HELLO_SIZE);
+
+        // The IDs for the requests, fetched with two pipelined requests
+        for (auto opcode : {Opcode::ALL_PUBLICATIONS, Opcode::ALL_AFFILIATIONS}) {
+            std::size_t frame = BinaryProtocol::start_frame(frames);
+            frames.put<std::uint32_t>(0);
+            frames.put(static_cast<std::uint8_t>(opcode));
+            BinaryProtocol::end_frame(frames, frame);
+        }
+        std::vector<PublicationID> publications;
+        std::vector<AffiliationID> affiliations;
+        ByteReader payload(nullptr, 0);
+        bool ok = connection.send(frames) && connection.receive(payload);
+        if (ok) {
+            payload.get<std::uint32_t>();
+            ok = payload.get<std::uint8_t>() == static_cast<std::uint8_t>(BinaryProtocol::Status::OK);
+            publications.resize(payload.get_count(sizeof(PublicationID)));
+            for (auto& id : publications) {
+                id = payload.get<PublicationID>();
+            }
+        }
+        if (ok && connection.receive(payload)) {
+            payload.get<std::uint32_t>();
+            ok = payload.get<std::uint8_t>() == static_cast<std::uint8_t>(BinaryProtocol::Status::OK);
+            affiliations = BinaryProtocol::get_strings(payload);
+        }
+
+        // A mix of point queries and traversals, at most depth of them in flight
+        std::minstd_rand random(client + 1);
+        auto any_publication = [&]() { return publications[random() % publications.size()]; };
+        auto any_affiliation = [&]() { return affiliations[random() % affiliations.size()]; };
+        auto add_request = [&](std::uint32_t request_id) {
+            std::size_t frame = BinaryProtocol::start_frame(frames);
+            frames.put(request_id);
+            unsigned int kind = (publications.empty() || affiliations.empty()) ? 0 : 1 + request_id % 6;
+            switch (kind) {
+            case 0:
+                frames.put(static_cast<std::uint8_t>(Opcode::AFFILIATION_COUNT));
+                break;
+            case 1:
+                frames.put(static_cast<std::uint8_t>(Opcode::PUBLICATION_RECORDS));
+                frames.put<std::uint32_t>(1);
+                frames.put(any_publication());
+                break;
+            case 2:
+                frames.put(static_cast<std::uint8_t>(Opcode::AFFILIATION_RECORDS));
+                BinaryProtocol::put_strings(frames, {any_affiliation()});
+                break;
+            case 3:
+                frames.put(static_cast<std::uint8_t>(Opcode::PUBLICATIONS));
+                frames.put_string(any_affiliation());
+                break;
+            case 4:
+                frames.put(static_cast<std::uint8_t>(Opcode::ALL_REFERENCES));
+                frames.put(any_publication());
+                break;
+            case 5:
+                frames.put(static_cast<std::uint8_t>(Opcode::CLOSEST_COMMON_PARENT));
+                frames.put(any_publication());
+                frames.put(any_publication());
+                break;
+            default:
+                frames.put(static_cast<std::uint8_t>(Opcode::AFFILIATIONS_CLOSEST_TO));
+                BinaryProtocol::put_coord(frames, {static_cast<int>(random() % 10000), static_cast<int>(random() % 10000)});
+                frames.put<std::uint32_t>(3);
+                break;
+            }
+            BinaryProtocol::end_frame(frames, frame);
+        };
+
+        // The responses come in order, so the send times are a queue
+        latencies.reserve(requests);
+        std::deque<std::chrono::steady_clock::time_point> sent_at;
+        std::uint32_t sent = 0;
+        while (ok && latencies.size() < requests) {
+            frames.bytes.clear();
+            while (sent < requests && sent_at.size() < depth) {
+                add_request(sent++);
+                sent_at.push_back(std::chrono::steady_clock::now());
+            }
+            if (!frames.bytes.empty() && !connection.send(frames)) {
+                ok = false;
+                break;
+            }
+            if (!connection.receive(payload)) {
+                ok = false;
+                break;
+            }
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - sent_at.front();
+            sent_at.pop_front();
+            auto request_id = payload.get<std::uint32_t>();
+            auto status = payload.get<std::uint8_t>();
+            ok = request_id == latencies.size() && status == static_cast<std::uint8_t>(BinaryProtocol::Status::OK);
+            latencies.push_back(elapsed.count());
+        }
+        close(fd);
+        return ok;
+    };
+    return run_clients(socket_path, std::max(clients, 1u), depth, run_client, output);
+}
+
+#else
+
+bool QueryServer::serve(std::string const&, std::ostream& log)
+{
+    log << "The query server needs Linux" << std::endl;
+    return false;
+}
+
+void QueryServer::accept_clients() {}
+void QueryServer::read_from(std::uint64_t, Connection&) {}
+void QueryServer::write_to(std::uint64_t, Connection&) {}
+void QueryServer::dispatch(std::uint64_t, Connection&) {}
+std::size_t QueryServer::complete_requests(Connection const&) const { return 0; }
+void QueryServer::collect_completions() {}
+bool QueryServer::close_if_finished(std::uint64_t, Connection&) { return false; }
+void QueryServer::close_connection(std::uint64_t) {}
+void QueryServer::run_worker() {}
+
+bool LoadGenerator::run(std::string const&, std::vector<std::string> const&, unsigned int, unsigned int,
+                        std::ostream& output)
+{
+    output << "The load generator needs Linux" << std::endl;
+    return false;
+}
+
+bool LoadGenerator::run_binary(std::string const&, unsigned int, unsigned int, unsigned int, std::ostream& output)
+{
+    output << "The load generator needs Linux" << std::endl;
+    return false;
+}
+
+#endif
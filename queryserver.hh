@@ -0,0 +1,150 @@
+// Queryserver.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Server that keeps the data loaded and executes the commands of many clients over a Unix domain socket. A client
+// sends commands in the usual text syntax, one per line, and gets back the output the command would print,
+// followed by a NUL byte (RESPONSE_END), which the text output never contains. The commands of one client are
+// executed in the order they were sent, and "quit" closes the connection after its response.
+//
+// A client that starts with the HELLO bytes of BinaryProtocol speaks the binary protocol instead: length-prefixed
+// request frames, answered in order by response frames. The client may pipeline requests, and all complete frames
+// that have arrived go to the workers as one batch.
+//
+// A single thread runs the epoll event loop: it accepts the clients, reads their commands and writes the
+// responses, never blocking on either. Complete command lines go to a pool of worker threads, which hand the
+// output back to the loop through an eventfd. The workers call the executors concurrently, so the executors
+// must be thread safe; the program passes ones that run binary queries in parallel under a shared lock and
+// everything else, including all text commands, under the exclusive lock.
+//
+// The server needs Linux (epoll, eventfd, signalfd). It stops on SIGINT or SIGTERM.
+
+#ifndef QUERYSERVER_HH
+#define QUERYSERVER_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "binaryio.hh"
+
+class QueryServer
+{
+public:
+    // Executes one command line, writing its output to the stream, and returns false if the client asked to quit.
+    // Both executors are called from many workers at once.
+    using Executor = std::function<bool(std::string const& line, std::ostream& output)>;
+    // Executes one binary request payload, appending the response payload to the writer
+    using BinaryExecutor = std::function<void(unsigned char const* request, std::size_t size, ByteWriter& response)>;
+
+    static char const RESPONSE_END = '\0';
+
+    // Estimate of performance: O(w), where w is the number of workers
+    // Short rationale for estimate: Only stores the executors, the workers are started by serve.
+    QueryServer(Executor execute, BinaryExecutor execute_binary, unsigned int worker_count);
+    QueryServer(QueryServer const&) = delete;
+    QueryServer& operator=(QueryServer const&) = delete;
+
+    // Estimate of performance: runs until stopped, each event in O(1) plus the bytes it moves
+    // Short rationale for estimate: Every readiness event reads or writes what is available without blocking.
+    // Returns false, after writing the reason to the log, if the socket can't be set up.
+    bool serve(std::string const& socket_path, std::ostream& log);
+
+private:
+    enum class Protocol { UNKNOWN, TEXT, BINARY };
+
+    struct Connection
+    {
+        int fd = -1;
+        Protocol protocol = Protocol::UNKNOWN; // Decided by the first bytes received
+        std::string input;   // Received bytes not executed yet
+        std::string output;  // Response bytes not written yet
+        bool busy = false;   // Some of its commands are with the workers
+        bool peer_done = false; // The client has shut down its sending side
+        bool quitting = false;  // The client sent quit
+        bool writing = false;   // Registered for EPOLLOUT
+    };
+
+    struct Job
+    {
+        std::uint64_t connection;
+        std::string requests; // One command line, or complete binary frames
+        bool binary;
+    };
+
+    struct Completion
+    {
+        std::uint64_t connection;
+        std::string output;
+        bool keep_open;
+    };
+
+    // Utility functions of the event loop
+    void accept_clients();
+    void read_from(std::uint64_t id, Connection& connection);
+    void write_to(std::uint64_t id, Connection& connection);
+    void dispatch(std::uint64_t id, Connection& connection);
+    // Size of the complete requests at the start of the input, up to MAX_BATCH_SIZE bytes of binary frames
+    std::size_t complete_requests(Connection const& connection) const;
+    void collect_completions();
+    // Closes the connection if nothing remains to be done for it, returns true if it was closed
+    bool close_if_finished(std::uint64_t id, Connection& connection);
+    void close_connection(std::uint64_t id);
+
+    void run_worker();
+
+    // Connections whose input grows this large without a complete line are closed
+    static std::size_t const MAX_LINE_LENGTH = 1 << 20;
+    // Pipelined binary requests are handed to the workers in batches of about this many bytes
+    static std::size_t const MAX_BATCH_SIZE = 1 << 16;
+    // Event loop identifiers of the non-client descriptors, the clients are numbered after them
+    static std::uint64_t const LISTENER_ID = 0;
+    static std::uint64_t const WAKEUP_ID = 1;
+    static std::uint64_t const SIGNALS_ID = 2;
+
+    Executor execute_;
+    BinaryExecutor execute_binary_;
+    unsigned int worker_count_;
+
+    int epoll_fd_ = -1;
+    int listen_fd_ = -1;
+    int wakeup_fd_ = -1;
+    std::unordered_map<std::uint64_t, Connection> connections_;
+    std::uint64_t next_connection_id_ = SIGNALS_ID + 1;
+
+    // Queue from the event loop to the workers, and back
+    std::mutex mutex_;
+    std::condition_variable job_ready_;
+    std::deque<Job> jobs_;
+    std::vector<Completion> completions_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+// Load generator for the server: every client connects, sends the commands of a file the given number of times,
+// waiting for each response before sending the next command, and the latencies of all clients are reported.
+class LoadGenerator
+{
+public:
+    // Estimate of performance: O(c r m), where c is the number of clients, r the repeat count and m the number of
+    // commands, plus the time the server takes
+    // Short rationale for estimate: Every command is a request-response round trip.
+    static bool run(std::string const& socket_path, std::vector<std::string> const& commands, unsigned int clients,
+                    unsigned int repeat, std::ostream& output);
+
+    // Estimate of performance: O(c r), where c is the number of clients and r the requests per client, plus the
+    // time the server takes
+    // Short rationale for estimate: Every client keeps depth binary requests in flight until it has sent r.
+    // The requests are a mix of point queries and traversals over the IDs the server has, fetched first.
+    static bool run_binary(std::string const& socket_path, unsigned int clients, unsigned int depth,
+                           unsigned int requests, std::ostream& output);
+};
+
+#endif // QUERYSERVER_HH
@@ -0,0 +1,576 @@
+// Shardeddatastructures.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "shardeddatastructures.hh"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <unordered_set>
+
+ShardedDatastructures::ShardedDatastructures(unsigned int shard_count)
+{
+    shard_count = std::max(shard_count, 1u);
+    for (unsigned int shard = 0; shard < shard_count; ++shard) {
+        shards_.push_back(std::make_unique<Datastructures>());
+    }
+    // The calling thread works for the first shard itself
+    for (unsigned int shard = 1; shard < shard_count; ++shard) {
+        workers_.emplace_back(&ShardedDatastructures::run_worker, this, shard);
+    }
+}
+
+ShardedDatastructures::~ShardedDatastructures()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+unsigned int ShardedDatastructures::shard_count() const
+{
+    return shards_.size();
+}
+
+unsigned int ShardedDatastructures::shard_of(AffiliationID const& id) const
+{
+    return std::hash<AffiliationID>()(id) % shards_.size();
+}
+
+// The IDs are often consecutive, so they are mixed before taking the remainder
+unsigned int ShardedDatastructures::shard_of(PublicationID id) const
+{
+    std::uint64_t mixed = static_cast<std::uint64_t>(id) * 0x9e3779b97f4a7c15ULL;
+    return (mixed >> 32) % shards_.size();
+}
+
+bool ShardedDatastructures::has_publication(PublicationID id)
+{
+    return shards_[shard_of(id)]->get_publication_year(id) != NO_YEAR;
+}
+
+void ShardedDatastructures::add_copy(unsigned int shard, PublicationID id)
+{
+    unsigned int owner = shard_of(id);
+    if (shard != owner && shards_[shard]->get_publication_year(id) == NO_YEAR) {
+        shards_[shard]->add_publication(id, shards_[owner]->get_publication_name(id), shards_[owner]->get_publication_year(id), {});
+    }
+}
+
+void ShardedDatastructures::fan_out(std::function<void(unsigned int)> const& task)
+{
+    if (workers_.empty() || size_estimate_ < PARALLEL_MIN_SIZE) {
+        for (unsigned int shard = 0; shard < shards_.size(); ++shard) {
+            task(shard);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        ++generation_;
+        running_ = workers_.size();
+    }
+    task_ready_.notify_all();
+    task(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_done_.wait(lock, [this]() { return running_ == 0; });
+    task_ = nullptr;
+}
+
+void ShardedDatastructures::run_worker(unsigned int shard)
+{
+    std::uint64_t done_generation = 0;
+    while (true) {
+        std::function<void(unsigned int)> const* task = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_ready_.wait(lock, [this, done_generation]() { return stopping_ || generation_ != done_generation; });
+            if (stopping_) {
+                return;
+            }
+            done_generation = generation_;
+            task = task_;
+        }
+        (*task)(shard);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--running_ == 0) {
+            task_done_.notify_one();
+        }
+    }
+}
+
+unsigned int ShardedDatastructures::get_affiliation_count() const
+{
+    unsigned int count = 0;
+    for (auto const& shard : shards_) {
+        count += shard->get_affiliation_count();
+    }
+    return count;
+}
+
+void ShardedDatastructures::clear_all()
+{
+    fan_out([this](unsigned int shard) { shards_[shard]->clear_all(); });
+    size_estimate_ = 0;
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_all_affiliations()
+{
+    std::vector<std::vector<AffiliationID>> parts(shards_.size());
+    fan_out([this, &parts](unsigned int shard) { parts[shard] = shards_[shard]->get_all_affiliations(); });
+
+    std::vector<AffiliationID> result;
+    result.reserve(get_affiliation_count());
+    for (auto& part : parts) {
+        std::move(part.begin(), part.end(), std::back_inserter(result));
+    }
+    return result;
+}
+
+bool ShardedDatastructures::add_affiliation(AffiliationID id, Name const& name, Coord xy)
+{
+    if (!shards_[shard_of(id)]->add_affiliation(id, name, xy)) {
+        return false;
+    }
+    ++size_estimate_;
+    return true;
+}
+
+Name ShardedDatastructures::get_affiliation_name(AffiliationID id)
+{
+    return shards_[shard_of(id)]->get_affiliation_name(id);
+}
+
+Coord ShardedDatastructures::get_affiliation_coord(AffiliationID id)
+{
+    return shards_[shard_of(id)]->get_affiliation_coord(id);
+}
+
+bool ShardedDatastructures::change_affiliation_coord(AffiliationID id, Coord newcoord)
+{
+    return shards_[shard_of(id)]->change_affiliation_coord(id, newcoord);
+}
+
+// The copies made for the affiliation stay in its shard, they are only dropped with their publications
+bool ShardedDatastructures::remove_affiliation(AffiliationID id)
+{
+    return shards_[shard_of(id)]->remove_affiliation(id);
+}
+
+std::vector<PublicationID> ShardedDatastructures::get_publications(AffiliationID id)
+{
+    return shards_[shard_of(id)]->get_publications(id);
+}
+
+std::vector<std::pair<Year, PublicationID>> ShardedDatastructures::get_publications_after(AffiliationID affiliationid, Year year)
+{
+    return shards_[shard_of(affiliationid)]->get_publications_after(affiliationid, year);
+}
+
+template <typename Key>
+std::vector<AffiliationID> ShardedDatastructures::merge_orders(std::vector<std::vector<std::pair<Key, AffiliationID>>>& orders)
+{
+    // Heap of the next (shard, position) of every order, the smallest (key, id) on top
+    using Head = std::pair<std::size_t, std::size_t>;
+    auto later = [&orders](Head const& a, Head const& b) {
+        return orders[b.first][b.second] < orders[a.first][a.second];
+    };
+    std::vector<Head> heads;
+    std::size_t total = 0;
+    for (std::size_t shard = 0; shard < orders.size(); ++shard) {
+        if (!orders[shard].empty()) {
+            heads.emplace_back(shard, 0);
+            total += orders[shard].size();
+        }
+    }
+    std::make_heap(heads.begin(), heads.end(), later);
+
+    std::vector<AffiliationID> result;
+    result.reserve(total);
+    while (!heads.empty()) {
+        std::pop_heap(heads.begin(), heads.end(), later);
+        Head& head = heads.back();
+        result.push_back(std::move(orders[head.first][head.second].second));
+        if (++head.second < orders[head.first].size()) {
+            std::push_heap(heads.begin(), heads.end(), later);
+        } else {
+            heads.pop_back();
+        }
+    }
+    return result;
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_affiliations_alphabetically()
+{
+    std::vector<std::vector<std::pair<Name, AffiliationID>>> orders(shards_.size());
+    fan_out([this, &orders](unsigned int shard) {
+        auto& ds = *shards_[shard];
+        for (auto& id : ds.get_affiliations_alphabetically()) {
+            Name name = ds.get_affiliation_name(id);
+            orders[shard].emplace_back(std::move(name), std::move(id));
+        }
+    });
+    return merge_orders(orders);
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_affiliations_distance_increasing()
+{
+    std::vector<std::vector<std::pair<Distance, AffiliationID>>> orders(shards_.size());
+    fan_out([this, &orders](unsigned int shard) {
+        auto& ds = *shards_[shard];
+        for (auto& id : ds.get_affiliations_distance_increasing()) {
+            Distance distance = Datastructures::calculate_distance_from_origin(ds.get_affiliation_coord(id));
+            orders[shard].emplace_back(distance, std::move(id));
+        }
+    });
+    return merge_orders(orders);
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_affiliations_closest_to(Coord xy, unsigned int k)
+{
+    std::vector<std::vector<std::pair<long long, AffiliationID>>> parts(shards_.size());
+    fan_out([this, &parts, xy, k](unsigned int shard) {
+        auto& ds = *shards_[shard];
+        for (auto& id : ds.get_affiliations_closest_to(xy, k)) {
+            Coord coord = ds.get_affiliation_coord(id);
+            long long dx = static_cast<long long>(coord.x) - xy.x;
+            long long dy = static_cast<long long>(coord.y) - xy.y;
+            parts[shard].emplace_back(dx * dx + dy * dy, std::move(id));
+        }
+    });
+
+    std::vector<std::pair<long long, AffiliationID>> candidates;
+    for (auto& part : parts) {
+        std::move(part.begin(), part.end(), std::back_inserter(candidates));
+    }
+    std::size_t wanted = std::min<std::size_t>(k, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + wanted, candidates.end());
+    std::vector<AffiliationID> result;
+    result.reserve(wanted);
+    for (std::size_t i = 0; i < wanted; ++i) {
+        result.push_back(std::move(candidates[i].second));
+    }
+    return result;
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_affiliations_within(Coord xy, Distance radius)
+{
+    std::vector<std::vector<std::pair<long long, AffiliationID>>> orders(shards_.size());
+    fan_out([this, &orders, xy, radius](unsigned int shard) {
+        auto& ds = *shards_[shard];
+        for (auto& id : ds.get_affiliations_within(xy, radius)) {
+            Coord coord = ds.get_affiliation_coord(id);
+            long long dx = static_cast<long long>(coord.x) - xy.x;
+            long long dy = static_cast<long long>(coord.y) - xy.y;
+            orders[shard].emplace_back(dx * dx + dy * dy, std::move(id));
+        }
+    });
+    return merge_orders(orders);
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_affiliations_in_rect(Coord min, Coord max)
+{
+    std::vector<std::vector<std::pair<Distance, AffiliationID>>> orders(shards_.size());
+    fan_out([this, &orders, min, max](unsigned int shard) {
+        auto& ds = *shards_[shard];
+        for (auto& id : ds.get_affiliations_in_rect(min, max)) {
+            Distance distance = Datastructures::calculate_distance_from_origin(ds.get_affiliation_coord(id));
+            orders[shard].emplace_back(distance, std::move(id));
+        }
+    });
+    return merge_orders(orders);
+}
+
+AffiliationID ShardedDatastructures::find_affiliation_with_coord(Coord xy)
+{
+    for (auto& shard : shards_) {
+        AffiliationID id = shard->find_affiliation_with_coord(xy);
+        if (id != NO_AFFILIATION) {
+            return id;
+        }
+    }
+    return NO_AFFILIATION;
+}
+
+bool ShardedDatastructures::add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations)
+{
+    unsigned int owner = shard_of(id);
+    if (!shards_[owner]->add_publication(id, name, year, affiliations)) {
+        return false;
+    }
+    ++size_estimate_;
+
+    // Every shard ignores the affiliations it doesn't have, so the copies get the whole list too
+    std::vector<unsigned int> copied{owner};
+    for (auto const& affiliation : affiliations) {
+        unsigned int shard = shard_of(affiliation);
+        if (std::find(copied.begin(), copied.end(), shard) == copied.end()) {
+            shards_[shard]->add_publication(id, name, year, affiliations);
+            copied.push_back(shard);
+        }
+    }
+    return true;
+}
+
+bool ShardedDatastructures::add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid)
+{
+    unsigned int shard = shard_of(affiliationid);
+    if (!has_publication(publicationid) || shards_[shard]->get_affiliation_name(affiliationid) == NO_NAME) {
+        return false;
+    }
+    add_copy(shard, publicationid);
+    return shards_[shard]->add_affiliation_to_publication(affiliationid, publicationid);
+}
+
+// The reference goes to the owners of both ends, each with a copy of the other end if needed
+bool ShardedDatastructures::add_reference(PublicationID id, PublicationID parentid)
+{
+    if (!has_publication(id) || !has_publication(parentid)) {
+        return false;
+    }
+    unsigned int child_shard = shard_of(id);
+    unsigned int parent_shard = shard_of(parentid);
+    add_copy(parent_shard, id);
+    shards_[parent_shard]->add_reference(id, parentid);
+    if (child_shard != parent_shard) {
+        add_copy(child_shard, parentid);
+        shards_[child_shard]->add_reference(id, parentid);
+    }
+    return true;
+}
+
+Name ShardedDatastructures::get_publication_name(PublicationID id)
+{
+    return shards_[shard_of(id)]->get_publication_name(id);
+}
+
+Year ShardedDatastructures::get_publication_year(PublicationID id)
+{
+    return shards_[shard_of(id)]->get_publication_year(id);
+}
+
+PublicationID ShardedDatastructures::get_parent(PublicationID id)
+{
+    return shards_[shard_of(id)]->get_parent(id);
+}
+
+std::vector<PublicationID> ShardedDatastructures::get_direct_references(PublicationID id)
+{
+    return shards_[shard_of(id)]->get_direct_references(id);
+}
+
+std::vector<AffiliationID> ShardedDatastructures::get_affiliations(PublicationID id)
+{
+    unsigned int owner = shard_of(id);
+    if (!has_publication(id)) {
+        return {};
+    }
+    std::vector<AffiliationID> result = shards_[owner]->get_affiliations(id);
+    for (unsigned int shard = 0; shard < shards_.size(); ++shard) {
+        if (shard != owner) {
+            auto part = shards_[shard]->get_affiliations(id);
+            std::move(part.begin(), part.end(), std::back_inserter(result));
+        }
+    }
+    return result;
+}
+
+std::vector<PublicationID> ShardedDatastructures::all_publications()
+{
+    std::vector<std::vector<PublicationID>> parts(shards_.size());
+    fan_out([this, &parts](unsigned int shard) {
+        for (PublicationID id : shards_[shard]->all_publications()) {
+            if (shard_of(id) == shard) {
+                parts[shard].push_back(id);
+            }
+        }
+    });
+
+    std::vector<PublicationID> result;
+    for (auto const& part : parts) {
+        result.insert(result.end(), part.begin(), part.end());
+    }
+    return result;
+}
+
+// A shard knows everything its own publications are linked to, but a copy of another shard's publication only
+// some of its links. So every publication found as a copy is expanded again in its owner. Expanded and reported
+// publications are tracked apart: the start is expanded first but only reported if a reference cycle leads back
+// to it, as in a single Datastructures.
+template <typename Query>
+std::vector<PublicationID> ShardedDatastructures::collect_across_shards(PublicationID id, Query query)
+{
+    if (!has_publication(id)) {
+        return {NO_PUBLICATION};
+    }
+
+    std::vector<PublicationID> result;
+    std::unordered_set<PublicationID> reported;
+    std::unordered_set<PublicationID> expanded{id};
+    std::vector<PublicationID> unexpanded{id};
+    while (!unexpanded.empty()) {
+        PublicationID current = unexpanded.back();
+        unexpanded.pop_back();
+        unsigned int shard = shard_of(current);
+        for (PublicationID reached : query(*shards_[shard], current)) {
+            if (!reported.insert(reached).second) {
+                continue;
+            }
+            result.push_back(reached);
+            if (shard_of(reached) != shard && expanded.insert(reached).second) {
+                unexpanded.push_back(reached);
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<PublicationID> ShardedDatastructures::get_all_references(PublicationID id)
+{
+    return collect_across_shards(id, [](Datastructures& ds, PublicationID current) { return ds.get_all_references(current); });
+}
+
+std::vector<PublicationID> ShardedDatastructures::get_referenced_by_chain(PublicationID id)
+{
+    return collect_across_shards(id, [](Datastructures& ds, PublicationID current) { return ds.get_referenced_by_chain(current); });
+}
+
+int ShardedDatastructures::count_all_references(PublicationID id)
+{
+    if (!has_publication(id)) {
+        return NO_VALUE;
+    }
+    return get_all_references(id).size();
+}
+
+// Same result as get_closest_common_parent of a single Datastructures: a parent whose chain of parents runs into
+// a reference cycle counts as a root of its own, so it is only the common parent of publications sharing it
+PublicationID ShardedDatastructures::get_closest_common_parent(PublicationID id1, PublicationID id2)
+{
+    PublicationID parent1 = get_parent(id1);
+    PublicationID parent2 = get_parent(id2);
+    if (!has_publication(parent1) || !has_publication(parent2)) {
+        return NO_PUBLICATION;
+    }
+
+    // Returns false if the climb runs into a reference cycle
+    auto climb = [this](PublicationID start, std::vector<PublicationID>& ancestors) {
+        std::unordered_set<PublicationID> seen;
+        for (PublicationID current = start; current != NO_PUBLICATION; current = get_parent(current)) {
+            if (!seen.insert(current).second) {
+                return false;
+            }
+            ancestors.push_back(current);
+        }
+        return true;
+    };
+    std::vector<PublicationID> ancestors1;
+    std::vector<PublicationID> ancestors2;
+    if (!climb(parent1, ancestors1) || !climb(parent2, ancestors2)) {
+        return parent1 == parent2 ? parent1 : NO_PUBLICATION;
+    }
+    std::unordered_set<PublicationID> common(ancestors1.begin(), ancestors1.end());
+    for (PublicationID ancestor : ancestors2) {
+        if (common.count(ancestor) != 0) {
+            return ancestor;
+        }
+    }
+    return NO_PUBLICATION;
+}
+
+bool ShardedDatastructures::remove_publication(PublicationID publicationid)
+{
+    if (!shards_[shard_of(publicationid)]->remove_publication(publicationid)) {
+        return false;
+    }
+    for (auto& shard : shards_) {
+        shard->remove_publication(publicationid);
+    }
+    return true;
+}
+
+unsigned int ShardedDatastructures::add_affiliations(std::vector<AffiliationRecord> const& records)
+{
+    std::vector<std::vector<AffiliationRecord>> parts(shards_.size());
+    for (auto const& record : records) {
+        parts[shard_of(record.id)].push_back(record);
+    }
+
+    std::vector<unsigned int> added(shards_.size(), 0);
+    fan_out([this, &parts, &added](unsigned int shard) { added[shard] = shards_[shard]->add_affiliations(parts[shard]); });
+    unsigned int total = 0;
+    for (unsigned int count : added) {
+        total += count;
+    }
+    size_estimate_ += total;
+    return total;
+}
+
+// The owners decide which records are added, so that the copies are made only for those
+unsigned int ShardedDatastructures::add_publications(std::vector<PublicationRecord> const& records)
+{
+    std::vector<std::vector<PublicationRecord>> parts(shards_.size());
+    std::unordered_set<PublicationID> batch;
+    unsigned int total = 0;
+    for (auto const& record : records) {
+        if (has_publication(record.id) || !batch.insert(record.id).second) {
+            continue;
+        }
+        ++total;
+        unsigned int owner = shard_of(record.id);
+        parts[owner].push_back(record);
+        std::vector<unsigned int> copied{owner};
+        for (auto const& affiliation : record.affiliations) {
+            unsigned int shard = shard_of(affiliation);
+            if (std::find(copied.begin(), copied.end(), shard) == copied.end()) {
+                parts[shard].push_back(record);
+                copied.push_back(shard);
+            }
+        }
+    }
+
+    fan_out([this, &parts](unsigned int shard) { shards_[shard]->add_publications(parts[shard]); });
+    size_estimate_ += total;
+    return total;
+}
+
+unsigned int ShardedDatastructures::add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references)
+{
+    std::vector<std::vector<PublicationRecord>> copies(shards_.size());
+    std::vector<std::vector<std::pair<PublicationID, PublicationID>>> parts(shards_.size());
+    auto copy_of = [this](PublicationID id) {
+        auto& owner = *shards_[shard_of(id)];
+        return PublicationRecord{id, owner.get_publication_name(id), owner.get_publication_year(id), {}};
+    };
+    unsigned int total = 0;
+    for (auto const& reference : references) {
+        auto [id, parentid] = reference;
+        if (!has_publication(id) || !has_publication(parentid)) {
+            continue;
+        }
+        ++total;
+        unsigned int child_shard = shard_of(id);
+        unsigned int parent_shard = shard_of(parentid);
+        parts[parent_shard].push_back(reference);
+        if (child_shard != parent_shard) {
+            // The shards skip the copies they already have
+            copies[parent_shard].push_back(copy_of(id));
+            copies[child_shard].push_back(copy_of(parentid));
+            parts[child_shard].push_back(reference);
+        }
+    }
+
+    fan_out([this, &copies, &parts](unsigned int shard) {
+        shards_[shard]->add_publications(copies[shard]);
+        shards_[shard]->add_references(parts[shard]);
+    });
+    return total;
+}
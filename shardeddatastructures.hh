@@ -0,0 +1,167 @@
+// Shardeddatastructures.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Front-end that partitions the data across several Datastructures instances (shards) by ID hash. Operations on
+// a single affiliation or publication go to the shard owning it, and the queries over all affiliations fan out
+// to every shard in parallel and merge the per-shard results.
+//
+// A publication is stored in full in its owner shard. Links to other shards are kept with copies of the
+// publication (same ID, name and year) in the shards that need them:
+// - the shard of each of its affiliations, so that get_publications and get_publications_after need only that
+//   shard;
+// - the shard of its parent and of each publication referencing it, so that a reference is stored in the owners
+//   of both ends. The owner of a publication therefore knows its parent and everything referencing it.
+// Traversals run inside one shard at a time and continue from every copy they reach in the shard owning it.
+// Copies are left out of the global listings and removed together with the publication.
+//
+// The front-end itself isn't thread safe: the parallelism is inside the fan-out queries and bulk additions.
+
+#ifndef SHARDEDDATASTRUCTURES_HH
+#define SHARDEDDATASTRUCTURES_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "datastructures.hh"
+
+class ShardedDatastructures
+{
+public:
+    // Estimate of performance: O(s), where s is the number of shards
+    // Short rationale for estimate: Creates the shards and a worker thread for each shard but the first.
+    explicit ShardedDatastructures(unsigned int shard_count);
+    ~ShardedDatastructures();
+    ShardedDatastructures(ShardedDatastructures const&) = delete;
+    ShardedDatastructures& operator=(ShardedDatastructures const&) = delete;
+
+    unsigned int shard_count() const;
+
+    // Estimate of performance: O(s)
+    // Short rationale for estimate: Sums the counts of the shards.
+    unsigned int get_affiliation_count() const;
+
+    // Estimate of performance: O(n / s) per shard, in parallel
+    // Short rationale for estimate: Clears every shard.
+    void clear_all();
+
+    // Estimate of performance: O(n / s) in parallel, plus O(n) to concatenate
+    // Short rationale for estimate: Every shard lists its own affiliations.
+    std::vector<AffiliationID> get_all_affiliations();
+
+    // Point operations on affiliations. Estimate of performance: that of the operation in one shard
+    // Short rationale for estimate: The ID hash picks the owning shard.
+    bool add_affiliation(AffiliationID id, Name const& name, Coord xy);
+    Name get_affiliation_name(AffiliationID id);
+    Coord get_affiliation_coord(AffiliationID id);
+    bool change_affiliation_coord(AffiliationID id, Coord newcoord);
+    bool remove_affiliation(AffiliationID id);
+    std::vector<PublicationID> get_publications(AffiliationID id);
+    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year);
+
+    // Estimate of performance: O(n / s) in parallel, plus O(n log s) for the k-way merge
+    // Short rationale for estimate: Every shard returns its own order, which are merged with a heap of s entries.
+    std::vector<AffiliationID> get_affiliations_alphabetically();
+    std::vector<AffiliationID> get_affiliations_distance_increasing();
+
+    // Estimate of performance: that of the query in one shard, run in parallel, plus O(s k log(s k)) to merge
+    // Short rationale for estimate: Every shard finds its own k closest, and the k closest of those are the result.
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy, unsigned int k = 3);
+    // Estimate of performance: that of the query in one shard, run in parallel, plus O(r log r) to sort the r found
+    std::vector<AffiliationID> get_affiliations_within(Coord xy, Distance radius);
+    std::vector<AffiliationID> get_affiliations_in_rect(Coord min, Coord max);
+
+    // Estimate of performance: O(s) times that of the query in one shard
+    // Short rationale for estimate: The first shard with an affiliation at the coordinate answers.
+    AffiliationID find_affiliation_with_coord(Coord xy);
+
+    // Estimate of performance: that of add_publication in one shard, times the number of shards involved
+    // Short rationale for estimate: The owner gets the publication, the shards of the other affiliations a copy.
+    bool add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations);
+    bool add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid);
+    bool add_reference(PublicationID id, PublicationID parentid);
+
+    // Point operations on publications. Estimate of performance: that of the operation in one shard
+    Name get_publication_name(PublicationID id);
+    Year get_publication_year(PublicationID id);
+    PublicationID get_parent(PublicationID id);
+    std::vector<PublicationID> get_direct_references(PublicationID id);
+
+    // Estimate of performance: O(s) times that of the query in one shard
+    // Short rationale for estimate: Each shard holding the publication knows its own affiliations of it.
+    std::vector<AffiliationID> get_affiliations(PublicationID id);
+
+    // Estimate of performance: O(n / s) in parallel, plus O(n) to concatenate
+    // Short rationale for estimate: Every shard lists the publications it owns.
+    std::vector<PublicationID> all_publications();
+
+    // Estimate of performance: O(r) plus the traversals in the shards, where r is the size of the result
+    // Short rationale for estimate: Every reached publication is expanded once, inside the shard owning it.
+    // The order of the result may differ from that of a single Datastructures.
+    std::vector<PublicationID> get_all_references(PublicationID id);
+    std::vector<PublicationID> get_referenced_by_chain(PublicationID id);
+    int count_all_references(PublicationID id);
+
+    // Estimate of performance: O(d), where d is the depth of the publications
+    // Short rationale for estimate: Climbs the parent links of both publications across the shards.
+    PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2);
+
+    // Estimate of performance: O(s) times that of remove_publication in one shard
+    // Short rationale for estimate: The publication and its copies are removed from every shard.
+    bool remove_publication(PublicationID publicationid);
+
+    // Estimate of performance: O(b) to partition the batch, plus the bulk addition in every shard in parallel
+    // Short rationale for estimate: Each shard gets its part of the batch, including the copies it needs.
+    unsigned int add_affiliations(std::vector<AffiliationRecord> const& records);
+    unsigned int add_publications(std::vector<PublicationRecord> const& records);
+    unsigned int add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references);
+
+private:
+    unsigned int shard_of(AffiliationID const& id) const;
+    unsigned int shard_of(PublicationID id) const;
+
+    // Utility function: whether the owner shard has the publication
+    bool has_publication(PublicationID id);
+
+    // Utility function: adds a copy of a publication owned by another shard, unless the shard has one already
+    void add_copy(unsigned int shard, PublicationID id);
+
+    // Utility function: runs task(shard) for every shard, in parallel on the shard workers once the data is
+    // large enough to pay for the synchronization
+    void fan_out(std::function<void(unsigned int)> const& task);
+    void run_worker(unsigned int shard);
+
+    // Utility function: everything reachable from id, where query(shard, id) returns what is reachable inside
+    // one shard
+    template <typename Query>
+    std::vector<PublicationID> collect_across_shards(PublicationID id, Query query);
+
+    // Utility function: merges the per-shard orders of (key, id) pairs
+    template <typename Key>
+    static std::vector<AffiliationID> merge_orders(std::vector<std::vector<std::pair<Key, AffiliationID>>>& orders);
+
+    // Fan-outs over fewer affiliations and publications than this run on the calling thread
+    static std::size_t const PARALLEL_MIN_SIZE = 4096;
+
+    std::vector<std::unique_ptr<Datastructures>> shards_;
+    std::size_t size_estimate_ = 0; // Affiliations and publications added, for choosing between parallel and not
+
+    // Shard workers: each task is a new generation, which every worker runs once for its own shard
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable task_ready_;
+    std::condition_variable task_done_;
+    std::function<void(unsigned int)> const* task_ = nullptr;
+    std::uint64_t generation_ = 0;
+    unsigned int running_ = 0;
+    bool stopping_ = false;
+};
+
+#endif // SHARDEDDATASTRUCTURES_HH
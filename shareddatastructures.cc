@@ -0,0 +1,227 @@
+// Shareddatastructures.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "shareddatastructures.hh"
+
+SharedDatastructures::SharedDatastructures(Datastructures& ds) : ds_(ds)
+{
+}
+
+template <typename Query>
+auto SharedDatastructures::read(Query query) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    while (!ds_.prepared_for_reads()) {
+        // Another reader may have prepared the indexes while this one waited for the exclusive lock
+        lock.unlock();
+        {
+            std::unique_lock<std::shared_mutex> exclusive(mutex_);
+            if (!ds_.prepared_for_reads()) {
+                ds_.prepare_for_reads();
+            }
+        }
+        lock.lock();
+    }
+    return query(std::as_const(ds_));
+}
+
+template <typename Mutation>
+auto SharedDatastructures::write(Mutation mutation)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    return mutation(ds_);
+}
+
+unsigned int SharedDatastructures::get_affiliation_count() const
+{
+    return read([](Datastructures const& ds) { return ds.get_affiliation_count(); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_all_affiliations() const
+{
+    return read([](Datastructures const& ds) { return ds.get_all_affiliations(); });
+}
+
+Name SharedDatastructures::get_affiliation_name(AffiliationID id) const
+{
+    return read([&id](Datastructures const& ds) { return ds.get_affiliation_name(id); });
+}
+
+Coord SharedDatastructures::get_affiliation_coord(AffiliationID id) const
+{
+    return read([&id](Datastructures const& ds) { return ds.get_affiliation_coord(id); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations_alphabetically() const
+{
+    return read([](Datastructures const& ds) { return ds.get_affiliations_alphabetically(); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations_distance_increasing() const
+{
+    return read([](Datastructures const& ds) { return ds.get_affiliations_distance_increasing(); });
+}
+
+AffiliationID SharedDatastructures::find_affiliation_with_coord(Coord xy) const
+{
+    return read([xy](Datastructures const& ds) { return ds.find_affiliation_with_coord(xy); });
+}
+
+std::vector<PublicationID> SharedDatastructures::all_publications() const
+{
+    return read([](Datastructures const& ds) { return ds.all_publications(); });
+}
+
+Name SharedDatastructures::get_publication_name(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_publication_name(id); });
+}
+
+Year SharedDatastructures::get_publication_year(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_publication_year(id); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_affiliations(id); });
+}
+
+std::vector<PublicationID> SharedDatastructures::get_direct_references(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_direct_references(id); });
+}
+
+std::vector<PublicationID> SharedDatastructures::get_publications(AffiliationID id) const
+{
+    return read([&id](Datastructures const& ds) { return ds.get_publications(id); });
+}
+
+PublicationID SharedDatastructures::get_parent(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_parent(id); });
+}
+
+std::vector<std::pair<Year, PublicationID>> SharedDatastructures::get_publications_after(AffiliationID affiliationid, Year year) const
+{
+    return read([&affiliationid, year](Datastructures const& ds) { return ds.get_publications_after(affiliationid, year); });
+}
+
+std::vector<PublicationID> SharedDatastructures::get_referenced_by_chain(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_referenced_by_chain(id); });
+}
+
+std::vector<PublicationID> SharedDatastructures::get_all_references(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.get_all_references(id); });
+}
+
+int SharedDatastructures::count_all_references(PublicationID id) const
+{
+    return read([id](Datastructures const& ds) { return ds.count_all_references(id); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations_closest_to(Coord xy) const
+{
+    return read([xy](Datastructures const& ds) { return ds.get_affiliations_closest_to(xy); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations_closest_to(Coord xy, unsigned int k) const
+{
+    return read([xy, k](Datastructures const& ds) { return ds.get_affiliations_closest_to(xy, k); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations_within(Coord xy, Distance radius) const
+{
+    return read([xy, radius](Datastructures const& ds) { return ds.get_affiliations_within(xy, radius); });
+}
+
+std::vector<AffiliationID> SharedDatastructures::get_affiliations_in_rect(Coord min, Coord max) const
+{
+    return read([min, max](Datastructures const& ds) { return ds.get_affiliations_in_rect(min, max); });
+}
+
+PublicationID SharedDatastructures::get_closest_common_parent(PublicationID id1, PublicationID id2) const
+{
+    return read([id1, id2](Datastructures const& ds) { return ds.get_closest_common_parent(id1, id2); });
+}
+
+std::vector<PublicationID> SharedDatastructures::get_closest_common_parents(std::vector<std::pair<PublicationID, PublicationID>> const& pairs) const
+{
+    return read([&pairs](Datastructures const& ds) { return ds.get_closest_common_parents(pairs); });
+}
+
+void SharedDatastructures::clear_all()
+{
+    write([](Datastructures& ds) { ds.clear_all(); });
+}
+
+bool SharedDatastructures::add_affiliation(AffiliationID id, Name const& name, Coord xy)
+{
+    return write([&](Datastructures& ds) { return ds.add_affiliation(id, name, xy); });
+}
+
+bool SharedDatastructures::change_affiliation_coord(AffiliationID id, Coord newcoord)
+{
+    return write([&](Datastructures& ds) { return ds.change_affiliation_coord(id, newcoord); });
+}
+
+bool SharedDatastructures::add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations)
+{
+    return write([&](Datastructures& ds) { return ds.add_publication(id, name, year, affiliations); });
+}
+
+unsigned int SharedDatastructures::add_affiliations(std::vector<AffiliationRecord> const& records)
+{
+    return write([&records](Datastructures& ds) { return ds.add_affiliations(records); });
+}
+
+unsigned int SharedDatastructures::add_publications(std::vector<PublicationRecord> const& records)
+{
+    return write([&records](Datastructures& ds) { return ds.add_publications(records); });
+}
+
+unsigned int SharedDatastructures::add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references)
+{
+    return write([&references](Datastructures& ds) { return ds.add_references(references); });
+}
+
+bool SharedDatastructures::add_reference(PublicationID id, PublicationID parentid)
+{
+    return write([id, parentid](Datastructures& ds) { return ds.add_reference(id, parentid); });
+}
+
+bool SharedDatastructures::add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid)
+{
+    return write([&affiliationid, publicationid](Datastructures& ds) {
+        return ds.add_affiliation_to_publication(affiliationid, publicationid);
+    });
+}
+
+bool SharedDatastructures::remove_affiliation(AffiliationID id)
+{
+    return write([&id](Datastructures& ds) { return ds.remove_affiliation(id); });
+}
+
+bool SharedDatastructures::remove_publication(PublicationID publicationid)
+{
+    return write([publicationid](Datastructures& ds) { return ds.remove_publication(publicationid); });
+}
+
+// Saving doesn't change the data, but it checkpoints the journal, so it's exclusive too
+bool SharedDatastructures::save_snapshot(std::string const& filename)
+{
+    return write([&filename](Datastructures& ds) { return ds.save_snapshot(filename); });
+}
+
+bool SharedDatastructures::load_snapshot(std::string const& filename)
+{
+    return write([&filename](Datastructures& ds) { return ds.load_snapshot(filename); });
+}
+
+void SharedDatastructures::run_exclusive(std::function<void(Datastructures&)> const& function)
+{
+    write([&function](Datastructures& ds) { function(ds); });
+}
@@ -0,0 +1,89 @@
+// Shareddatastructures.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Front-end that lets many threads use one Datastructures at the same time. Queries take a shared lock and call
+// the const query functions, which don't modify anything, so any number of them run in parallel. Mutations take
+// the exclusive lock. Datastructures keeps some of its indexes lazily up to date; when a query finds them out of
+// date it takes the exclusive lock once to call prepare_for_reads, after which the queries run shared again.
+
+#ifndef SHAREDDATASTRUCTURES_HH
+#define SHAREDDATASTRUCTURES_HH
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "datastructures.hh"
+
+class SharedDatastructures
+{
+public:
+    explicit SharedDatastructures(Datastructures& ds);
+
+    // Queries, see the corresponding functions of Datastructures. Estimate of performance: that of the const
+    // version of the query, plus a prepare_for_reads after each batch of mutations.
+    unsigned int get_affiliation_count() const;
+    std::vector<AffiliationID> get_all_affiliations() const;
+    Name get_affiliation_name(AffiliationID id) const;
+    Coord get_affiliation_coord(AffiliationID id) const;
+    std::vector<AffiliationID> get_affiliations_alphabetically() const;
+    std::vector<AffiliationID> get_affiliations_distance_increasing() const;
+    AffiliationID find_affiliation_with_coord(Coord xy) const;
+    std::vector<PublicationID> all_publications() const;
+    Name get_publication_name(PublicationID id) const;
+    Year get_publication_year(PublicationID id) const;
+    std::vector<AffiliationID> get_affiliations(PublicationID id) const;
+    std::vector<PublicationID> get_direct_references(PublicationID id) const;
+    std::vector<PublicationID> get_publications(AffiliationID id) const;
+    PublicationID get_parent(PublicationID id) const;
+    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year) const;
+    std::vector<PublicationID> get_referenced_by_chain(PublicationID id) const;
+    std::vector<PublicationID> get_all_references(PublicationID id) const;
+    int count_all_references(PublicationID id) const;
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy) const;
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy, unsigned int k) const;
+    std::vector<AffiliationID> get_affiliations_within(Coord xy, Distance radius) const;
+    std::vector<AffiliationID> get_affiliations_in_rect(Coord min, Coord max) const;
+    PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2) const;
+    std::vector<PublicationID> get_closest_common_parents(std::vector<std::pair<PublicationID, PublicationID>> const& pairs) const;
+
+    // Mutations, see the corresponding functions of Datastructures. Estimate of performance: that of the
+    // mutation, after waiting for the running queries to finish.
+    void clear_all();
+    bool add_affiliation(AffiliationID id, Name const& name, Coord xy);
+    bool change_affiliation_coord(AffiliationID id, Coord newcoord);
+    bool add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations);
+    unsigned int add_affiliations(std::vector<AffiliationRecord> const& records);
+    unsigned int add_publications(std::vector<PublicationRecord> const& records);
+    unsigned int add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references);
+    bool add_reference(PublicationID id, PublicationID parentid);
+    bool add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid);
+    bool remove_affiliation(AffiliationID id);
+    bool remove_publication(PublicationID publicationid);
+    bool save_snapshot(std::string const& filename);
+    bool load_snapshot(std::string const& filename);
+
+    // Estimate of performance: that of the function, after waiting for the running queries to finish
+    // Short rationale for estimate: The function runs under the exclusive lock.
+    // Runs the function on the Datastructures, for callers that need more than one call at a time or use the
+    // non-const functions directly.
+    void run_exclusive(std::function<void(Datastructures&)> const& function);
+
+private:
+    // Utility function: runs query(ds) under the shared lock, preparing the lazy indexes first if needed
+    template <typename Query>
+    auto read(Query query) const;
+
+    // Utility function: runs mutation(ds) under the exclusive lock
+    template <typename Mutation>
+    auto write(Mutation mutation);
+
+    Datastructures& ds_;
+    mutable std::shared_mutex mutex_;
+};
+
+#endif // SHAREDDATASTRUCTURES_HH
@@ -0,0 +1,147 @@
+// Smallvector.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Vector of trivially copyable elements that keeps up to N elements inside the object itself and only
+// allocates when it grows beyond that. The inline buffer shares its space with the heap pointer, so with
+// N * sizeof(T) <= 16 the whole object is as small as a std::vector.
+
+#ifndef SMALLVECTOR_HH
+#define SMALLVECTOR_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename T, unsigned int N>
+class SmallVector
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SmallVector copies its elements with memcpy");
+    static_assert(N > 0, "SmallVector needs room for at least one inline element");
+
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = T const*;
+
+    SmallVector() = default;
+
+    SmallVector(SmallVector const& other)
+    {
+        reserve(other.size_);
+        std::memcpy(data(), other.data(), other.size_ * sizeof(T));
+        size_ = other.size_;
+    }
+
+    SmallVector(SmallVector&& other) noexcept : size_(other.size_), capacity_(other.capacity_)
+    {
+        std::memcpy(&storage_, &other.storage_, sizeof(storage_));
+        other.size_ = 0;
+        other.capacity_ = N;
+    }
+
+    SmallVector& operator=(SmallVector other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~SmallVector()
+    {
+        if (!is_inline()) {
+            delete[] storage_.heap;
+        }
+    }
+
+    void swap(SmallVector& other) noexcept
+    {
+        Storage storage = storage_;
+        storage_ = other.storage_;
+        other.storage_ = storage;
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    T* data() { return is_inline() ? storage_.inline_elements : storage_.heap; }
+    T const* data() const { return is_inline() ? storage_.inline_elements : storage_.heap; }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + size_; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size_; }
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    T& operator[](std::size_t i) { return data()[i]; }
+    T const& operator[](std::size_t i) const { return data()[i]; }
+    T& front() { return data()[0]; }
+    T const& front() const { return data()[0]; }
+    T& back() { return data()[size_ - 1]; }
+    T const& back() const { return data()[size_ - 1]; }
+
+    void push_back(T const& value)
+    {
+        if (size_ == capacity_) {
+            T copy = value; // The value may live in the buffer that is about to be reallocated
+            reserve(2 * static_cast<std::size_t>(capacity_));
+            data()[size_++] = copy;
+        } else {
+            data()[size_++] = value;
+        }
+    }
+
+    void pop_back() { --size_; }
+
+    // Erases [first, last), to be used with std::remove like std::vector::erase
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        T* begin_ptr = data();
+        T* first_ptr = begin_ptr + (first - begin_ptr);
+        std::size_t tail = end() - last;
+        std::memmove(first_ptr, last, tail * sizeof(T));
+        size_ -= static_cast<std::uint32_t>(last - first);
+        return first_ptr;
+    }
+
+    void clear() { size_ = 0; }
+
+    // Releases the heap buffer as well, unlike clear
+    void reset() { *this = SmallVector(); }
+
+    void reserve(std::size_t capacity)
+    {
+        if (capacity <= capacity_) {
+            return;
+        }
+        T* heap = new T[capacity];
+        std::memcpy(heap, data(), size_ * sizeof(T));
+        if (!is_inline()) {
+            delete[] storage_.heap;
+        }
+        storage_.heap = heap;
+        capacity_ = static_cast<std::uint32_t>(capacity);
+    }
+
+    // Copy for the public interface, which returns std::vectors
+    std::vector<T> to_vector() const { return std::vector<T>(begin(), end()); }
+
+private:
+    bool is_inline() const { return capacity_ == N; }
+
+    union Storage
+    {
+        T inline_elements[N];
+        T* heap;
+    };
+
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = N;
+    Storage storage_{};
+};
+
+#endif // SMALLVECTOR_HH
@@ -0,0 +1,288 @@
+// Snapshot.cc
+//
+// Student name: Taisto Tammilehto
+//
+// Binary snapshots of a Datastructures instance. A snapshot is a 32-byte header followed by the payload:
+//
+//   magic "SCHNSNAP" | version (u32) | reserved (u32) | payload size (u64) | FNV-1a 64 checksum of the payload (u64)
+//
+// All integers are little-endian and strings are a u32 length followed by the bytes. The payload holds the
+// affiliation slots by handle (including the free ones), the two affiliation orders, the publications and the
+// citation graph in its compacted CSR form, so loading only copies arrays instead of re-running the
+// insertions, sorts and graph compaction. The CSR edge arrays are written block by block, so that the positions of
+// the slices stay valid.
+// The ancestor index and the subtree layout are rebuilt lazily by the first query that needs them.
+
+#include "datastructures.hh"
+#include "binaryio.hh"
+#include "journal.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+
+char const SNAPSHOT_MAGIC[8] = {'S', 'C', 'H', 'N', 'S', 'N', 'A', 'P'};
+std::uint32_t const SNAPSHOT_VERSION = 3;
+std::size_t const SNAPSHOT_HEADER_SIZE = 32;
+
+} // namespace
+
+// Writes all affiliations, publications and references to a snapshot file, returns false if the file can't be written
+bool Datastructures::save_snapshot(std::string const& filename)
+{
+    // The snapshot stores the graph in CSR form and the name order as a set, so bring both up to date first
+    if (!csr_compacted || csr_delta_edges > 0 || !reverse_references.empty()) {
+        compact_citation_graph();
+    }
+    update_sorted_affiliations_by_name();
+    update_sorted_affiliations_by_distance();
+
+    ByteWriter writer;
+
+    // Affiliation slots by handle, the free ones included so that the handles stay valid. They are read through
+    // const references, so that chunks shared with copies aren't cloned.
+    writer.put<std::uint32_t>(affiliation_ids.size());
+    for (AffiliationHandle handle = 0; handle < affiliation_ids.size(); ++handle) {
+        writer.put_string(std::as_const(affiliation_ids)[handle]);
+        writer.put_string(std::as_const(affiliation_names)[handle]);
+        writer.put<std::int32_t>(std::as_const(affiliation_xs)[handle]);
+        writer.put<std::int32_t>(std::as_const(affiliation_ys)[handle]);
+        writer.put_array(std::as_const(affiliation_publications)[handle]);
+        auto const& index = std::as_const(affiliation_years)[handle];
+        writer.put<std::uint32_t>(index.entries.size());
+        for (auto [year, publicationid] : index.entries) {
+            writer.put<Year>(year);
+            writer.put<PublicationID>(publicationid);
+        }
+        writer.put<std::uint32_t>(index.sorted_size);
+    }
+    writer.put_array(free_affiliation_handles);
+    writer.put_array(sorted_affiliations_by_name);
+    writer.put_array(sorted_affiliations_by_distance);
+
+    // Publications with their slices of the CSR edge arrays
+    writer.put<std::uint32_t>(publications.size());
+    for (auto const& [id, info] : std::as_const(publications)) {
+        writer.put<PublicationID>(id);
+        writer.put_string(info.name);
+        writer.put<Year>(info.year);
+        writer.put_array(info.affiliations);
+        writer.put<PublicationID>(info.parent);
+        CsrSlices slice;
+        auto const& slices = csr_slices;
+        auto slice_it = slices.find(id);
+        if (slice_it != slices.end()) {
+            slice = slice_it->second;
+        }
+        writer.put<std::uint32_t>(slice.references_begin);
+        writer.put<std::uint32_t>(slice.references_count);
+        writer.put<std::uint32_t>(slice.referrers_begin);
+        writer.put<std::uint32_t>(slice.referrers_count);
+    }
+    for (auto const* edges : {&csr_references, &csr_referrers}) {
+        writer.put<std::uint32_t>(edges->block_count());
+        for (std::size_t block = 0; block < edges->block_count(); ++block) {
+            writer.put_array(edges->block(block));
+        }
+    }
+
+    ByteWriter header;
+    header.bytes.assign(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC));
+    header.put<std::uint32_t>(SNAPSHOT_VERSION);
+    header.put<std::uint32_t>(0);
+    header.put<std::uint64_t>(writer.bytes.size());
+    header.put<std::uint64_t>(fnv1a(writer.bytes.data(), writer.bytes.size()));
+
+    // The journal may only be cut once the snapshot is durable, otherwise a crash could lose both
+    if (!replace_file(filename, {&header.bytes, &writer.bytes})) {
+        return false;
+    }
+
+    // Everything journaled so far is in the snapshot
+    if (journal) {
+        journal->checkpoint();
+    }
+    return true;
+}
+
+// Replaces the contents with those of a snapshot file. Returns false, leaving the contents untouched, if the file
+// can't be read or its header or checksum don't match. A file that passes the checksum but is still inconsistent
+// leaves the data structure empty.
+bool Datastructures::load_snapshot(std::string const& filename)
+{
+    // Loading isn't journaled as mutations, the journal restarts from the loaded snapshot instead
+    auto active_journal = std::move(journal);
+    bool loaded = read_snapshot(filename);
+    journal = std::move(active_journal);
+    if (loaded && journal) {
+        journal->checkpoint();
+    }
+    return loaded;
+}
+
+bool Datastructures::read_snapshot(std::string const& filename)
+{
+    MappedFile file(filename);
+    if (file.data() == nullptr || file.size() < SNAPSHOT_HEADER_SIZE
+        || std::memcmp(file.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        return false;
+    }
+    ByteReader header(file.data() + sizeof(SNAPSHOT_MAGIC), SNAPSHOT_HEADER_SIZE - sizeof(SNAPSHOT_MAGIC));
+    std::uint32_t version = header.get<std::uint32_t>();
+    header.get<std::uint32_t>();
+    std::uint64_t payload_size = header.get<std::uint64_t>();
+    std::uint64_t checksum = header.get<std::uint64_t>();
+    unsigned char const* payload = file.data() + SNAPSHOT_HEADER_SIZE;
+    if (version != SNAPSHOT_VERSION || payload_size != file.size() - SNAPSHOT_HEADER_SIZE
+        || checksum != fnv1a(payload, payload_size)) {
+        return false;
+    }
+
+    clear_all();
+    ByteReader reader(payload, payload_size);
+    auto fail = [this]() {
+        clear_all();
+        return false;
+    };
+
+    // Affiliation slots
+    std::uint32_t slot_count = reader.get<std::uint32_t>();
+    affiliation_ids.reserve(slot_count);
+    affiliation_names.reserve(slot_count);
+    affiliation_xs.reserve(slot_count);
+    affiliation_ys.reserve(slot_count);
+    affiliation_publications.reserve(slot_count);
+    affiliation_years.reserve(slot_count);
+    AffiliationIndexes& indexes = writable_affiliation_indexes();
+    indexes.handles.reserve(slot_count);
+    for (AffiliationHandle handle = 0; handle < slot_count && !reader.failed; ++handle) {
+        affiliation_ids.push_back(reader.get_string());
+        affiliation_names.push_back(reader.get_string());
+        affiliation_xs.push_back(reader.get<std::int32_t>());
+        affiliation_ys.push_back(reader.get<std::int32_t>());
+        auto& affiliation_publication_list = affiliation_publications.emplace_back();
+        std::uint32_t publication_count = reader.get_count(sizeof(PublicationID));
+        affiliation_publication_list.reserve(publication_count);
+        for (std::uint32_t i = 0; i < publication_count; ++i) {
+            affiliation_publication_list.push_back(reader.get<PublicationID>());
+        }
+        auto& index = affiliation_years.emplace_back();
+        std::uint32_t entry_count = reader.get_count(sizeof(Year) + sizeof(PublicationID));
+        index.entries.reserve(entry_count);
+        for (std::uint32_t i = 0; i < entry_count; ++i) {
+            Year year = reader.get<Year>();
+            index.entries.emplace_back(year, reader.get<PublicationID>());
+        }
+        index.sorted_size = std::min<std::size_t>(reader.get<std::uint32_t>(), index.entries.size());
+        if (!index.sorted()) {
+            unsorted_year_indexes.push_back(handle);
+        }
+        if (affiliation_ids.back() != NO_AFFILIATION) {
+            auto const& id = affiliation_ids.back();
+            if (!indexes.handles.emplace(id, handle).second) {
+                return fail();
+            }
+        }
+    }
+
+    // Free handles and the two orders, which were written sorted, so they are read back as they are
+    std::uint32_t free_count = reader.get_count(sizeof(AffiliationHandle));
+    for (std::uint32_t i = 0; i < free_count; ++i) {
+        free_affiliation_handles.push_back(reader.get<AffiliationHandle>());
+    }
+    std::uint32_t name_count = reader.get_count(sizeof(AffiliationHandle));
+    for (std::uint32_t i = 0; i < name_count; ++i) {
+        AffiliationHandle handle = reader.get<AffiliationHandle>();
+        if (handle >= slot_count) {
+            return fail();
+        }
+        sorted_affiliations_by_name.push_back(handle);
+    }
+    std::uint32_t distance_count = reader.get_count(sizeof(AffiliationHandle));
+    for (std::uint32_t i = 0; i < distance_count; ++i) {
+        AffiliationHandle handle = reader.get<AffiliationHandle>();
+        if (handle >= slot_count) {
+            return fail();
+        }
+        sorted_affiliations_by_distance.push_back(handle);
+    }
+    for (AffiliationHandle handle : free_affiliation_handles) {
+        if (handle >= slot_count) {
+            return fail();
+        }
+    }
+    if (reader.failed || name_count != indexes.handles.size() || distance_count != indexes.handles.size()) {
+        return fail();
+    }
+
+    // Publications and their CSR slices
+    std::uint32_t publication_count = reader.get<std::uint32_t>();
+    for (std::uint32_t i = 0; i < publication_count && !reader.failed; ++i) {
+        PublicationID id = reader.get<PublicationID>();
+        if (id == NO_PUBLICATION || publications.count(id) != 0) {
+            return fail();
+        }
+        PublicationInfo& info = publications[id];
+        info.name = reader.get_string();
+        info.year = reader.get<Year>();
+        std::uint32_t affiliation_count = reader.get_count(sizeof(AffiliationHandle));
+        info.affiliations.reserve(affiliation_count);
+        for (std::uint32_t j = 0; j < affiliation_count; ++j) {
+            AffiliationHandle handle = reader.get<AffiliationHandle>();
+            if (handle >= slot_count) {
+                return fail();
+            }
+            info.affiliations.push_back(handle);
+        }
+        info.parent = reader.get<PublicationID>();
+        CsrSlices& slice = csr_slices[id];
+        slice.references_begin = reader.get<std::uint32_t>();
+        slice.references_count = reader.get<std::uint32_t>();
+        slice.referrers_begin = reader.get<std::uint32_t>();
+        slice.referrers_count = reader.get<std::uint32_t>();
+    }
+
+    // The edge arrays block by block, after which every slice and every referenced publication must be known to
+    // be valid
+    for (auto* edges : {&csr_references, &csr_referrers}) {
+        std::vector<std::vector<PublicationID>> blocks(reader.get_count(sizeof(std::uint32_t)));
+        for (auto& block : blocks) {
+            block.resize(reader.get_count(sizeof(PublicationID)));
+            for (auto& edge : block) {
+                edge = reader.get<PublicationID>();
+            }
+        }
+        edges->assign_blocks(std::move(blocks));
+    }
+    if (reader.failed || !reader.at_end()) {
+        return fail();
+    }
+    // Removals leave stale IDs between the slices, so only the edges inside them are checked
+    auto valid_slice = [this](ChunkedSlices<PublicationID> const& edges, unsigned int begin, unsigned int count) {
+        if (!edges.contains(begin, count)) {
+            return false;
+        }
+        PublicationID const* first = edges.data(begin);
+        return std::all_of(first, first + count, [this](PublicationID edge) { return publications.count(edge) != 0; });
+    };
+    for (auto const& [id, slice] : csr_slices) {
+        if (!valid_slice(csr_references, slice.references_begin, slice.references_count)
+            || !valid_slice(csr_referrers, slice.referrers_begin, slice.referrers_count)) {
+            return fail();
+        }
+    }
+    for (auto const& [id, info] : publications) {
+        if (info.parent != NO_PUBLICATION && publications.count(info.parent) == 0) {
+            return fail();
+        }
+    }
+
+    csr_compacted = true;
+    csr_delta_edges = 0;
+    ancestor_index_valid = false;
+    rebuild_affiliation_grid();
+    return true;
+}
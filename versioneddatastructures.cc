@@ -0,0 +1,163 @@
+// Versioneddatastructures.cc
+//
+// Student name: Taisto Tammilehto
+
+#include "versioneddatastructures.hh"
+
+#include <algorithm>
+
+VersionedDatastructures::ReadView::ReadView(std::atomic<std::uint64_t>* slot, Datastructures const* data, std::uint64_t version)
+    : slot_(slot), data_(data), version_(version)
+{
+}
+
+VersionedDatastructures::ReadView::ReadView(ReadView&& other) noexcept
+    : slot_(other.slot_), data_(other.data_), version_(other.version_)
+{
+    other.slot_ = nullptr;
+}
+
+VersionedDatastructures::ReadView::~ReadView()
+{
+    if (slot_) {
+        slot_->store(0, std::memory_order_release);
+    }
+}
+
+VersionedDatastructures::VersionedDatastructures(Datastructures const& initial) : working_(initial)
+{
+    publish();
+}
+
+// Every reader must have dropped its view by now
+VersionedDatastructures::~VersionedDatastructures()
+{
+    delete current_.load();
+}
+
+unsigned int VersionedDatastructures::register_reader()
+{
+    for (unsigned int reader = 0; reader < MAX_READERS; ++reader) {
+        bool free = false;
+        if (readers_[reader].in_use.compare_exchange_strong(free, true)) {
+            return reader;
+        }
+    }
+    return NO_READER;
+}
+
+void VersionedDatastructures::unregister_reader(unsigned int reader)
+{
+    readers_[reader].epoch.store(0);
+    readers_[reader].in_use.store(false);
+}
+
+// The epoch is stored before the version is loaded. If the writer retires the loaded version after that, it also
+// sees the pinned epoch when reclaiming, and if it reclaimed before the store, the load already finds the newer
+// version. Both orders rely on the sequentially consistent stores and loads.
+VersionedDatastructures::ReadView VersionedDatastructures::read(unsigned int reader) const
+{
+    auto& slot = readers_[reader].epoch;
+    slot.store(global_epoch_.load());
+    Version const* version = current_.load();
+    return ReadView(&slot, &version->data, version->number);
+}
+
+template <typename Result>
+Result VersionedDatastructures::mutated(Result result, std::size_t count)
+{
+    pending_mutations_ += count;
+    if (pending_mutations_ >= std::max(PUBLISH_MIN, published_size_ / PUBLISH_FRACTION)) {
+        publish();
+    }
+    return result;
+}
+
+bool VersionedDatastructures::add_affiliation(AffiliationID id, Name const& name, Coord xy)
+{
+    return mutated(working_.add_affiliation(id, name, xy));
+}
+
+bool VersionedDatastructures::change_affiliation_coord(AffiliationID id, Coord newcoord)
+{
+    return mutated(working_.change_affiliation_coord(id, newcoord));
+}
+
+bool VersionedDatastructures::add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations)
+{
+    return mutated(working_.add_publication(id, name, year, affiliations));
+}
+
+bool VersionedDatastructures::add_reference(PublicationID id, PublicationID parentid)
+{
+    return mutated(working_.add_reference(id, parentid));
+}
+
+bool VersionedDatastructures::add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid)
+{
+    return mutated(working_.add_affiliation_to_publication(affiliationid, publicationid));
+}
+
+bool VersionedDatastructures::remove_affiliation(AffiliationID id)
+{
+    return mutated(working_.remove_affiliation(id));
+}
+
+bool VersionedDatastructures::remove_publication(PublicationID publicationid)
+{
+    return mutated(working_.remove_publication(publicationid));
+}
+
+unsigned int VersionedDatastructures::add_affiliations(std::vector<AffiliationRecord> const& records)
+{
+    return mutated(working_.add_affiliations(records), records.size());
+}
+
+unsigned int VersionedDatastructures::add_publications(std::vector<PublicationRecord> const& records)
+{
+    return mutated(working_.add_publications(records), records.size());
+}
+
+unsigned int VersionedDatastructures::add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references)
+{
+    return mutated(working_.add_references(references), references.size());
+}
+
+void VersionedDatastructures::publish()
+{
+    // The published copy is immutable, so its lazy indexes have to be up to date before copying. The readers'
+    // traversals without the subtree layout count towards rebuilding it, as they would on the working copy.
+    Version const* published = current_.load();
+    if (published) {
+        working_.take_traversal_work(published->data);
+    }
+    working_.prepare_for_copies();
+    auto version = std::unique_ptr<Version>(new Version{working_, ++versions_published_});
+    published_size_ = working_.get_affiliation_count() + working_.get_publication_count();
+    pending_mutations_ = 0;
+
+    Version* replaced = current_.exchange(version.release());
+    if (replaced) {
+        retired_.emplace_back(global_epoch_.fetch_add(1), std::unique_ptr<Version>(replaced));
+    }
+    reclaim();
+}
+
+void VersionedDatastructures::reclaim()
+{
+    std::uint64_t oldest_pinned = std::numeric_limits<std::uint64_t>::max();
+    for (auto const& reader : readers_) {
+        std::uint64_t epoch = reader.epoch.load();
+        if (epoch != 0) {
+            oldest_pinned = std::min(oldest_pinned, epoch);
+        }
+    }
+
+    // The versions were retired in epoch order. A reader that pinned an epoch after the retirement of a version
+    // loaded a newer one.
+    auto first_kept = std::partition_point(retired_.begin(), retired_.end(), [oldest_pinned](auto const& retired) {
+        return retired.first < oldest_pinned;
+    });
+    versions_freed_ += first_kept - retired_.begin();
+    retired_.erase(retired_.begin(), first_kept);
+}
@@ -0,0 +1,140 @@
+// Versioneddatastructures.hh
+//
+// Student name: Taisto Tammilehto
+//
+// Multi-version front-end: readers query immutable published versions of the data and never wait for the writer,
+// and the writer never waits for the readers.
+//
+// A single writer thread applies the mutations to a private working copy. Every so often the working copy is
+// prepared for reads, copied and published as the current version with an atomic pointer swap. The copy shares the
+// chunks of the working copy's storage (see chunkedvector.hh), and the writer clones a chunk before changing it if
+// a version still shares it. Publishing thus copies one pointer per chunk plus the chunks written since the
+// previous version, so versions are published after a small number of mutations relative to the size of the data,
+// and the versions together take little more memory than one copy.
+//
+// A reader pins the current global epoch in its slot before loading the current version, and clears the slot
+// when it is done. A replaced version is retired with the epoch at which it was replaced, and freed once every
+// pinned slot holds a later epoch, i.e. once no reader can still be looking at it (epoch-based reclamation).
+
+#ifndef VERSIONEDDATASTRUCTURES_HH
+#define VERSIONEDDATASTRUCTURES_HH
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "datastructures.hh"
+
+class VersionedDatastructures
+{
+public:
+    // Maximum number of readers registered at the same time
+    static constexpr unsigned int MAX_READERS = 64;
+    static unsigned int const NO_READER = std::numeric_limits<unsigned int>::max();
+
+    // Pinned view of one published version, valid until destroyed. Queries go through the const functions of
+    // Datastructures, e.g. view->get_all_references(id).
+    class ReadView
+    {
+    public:
+        ReadView(ReadView&& other) noexcept;
+        ReadView(ReadView const&) = delete;
+        ReadView& operator=(ReadView const&) = delete;
+        ~ReadView();
+
+        Datastructures const* operator->() const { return data_; }
+        Datastructures const& operator*() const { return *data_; }
+        // Number of the published version, counting from 1
+        std::uint64_t version() const { return version_; }
+
+    private:
+        friend class VersionedDatastructures;
+        ReadView(std::atomic<std::uint64_t>* slot, Datastructures const* data, std::uint64_t version);
+
+        std::atomic<std::uint64_t>* slot_;
+        Datastructures const* data_;
+        std::uint64_t version_;
+    };
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: Copies the initial data into the working copy and publishes it as version 1.
+    explicit VersionedDatastructures(Datastructures const& initial);
+    ~VersionedDatastructures();
+
+    // Estimate of performance: O(MAX_READERS)
+    // Short rationale for estimate: Claims the first free reader slot, returns NO_READER if all are taken.
+    unsigned int register_reader();
+    void unregister_reader(unsigned int reader);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Stores the epoch in the reader's slot and loads the current version. A reader
+    // may hold one view at a time.
+    ReadView read(unsigned int reader) const;
+
+    // Writer side, called from one thread only. Estimate of performance: that of the mutation on the working
+    // copy, plus amortized O(PUBLISH_FRACTION / c) for publishing, where c is the number of elements in a chunk
+    bool add_affiliation(AffiliationID id, Name const& name, Coord xy);
+    bool change_affiliation_coord(AffiliationID id, Coord newcoord);
+    bool add_publication(PublicationID id, Name const& name, Year year, std::vector<AffiliationID> const& affiliations);
+    bool add_reference(PublicationID id, PublicationID parentid);
+    bool add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid);
+    bool remove_affiliation(AffiliationID id);
+    bool remove_publication(PublicationID publicationid);
+    unsigned int add_affiliations(std::vector<AffiliationRecord> const& records);
+    unsigned int add_publications(std::vector<PublicationRecord> const& records);
+    unsigned int add_references(std::vector<std::pair<PublicationID, PublicationID>> const& references);
+
+    // Estimate of performance: O(n / c + m), where c is the number of elements in a chunk and m the number of
+    // mutations since the previous publish, plus the lazy rebuilds that are due
+    // Short rationale for estimate: Prepares and copies the working copy, which shares all but the chunks the
+    // mutations wrote, swaps it in and frees the retired versions no reader can see anymore.
+    void publish();
+
+    // Statistics for the benchmark
+    std::uint64_t versions_published() const { return versions_published_; }
+    std::uint64_t versions_freed() const { return versions_freed_; }
+    std::size_t versions_retired() const { return retired_.size(); }
+
+private:
+    struct Version
+    {
+        Datastructures data;
+        std::uint64_t number;
+    };
+
+    // Utility function: counts a mutation and publishes once enough of them have been made
+    template <typename Result>
+    Result mutated(Result result, std::size_t count = 1);
+
+    // Utility function: frees the retired versions older than every pinned epoch
+    void reclaim();
+
+    // Versions are published after max(PUBLISH_MIN, size / PUBLISH_FRACTION) mutations
+    static constexpr std::size_t PUBLISH_FRACTION = 1024;
+    static constexpr std::size_t PUBLISH_MIN = 64;
+
+    // Each slot on a cache line of its own, so that pinning doesn't invalidate the lines of the other readers
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<std::uint64_t> epoch{0}; // 0 while not pinned
+        std::atomic<bool> in_use{false};
+    };
+    mutable std::array<ReaderSlot, MAX_READERS> readers_;
+
+    std::atomic<std::uint64_t> global_epoch_{1};
+    std::atomic<Version*> current_{nullptr};
+    std::vector<std::pair<std::uint64_t, std::unique_ptr<Version>>> retired_; // (epoch when retired, version)
+
+    Datastructures working_;
+    std::size_t pending_mutations_ = 0;
+    std::size_t published_size_ = 0; // Affiliations and publications in the last published version
+    std::uint64_t versions_published_ = 0;
+    std::uint64_t versions_freed_ = 0;
+};
+
+#endif // VERSIONEDDATASTRUCTURES_HH